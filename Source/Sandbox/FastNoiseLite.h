@@ -51,6 +51,7 @@
 #define FASTNOISELITE_H
 
 #include <cmath>
+#include <cstdint>
 
 class FastNoiseLite
 {
@@ -153,6 +154,11 @@ public:
     /// </remarks>
     void SetFrequency(float frequency) { mFrequency = frequency; }
 
+    /// <summary>
+    /// Frequency set through SetFrequency(...)
+    /// </summary>
+    float GetFrequency() const { return mFrequency; }
+
     /// <summary>
     /// Sets noise algorithm used for GetNoise(...)
     /// </summary>
@@ -312,6 +318,185 @@ public:
         }
     }
 
+    /// <summary>
+    /// Whether GetNoiseWithGradient is analytic for the current settings
+    /// </summary>
+    /// <remarks>
+    /// True for Perlin, OpenSimplex2 and OpenSimplex2S, with no fractal or FBm
+    /// </remarks>
+    bool HasAnalyticGradient() const
+    {
+        const bool bGradientNoise = mNoiseType == NoiseType_Perlin || mNoiseType == NoiseType_OpenSimplex2 || mNoiseType == NoiseType_OpenSimplex2S;
+        return bGradientNoise && (mFractalType == FractalType_None || mFractalType == FractalType_FBm);
+    }
+
+    /// <summary>
+    /// Hash of every setting that changes the output, stable across runs and machines
+    /// </summary>
+    /// <remarks>
+    /// FNV-1a over the settings, for keying generated data kept on disk
+    /// </remarks>
+    uint64_t GetConfigHash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* data, size_t size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        auto mixInt = [&mix](int value) { mix(&value, sizeof(value)); };
+        auto mixFloat = [&mix](float value) { mix(&value, sizeof(value)); };
+
+        mixInt(mSeed);
+        mixFloat(mFrequency);
+        mixInt((int)mNoiseType);
+        mixInt((int)mRotationType3D);
+        mixInt((int)mTransformType3D);
+        mixInt((int)mFractalType);
+        mixInt(mOctaves);
+        mixFloat(mLacunarity);
+        mixFloat(mGain);
+        mixFloat(mWeightedStrength);
+        mixFloat(mPingPongStength);
+        mixInt((int)mCellularDistanceFunction);
+        mixInt((int)mCellularReturnType);
+        mixFloat(mCellularJitterModifier);
+        mixInt((int)mDomainWarpType);
+        mixInt((int)mWarpTransformType3D);
+        mixFloat(mDomainWarpAmp);
+        return hash;
+    }
+
+    /// <summary>
+    /// Upper bound on |GetNoise(x, y)| for the current settings
+    /// </summary>
+    /// <remarks>
+    /// Hybrid cellular distances reach past 1, everything else stays near the documented -1...1
+    /// </remarks>
+    float GetOutputBound() const
+    {
+        const float single = IsHybridCellular() ? 3.2f : 1.1f;
+        switch (mFractalType)
+        {
+            default:
+            case FractalType_FBm:
+                return single;
+            case FractalType_Ridged:
+                return FastMax(1.0f, 2 * single - 1);
+            case FractalType_PingPong:
+                return 1.0f;
+        }
+    }
+
+    /// <summary>
+    /// Upper bound on the gradient length of GetNoise(x, y) with respect to the input position
+    /// </summary>
+    /// <returns>
+    /// Negative when there is no finite bound: cellular cell values, ratios and Manhattan
+    /// distances step, and weighted octaves or jitter past 1 are not covered
+    /// </returns>
+    /// <remarks>
+    /// Sum over octaves of amplitude * lacunarity^i * frequency * the steepest slope of one octave,
+    /// which was measured per noise type on dense samples and carries a 25% margin
+    /// </remarks>
+    float GetGradientBound() const
+    {
+        float single;
+        switch (mNoiseType)
+        {
+            case NoiseType_OpenSimplex2: single = 7.4f; break;
+            case NoiseType_OpenSimplex2S: single = 4.65f; break;
+            case NoiseType_Perlin: single = 2.95f; break;
+            case NoiseType_ValueCubic: single = 1.45f; break;
+            case NoiseType_Value: single = 2.95f; break;
+            case NoiseType_Cellular:
+            {
+                const bool bSteps = mCellularReturnType == CellularReturnType_CellValue || mCellularReturnType == CellularReturnType_Distance2Div
+                    || mCellularJitterModifier > 1 || mCellularDistanceFunction == CellularDistanceFunction_Manhattan
+                    || (mCellularDistanceFunction == CellularDistanceFunction_Hybrid && mCellularReturnType != CellularReturnType_Distance);
+                if (bSteps)
+                {
+                    return -1;
+                }
+                single = mCellularDistanceFunction == CellularDistanceFunction_Euclidean ? 2.05f
+                    : mCellularDistanceFunction == CellularDistanceFunction_EuclideanSq ? 4.4f : 4.35f;
+                break;
+            }
+            default: return -1;
+        }
+        single *= 1.25f;
+
+        float octave;
+        switch (mFractalType)
+        {
+            default:
+                return single * FastAbs(mFrequency);
+            case FractalType_FBm: octave = single; break;
+            case FractalType_Ridged: octave = 2 * single; break;
+            case FractalType_PingPong: octave = 2 * FastAbs(mPingPongStength) * single; break;
+        }
+        if (mWeightedStrength != 0)
+        {
+            return -1;
+        }
+
+        float bound = 0;
+        float amp = mFractalBounding;
+        float frequency = FastAbs(mFrequency);
+        for (int i = 0; i < mOctaves; i++)
+        {
+            bound += amp * frequency * octave;
+            amp *= FastAbs(mGain);
+            frequency *= FastAbs(mLacunarity);
+        }
+        return bound;
+    }
+
+    /// <summary>
+    /// 2D noise and its derivatives with respect to the input position using current settings
+    /// </summary>
+    /// <returns>
+    /// Same value as GetNoise(x, y)
+    /// </returns>
+    /// <remarks>
+    /// One evaluation when HasAnalyticGradient(), central differences otherwise
+    /// </remarks>
+    template <typename FNfloat>
+    float GetNoiseWithGradient(FNfloat x, FNfloat y, float& outDx, float& outDy)
+    {
+        Arguments_must_be_floating_point_values<FNfloat>();
+
+        if (!HasAnalyticGradient())
+        {
+            const FNfloat h = (FNfloat)(0.001f / mFrequency);
+            outDx = (float)((GetNoise(x + h, y) - GetNoise(x - h, y)) / (2 * h));
+            outDy = (float)((GetNoise(x, y + h) - GetNoise(x, y - h)) / (2 * h));
+            return GetNoise(x, y);
+        }
+
+        // The simplex skew applied here is undone by the unskew inside the single noise
+        // functions, so their corner offsets move 1:1 with the frequency scaled input and
+        // only the frequency is left for the chain rule.
+        TransformNoiseCoordinate(x, y);
+
+        float value;
+        if (mFractalType == FractalType_FBm)
+        {
+            value = GenFractalFBmWithGradient(x, y, outDx, outDy);
+        }
+        else
+        {
+            value = GenNoiseSingleWithGradient(mSeed, x, y, outDx, outDy);
+        }
+
+        outDx *= mFrequency;
+        outDy *= mFrequency;
+        return value;
+    }
+
     /// <summary>
     /// 3D noise at given position using current settings
     /// </summary>
@@ -470,6 +655,11 @@ private:
         return t < 1 ? t : 2 - t;
     }
 
+    bool IsHybridCellular() const
+    {
+        return mNoiseType == NoiseType_Cellular && mCellularDistanceFunction == CellularDistanceFunction_Hybrid;
+    }
+
     void CalculateFractalBounding()
     {
         float gain = FastAbs(mGain);
@@ -539,6 +729,33 @@ private:
     }
 
 
+    void GradCoordVector(int seed, int xPrimed, int yPrimed, float& xg, float& yg)
+    {
+        int hash = Hash(seed, xPrimed, yPrimed);
+        hash ^= hash >> 15;
+        hash &= 127 << 1;
+
+        xg = Lookup<float>::Gradients2D[hash];
+        yg = Lookup<float>::Gradients2D[hash | 1];
+    }
+
+
+    // Adds a^4 * (g . d) and its derivatives with respect to d, for a = r^2 - |d|^2
+    void SimplexCornerWithGradient(int seed, int xPrimed, int yPrimed, float a, float xd, float yd, float& value, float& dx, float& dy)
+    {
+        float xg, yg;
+        GradCoordVector(seed, xPrimed, yPrimed, xg, yg);
+
+        float dot = xd * xg + yd * yg;
+        float a3 = a * a * a;
+        float a4 = a3 * a;
+
+        value += a4 * dot;
+        dx += a4 * xg - 8 * a3 * xd * dot;
+        dy += a4 * yg - 8 * a3 * yd * dot;
+    }
+
+
     float GradCoord(int seed, int xPrimed, int yPrimed, int zPrimed, float xd, float yd, float zd)
     {
         int hash = Hash(seed, xPrimed, yPrimed, zPrimed);
@@ -635,6 +852,24 @@ private:
         }
     }
 
+    template <typename FNfloat>
+    float GenNoiseSingleWithGradient(int seed, FNfloat x, FNfloat y, float& outDx, float& outDy)
+    {
+        switch (mNoiseType)
+        {
+            case NoiseType_OpenSimplex2:
+                return SingleSimplexWithGradient(seed, x, y, outDx, outDy);
+            case NoiseType_OpenSimplex2S:
+                return SingleOpenSimplex2SWithGradient(seed, x, y, outDx, outDy);
+            case NoiseType_Perlin:
+                return SinglePerlinWithGradient(seed, x, y, outDx, outDy);
+            default:
+                outDx = 0;
+                outDy = 0;
+                return 0;
+        }
+    }
+
     template <typename FNfloat>
     float GenNoiseSingle(int seed, FNfloat x, FNfloat y, FNfloat z)
     {
@@ -862,6 +1097,43 @@ private:
         return sum;
     }
 
+    template <typename FNfloat>
+    float GenFractalFBmWithGradient(FNfloat x, FNfloat y, float& outDx, float& outDy)
+    {
+        int seed = mSeed;
+        float sum = 0;
+        float amp = mFractalBounding;
+        float ampDx = 0, ampDy = 0;
+        float scale = 1;
+        outDx = 0;
+        outDy = 0;
+
+        for (int i = 0; i < mOctaves; i++)
+        {
+            float noiseDx, noiseDy;
+            float noise = GenNoiseSingleWithGradient(seed++, x, y, noiseDx, noiseDy);
+            noiseDx *= scale;
+            noiseDy *= scale;
+
+            sum += noise * amp;
+            outDx += noiseDx * amp + noise * ampDx;
+            outDy += noiseDy * amp + noise * ampDy;
+
+            // Weighted strength makes the next amplitude depend on this octave
+            float weight = Lerp(1.0f, FastMin(noise + 1, 2) * 0.5f, mWeightedStrength);
+            float weightSlope = noise + 1 < 2 ? 0.5f * mWeightedStrength : 0;
+            ampDx = (ampDx * weight + amp * weightSlope * noiseDx) * mGain;
+            ampDy = (ampDy * weight + amp * weightSlope * noiseDy) * mGain;
+            amp *= weight * mGain;
+
+            x *= mLacunarity;
+            y *= mLacunarity;
+            scale *= mLacunarity;
+        }
+
+        return sum;
+    }
+
     template <typename FNfloat>
     float GenFractalFBm(FNfloat x, FNfloat y, FNfloat z)
     {
@@ -1050,6 +1322,68 @@ private:
         return (n0 + n1 + n2) * 99.83685446303647f;
     }
 
+    template <typename FNfloat>
+    float SingleSimplexWithGradient(int seed, FNfloat x, FNfloat y, float& outDx, float& outDy)
+    {
+        // Same lattice walk as SingleSimplex, corners also accumulate their derivatives
+
+        const float SQRT3 = 1.7320508075688772935274463415059f;
+        const float G2 = (3 - SQRT3) / 6;
+
+        int i = FastFloor(x);
+        int j = FastFloor(y);
+        float xi = (float)(x - i);
+        float yi = (float)(y - j);
+
+        float t = (xi + yi) * G2;
+        float x0 = (float)(xi - t);
+        float y0 = (float)(yi - t);
+
+        i *= PrimeX;
+        j *= PrimeY;
+
+        float value = 0, dx = 0, dy = 0;
+
+        float a = 0.5f - x0 * x0 - y0 * y0;
+        if (a > 0)
+        {
+            SimplexCornerWithGradient(seed, i, j, a, x0, y0, value, dx, dy);
+        }
+
+        float x2 = x0 + (2 * (float)G2 - 1);
+        float y2 = y0 + (2 * (float)G2 - 1);
+        float c = 0.5f - x2 * x2 - y2 * y2;
+        if (c > 0)
+        {
+            SimplexCornerWithGradient(seed, i + PrimeX, j + PrimeY, c, x2, y2, value, dx, dy);
+        }
+
+        if (y0 > x0)
+        {
+            float x1 = x0 + (float)G2;
+            float y1 = y0 + ((float)G2 - 1);
+            float b = 0.5f - x1 * x1 - y1 * y1;
+            if (b > 0)
+            {
+                SimplexCornerWithGradient(seed, i, j + PrimeY, b, x1, y1, value, dx, dy);
+            }
+        }
+        else
+        {
+            float x1 = x0 + ((float)G2 - 1);
+            float y1 = y0 + (float)G2;
+            float b = 0.5f - x1 * x1 - y1 * y1;
+            if (b > 0)
+            {
+                SimplexCornerWithGradient(seed, i + PrimeX, j, b, x1, y1, value, dx, dy);
+            }
+        }
+
+        outDx = dx * 99.83685446303647f;
+        outDy = dy * 99.83685446303647f;
+        return value * 99.83685446303647f;
+    }
+
     template <typename FNfloat>
     float SingleOpenSimplex2(int seed, FNfloat x, FNfloat y, FNfloat z)
     {
@@ -1283,6 +1617,133 @@ private:
         return value * 18.24196194486065f;
     }
 
+    template <typename FNfloat>
+    float SingleOpenSimplex2SWithGradient(int seed, FNfloat x, FNfloat y, float& outDx, float& outDy)
+    {
+        // Same lattice walk as SingleOpenSimplex2S, corners also accumulate their derivatives
+
+        const FNfloat SQRT3 = (FNfloat)1.7320508075688772935274463415059;
+        const FNfloat G2 = (3 - SQRT3) / 6;
+
+        int i = FastFloor(x);
+        int j = FastFloor(y);
+        float xi = (float)(x - i);
+        float yi = (float)(y - j);
+
+        i *= PrimeX;
+        j *= PrimeY;
+        int i1 = i + PrimeX;
+        int j1 = j + PrimeY;
+
+        float t = (xi + yi) * (float)G2;
+        float x0 = xi - t;
+        float y0 = yi - t;
+
+        float value = 0, dx = 0, dy = 0;
+
+        float a0 = (2.0f / 3.0f) - x0 * x0 - y0 * y0;
+        SimplexCornerWithGradient(seed, i, j, a0, x0, y0, value, dx, dy);
+
+        float x1 = x0 - (float)(1 - 2 * G2);
+        float y1 = y0 - (float)(1 - 2 * G2);
+        float a1 = (2.0f / 3.0f) - x1 * x1 - y1 * y1;
+        SimplexCornerWithGradient(seed, i1, j1, a1, x1, y1, value, dx, dy);
+
+        float xmyi = xi - yi;
+        if (t > G2)
+        {
+            if (xi + xmyi > 1)
+            {
+                float x2 = x0 + (float)(3 * G2 - 2);
+                float y2 = y0 + (float)(3 * G2 - 1);
+                float a2 = (2.0f / 3.0f) - x2 * x2 - y2 * y2;
+                if (a2 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i + (PrimeX << 1), j + PrimeY, a2, x2, y2, value, dx, dy);
+                }
+            }
+            else
+            {
+                float x2 = x0 + (float)G2;
+                float y2 = y0 + (float)(G2 - 1);
+                float a2 = (2.0f / 3.0f) - x2 * x2 - y2 * y2;
+                if (a2 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i, j + PrimeY, a2, x2, y2, value, dx, dy);
+                }
+            }
+
+            if (yi - xmyi > 1)
+            {
+                float x3 = x0 + (float)(3 * G2 - 1);
+                float y3 = y0 + (float)(3 * G2 - 2);
+                float a3 = (2.0f / 3.0f) - x3 * x3 - y3 * y3;
+                if (a3 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i + PrimeX, j + (PrimeY << 1), a3, x3, y3, value, dx, dy);
+                }
+            }
+            else
+            {
+                float x3 = x0 + (float)(G2 - 1);
+                float y3 = y0 + (float)G2;
+                float a3 = (2.0f / 3.0f) - x3 * x3 - y3 * y3;
+                if (a3 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i + PrimeX, j, a3, x3, y3, value, dx, dy);
+                }
+            }
+        }
+        else
+        {
+            if (xi + xmyi < 0)
+            {
+                float x2 = x0 + (float)(1 - G2);
+                float y2 = y0 - (float)G2;
+                float a2 = (2.0f / 3.0f) - x2 * x2 - y2 * y2;
+                if (a2 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i - PrimeX, j, a2, x2, y2, value, dx, dy);
+                }
+            }
+            else
+            {
+                float x2 = x0 + (float)(G2 - 1);
+                float y2 = y0 + (float)G2;
+                float a2 = (2.0f / 3.0f) - x2 * x2 - y2 * y2;
+                if (a2 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i + PrimeX, j, a2, x2, y2, value, dx, dy);
+                }
+            }
+
+            if (yi < xmyi)
+            {
+                float x2 = x0 - (float)G2;
+                float y2 = y0 - (float)(G2 - 1);
+                float a2 = (2.0f / 3.0f) - x2 * x2 - y2 * y2;
+                if (a2 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i, j - PrimeY, a2, x2, y2, value, dx, dy);
+                }
+            }
+            else
+            {
+                float x2 = x0 + (float)G2;
+                float y2 = y0 + (float)(G2 - 1);
+                float a2 = (2.0f / 3.0f) - x2 * x2 - y2 * y2;
+                if (a2 > 0)
+                {
+                    SimplexCornerWithGradient(seed, i, j + PrimeY, a2, x2, y2, value, dx, dy);
+                }
+            }
+        }
+
+        outDx = dx * 18.24196194486065f;
+        outDy = dy * 18.24196194486065f;
+        return value * 18.24196194486065f;
+    }
+
     template <typename FNfloat>
     float SingleOpenSimplex2S(int seed, FNfloat x, FNfloat y, FNfloat z)
     {
@@ -1791,6 +2252,50 @@ private:
         return Lerp(xf0, xf1, ys) * 1.4247691104677813f;
     }
 
+    template <typename FNfloat>
+    float SinglePerlinWithGradient(int seed, FNfloat x, FNfloat y, float& outDx, float& outDy)
+    {
+        int x0 = FastFloor(x);
+        int y0 = FastFloor(y);
+
+        float xd0 = (float)(x - x0);
+        float yd0 = (float)(y - y0);
+        float xd1 = xd0 - 1;
+        float yd1 = yd0 - 1;
+
+        float xs = InterpQuintic(xd0);
+        float ys = InterpQuintic(yd0);
+        float xsSlope = 30 * xd0 * xd0 * xd1 * xd1;
+        float ysSlope = 30 * yd0 * yd0 * yd1 * yd1;
+
+        x0 *= PrimeX;
+        y0 *= PrimeY;
+        int x1 = x0 + PrimeX;
+        int y1 = y0 + PrimeY;
+
+        float xg00, yg00, xg10, yg10, xg01, yg01, xg11, yg11;
+        GradCoordVector(seed, x0, y0, xg00, yg00);
+        GradCoordVector(seed, x1, y0, xg10, yg10);
+        GradCoordVector(seed, x0, y1, xg01, yg01);
+        GradCoordVector(seed, x1, y1, xg11, yg11);
+
+        float n00 = xd0 * xg00 + yd0 * yg00;
+        float n10 = xd1 * xg10 + yd0 * yg10;
+        float n01 = xd0 * xg01 + yd1 * yg01;
+        float n11 = xd1 * xg11 + yd1 * yg11;
+
+        float xf0 = Lerp(n00, n10, xs);
+        float xf1 = Lerp(n01, n11, xs);
+        float xf0Dx = Lerp(xg00, xg10, xs) + (n10 - n00) * xsSlope;
+        float xf1Dx = Lerp(xg01, xg11, xs) + (n11 - n01) * xsSlope;
+        float xf0Dy = Lerp(yg00, yg10, xs);
+        float xf1Dy = Lerp(yg01, yg11, xs);
+
+        outDx = Lerp(xf0Dx, xf1Dx, ys) * 1.4247691104677813f;
+        outDy = (Lerp(xf0Dy, xf1Dy, ys) + (xf1 - xf0) * ysSlope) * 1.4247691104677813f;
+        return Lerp(xf0, xf1, ys) * 1.4247691104677813f;
+    }
+
     template <typename FNfloat>
     float SinglePerlin(int seed, FNfloat x, FNfloat y, FNfloat z)
     {
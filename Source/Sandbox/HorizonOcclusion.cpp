@@ -0,0 +1,99 @@
+﻿#include "HorizonOcclusion.h"
+
+void FHorizonBuffer::Reset(const FVector& InEye, int32 InResolution)
+{
+    Eye = InEye;
+    Resolution = FMath::Max(InResolution, 8);
+    Slopes.Init(-MAX_flt, Resolution);
+    Distances.Init(MAX_flt, Resolution);
+}
+
+bool FHorizonBuffer::GetAzimuthRange(const FBox2D& Footprint, float& OutMinBin, float& OutMaxBin, float& OutMinDistance, float& OutMaxDistance) const
+{
+    const FVector2D Eye2D(Eye.X, Eye.Y);
+    const FVector2D Closest(FMath::Clamp(Eye2D.X, Footprint.Min.X, Footprint.Max.X), FMath::Clamp(Eye2D.Y, Footprint.Min.Y, Footprint.Max.Y));
+    OutMinDistance = FVector2D::Distance(Eye2D, Closest);
+
+    // The eye is above (or touching) the footprint, nothing can be said about it
+    if (OutMinDistance <= KINDA_SMALL_NUMBER)
+    {
+        return false;
+    }
+
+    const FVector2D ToCenter = Footprint.GetCenter() - Eye2D;
+    const float CenterAngle = FMath::Atan2(ToCenter.Y, ToCenter.X);
+    const FVector2D Corners[4] = {
+        Footprint.Min,
+        FVector2D(Footprint.Max.X, Footprint.Min.Y),
+        FVector2D(Footprint.Min.X, Footprint.Max.Y),
+        Footprint.Max
+    };
+
+    float MinDelta = 0.0f;
+    float MaxDelta = 0.0f;
+    OutMaxDistance = 0.0f;
+    for (const FVector2D& Corner : Corners)
+    {
+        const FVector2D ToCorner = Corner - Eye2D;
+        const float Delta = FMath::UnwindRadians(FMath::Atan2(ToCorner.Y, ToCorner.X) - CenterAngle);
+        MinDelta = FMath::Min(MinDelta, Delta);
+        MaxDelta = FMath::Max(MaxDelta, Delta);
+        OutMaxDistance = FMath::Max(OutMaxDistance, ToCorner.Size());
+    }
+
+    const float BinsPerRadian = Resolution / (2.0f * PI);
+    OutMinBin = (CenterAngle + MinDelta + PI) * BinsPerRadian;
+    OutMaxBin = (CenterAngle + MaxDelta + PI) * BinsPerRadian;
+    return true;
+}
+
+bool FHorizonBuffer::IsOccluded(const FBox2D& Footprint, float MaxHeight) const
+{
+    float MinBin, MaxBin, MinDistance, MaxDistance;
+    if (!GetAzimuthRange(Footprint, MinBin, MaxBin, MinDistance, MaxDistance))
+    {
+        return false;
+    }
+
+    // Steepest slope any point of the node can have as seen from the eye
+    const float Rise = MaxHeight - Eye.Z;
+    const float NodeSlope = Rise > 0.0f ? Rise / MinDistance : Rise / MaxDistance;
+
+    const int32 FirstBin = FMath::FloorToInt(MinBin);
+    const int32 LastBin = FMath::FloorToInt(MaxBin);
+    for (int32 Bin = FirstBin; Bin <= LastBin; ++Bin)
+    {
+        const int32 Index = (Bin % Resolution + Resolution) % Resolution;
+        if (Slopes[Index] <= NodeSlope || Distances[Index] > MinDistance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FHorizonBuffer::AddOccluder(const FBox2D& Footprint, float MinHeight)
+{
+    float MinBin, MaxBin, MinDistance, MaxDistance;
+    if (!GetAzimuthRange(Footprint, MinBin, MaxBin, MinDistance, MaxDistance))
+    {
+        return;
+    }
+
+    // Lowest slope the occluder is guaranteed to block along any ray crossing it
+    const float Rise = MinHeight - Eye.Z;
+    const float OccluderSlope = Rise > 0.0f ? Rise / MaxDistance : Rise / MinDistance;
+
+    // Only bins whose whole azimuth range crosses the footprint
+    const int32 FirstBin = FMath::CeilToInt(MinBin);
+    const int32 LastBin = FMath::FloorToInt(MaxBin) - 1;
+    for (int32 Bin = FirstBin; Bin <= LastBin; ++Bin)
+    {
+        const int32 Index = (Bin % Resolution + Resolution) % Resolution;
+        if (OccluderSlope > Slopes[Index])
+        {
+            Slopes[Index] = OccluderSlope;
+            Distances[Index] = MaxDistance;
+        }
+    }
+}
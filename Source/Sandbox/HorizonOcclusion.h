@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+// 1D horizon buffer around an eye point, indexed by azimuth. Each bin keeps the
+// highest elevation slope (dz / distance) that is known to be covered by terrain,
+// together with the distance at which that occluder ends. Nodes must be fed
+// roughly front-to-back so occluders are in place before the nodes behind them.
+class FHorizonBuffer
+{
+public:
+    void Reset(const FVector& InEye, int32 InResolution);
+
+    // True if every azimuth bin spanned by Footprint already hides a surface of height MaxHeight.
+    bool IsOccluded(const FBox2D& Footprint, float MaxHeight) const;
+
+    // Raises the horizon in the bins fully covered by Footprint, assuming terrain is at least MinHeight there.
+    void AddOccluder(const FBox2D& Footprint, float MinHeight);
+
+private:
+    bool GetAzimuthRange(const FBox2D& Footprint, float& OutMinBin, float& OutMaxBin, float& OutMinDistance, float& OutMaxDistance) const;
+
+    FVector Eye;
+    int32 Resolution;
+    TArray<float> Slopes;
+    TArray<float> Distances;
+};
@@ -1,7 +1,139 @@
 ﻿#include "QuadTree.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerState.h"
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+#include "HorizonOcclusion.h"
+#include "QuadTreeStats.h"
+#include "TerrainCollisionComponent.h"
+#include "TerrainMeshComponent.h"
+#include "TerrainPatchInstancesComponent.h"
+#include "UObject/UObjectIterator.h"
+#include "TerrainChunkScheduler.h"
+#include "TerrainBakedData.h"
+#include "TerrainDiskCache.h"
+#include "TerrainHeightCodec.h"
+#include "TerrainLinearQuadTree.h"
+
+DEFINE_LOG_CATEGORY(LogQuadTree);
+
+DECLARE_CYCLE_STAT(TEXT("Update LOD"), STAT_QuadTree_UpdateLOD, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Publish Snapshot"), STAT_QuadTree_PublishSnapshot, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Horizon Occlusion"), STAT_QuadTree_Occlusion, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Prefetch"), STAT_QuadTree_Prefetch, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Request Chunks"), STAT_QuadTree_RequestChunks, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Stage: Upload"), STAT_QuadTree_StageUpload, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Stage: Collision"), STAT_QuadTree_StageCollision, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Collision: Trimesh Section"), STAT_QuadTree_TrimeshSection, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Queue: Sample"), STAT_QuadTree_QueueSample, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Queue: Mesh"), STAT_QuadTree_QueueMesh, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Queue: Attributes"), STAT_QuadTree_QueueAttributes, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Queue: Upload"), STAT_QuadTree_QueueUpload, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Chunk Workers"), STAT_QuadTree_ChunkWorkers, STATGROUP_QuadTree);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Teleport To Near Chunks Ready (ms)"), STAT_QuadTree_TeleportNearReady, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Stream Tiles"), STAT_QuadTree_StreamTiles, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Loaded Tiles"), STAT_QuadTree_LoadedTiles, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("LOD Observers"), STAT_QuadTree_Observers, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("LOD Observer Tests"), STAT_QuadTree_ObserverTests, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Leaves"), STAT_QuadTree_Leaves, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Balance Splits"), STAT_QuadTree_BalanceSplits, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Occluded Nodes"), STAT_QuadTree_OccludedNodes, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Prefetch Hits"), STAT_QuadTree_PrefetchHits, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Prefetch Misses"), STAT_QuadTree_PrefetchMisses, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Cache Evictions"), STAT_QuadTree_CacheEvictions, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Cached Chunks"), STAT_QuadTree_CachedChunks, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Chunk Cache Memory"), STAT_QuadTree_CacheMemory, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Collision Chunks"), STAT_QuadTree_CollisionChunks, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Collision Memory"), STAT_QuadTree_CollisionMemory, STATGROUP_QuadTree);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Collision Rebuild (ms)"), STAT_QuadTree_CollisionRebuild, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Collision Anchors"), STAT_QuadTree_CollisionAnchors, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Memory Per Anchor"), STAT_QuadTree_MemoryPerAnchor, STATGROUP_QuadTree);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Build CPU Per Anchor (ms)"), STAT_QuadTree_BuildPerAnchor, STATGROUP_QuadTree);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Update CPU Per Anchor (ms)"), STAT_QuadTree_UpdatePerAnchor, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Fallback Chunks"), STAT_QuadTree_FallbackChunks, STATGROUP_QuadTree);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Prefetch Hit Rate (%)"), STAT_QuadTree_PrefetchHitRate, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Mesh Rebuild Read"), STAT_QuadTree_MeshRebuildRead, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Mesh Rebuild Written"), STAT_QuadTree_MeshRebuildWritten, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Disk Cache Mapped"), STAT_QuadTree_DiskCacheMapped, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Disk Cache Hits"), STAT_QuadTree_DiskCacheHits, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Baked Tiles Decoded"), STAT_QuadTree_BakedTilesDecoded, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Baked Chunks"), STAT_QuadTree_BakedChunks, STATGROUP_QuadTree);
+
+// Chunk vertex before the packed format: 32-bit position, then double normal, tangent and UV, and a colour
+static constexpr SIZE_T FullChunkVertexBytes = sizeof(FVector3f) + 2 * sizeof(FVector) + sizeof(FVector2D) + sizeof(FColor);
+
 UQuadTreeComponent::UQuadTreeComponent()
 {
-    ProceduralMesh = CreateDefaultSubobject<UProceduralMeshComponent>(TEXT("ProceduralMesh"));
+}
+
+void UQuadTreeComponent::OnRegister()
+{
+    Super::OnRegister();
+    UpdateOwnedComponents();
+}
+
+template <typename ComponentType>
+static ComponentType* AddOwnedComponent(AActor* Owner)
+{
+    // Under the owner's root, the render mesh moves with the camera relative origin
+    ComponentType* Component = NewObject<ComponentType>(Owner, NAME_None, RF_Transient);
+    Component->SetupAttachment(Owner->GetRootComponent());
+    Component->RegisterComponent();
+    return Component;
+}
+
+template <typename ComponentType>
+static void DestroyOwnedComponent(ComponentType*& Component)
+{
+    if (Component)
+    {
+        Component->DestroyComponent();
+        Component = nullptr;
+    }
+}
+
+void UQuadTreeComponent::UpdateOwnedComponents()
+{
+    AActor* Owner = GetOwner();
+    if (!Owner || !GetWorld() || HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject))
+    {
+        return;
+    }
+
+    // A dedicated server never draws, it keeps no scene proxy or instance buffers around
+    if (IsHeadless())
+    {
+        DestroyOwnedComponent(TerrainMesh);
+        DestroyOwnedComponent(PatchInstances);
+    }
+    else
+    {
+        if (!TerrainMesh)
+        {
+            TerrainMesh = AddOwnedComponent<UTerrainMeshComponent>(Owner);
+        }
+        if (!PatchInstances)
+        {
+            PatchInstances = AddOwnedComponent<UTerrainPatchInstancesComponent>(Owner);
+        }
+    }
+
+    // The terrain mesh never cooks collision, this hidden copy does it on its own schedule
+    if (bUseHeightfieldCollision)
+    {
+        DestroyOwnedComponent(CollisionMesh);
+    }
+    else if (!CollisionMesh)
+    {
+        CollisionMesh = NewObject<UProceduralMeshComponent>(Owner, NAME_None, RF_Transient);
+        CollisionMesh->SetVisibility(false);
+        CollisionMesh->bUseAsyncCooking = true;
+        CollisionMesh->SetupAttachment(Owner->GetRootComponent());
+        CollisionMesh->RegisterComponent();
+    }
 }
 
 void UQuadTreeComponent::InitializeQuadTree(const FVector2D& Origin, float InitialSize)
@@ -15,15 +147,210 @@ void UQuadTreeComponent::InitializeQuadTree(const FVector2D& Origin, float Initi
         NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_Cellular); // Tipo de ruido
         NoiseFunc->SetFrequency(0.0001); // Frecuencia del ruid
     }
-    ProceduralMesh->SetMaterial(0, Material);
-    ProceduralMesh->bUseAsyncCooking = true;
-    RootNode = FQuadTreeNode(Origin, InitialSize, InitialSize);
+    UpdateOwnedComponents();
+    const bool bHeadless = IsHeadless();
+    if (!bHeadless && RenderMode == ETerrainRenderMode::InstancedPatches && !InstancedMaterial)
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("%s: instanced patches need an InstancedMaterial that reads HeightAtlas, drawing slots instead"), *GetOwner()->GetName());
+    }
+    const bool bInstanced = RenderMode == ETerrainRenderMode::InstancedPatches && InstancedMaterial != nullptr;
+    bDrawInstancedPatches = bInstanced;
+    if (TerrainMesh && PatchInstances)
+    {
+        TerrainMesh->SetMaterial(0, Material);
+        PatchInstances->SetPatchMaterial(InstancedMaterial);
+        if (bInstanced)
+        {
+            TerrainMesh->ClearChunks();
+        }
+        else
+        {
+            PatchInstances->ClearPatches();
+        }
+    }
+    if (!Scheduler.IsValid())
+    {
+        Scheduler = MakeShared<FTerrainChunkScheduler, ESPMode::ThreadSafe>();
+    }
+    FTerrainGenerationSettings Settings;
+    Settings.Height = Height;
+    Settings.HeightBound = NoiseFunc->GetOutputBound() * FMath::Abs(Height);
+    Settings.Resolution = PatchResolution;
+    Settings.UVScale = UVScale;
+    // Without a render mesh only collision consumes chunks, and heightfields only need the samples.
+    // Instanced patches render straight from the samples too.
+    Settings.bBuildAttributes = !bHeadless && !bInstanced;
+    Settings.bBuildMesh = (!bHeadless && !bInstanced) || !bUseHeightfieldCollision;
+    Scheduler->SetGenerationSettings(*NoiseFunc, Settings);
+    TileOrigin = Origin;
+    TileExtent = bInfiniteWorld ? TileSize : InitialSize;
+    UpdateDiskCache();
+    UpdateBakedData();
+    {
+        FScopeLock Lock(&HeightFieldMutex);
+        const double FinestSpacing = TileExtent / (double(1ll << FMath::Clamp(MaxDepth, 0, 30)) * FMath::Max(PatchResolution, 1));
+        HeightField = MakeShared<const FTerrainHeightField, ESPMode::ThreadSafe>(*NoiseFunc, Height, GetOwner()->GetActorLocation(), float(FinestSpacing), BakedData);
+    }
+    Scheduler->SetQueueCapacities(StageQueueCapacity, UploadQueueCapacity);
+    Scheduler->SetMaxWorkers(GenerationWorkers);
+    Scheduler->SetMaxSpeculativeJobs(MaxSpeculativeChunks);
+    bHasPrediction = false;
+
+    // Chunks stay valid for the settings they were built with, switching back finds them in the cache
+    for (TPair<FTerrainChunkKey, FTerrainChunkPtr>& Resident : ResidentChunks)
+    {
+        ChunkCache.Add(GetCacheKey(Resident.Key), MoveTemp(Resident.Value), false);
+    }
+    ResidentChunks.Empty();
+    CollisionChunks.Empty();
+    CollisionWanted.Empty();
+    DestroyHeightfieldCollision();
+    bCollisionDirty = true;
+    LastCollisionUpdateTime = 0.0;
+    TilePool.Reset();
+    FreeTiles.Reset();
+    LoadedTiles.Reset();
+    PublishSnapshot();
+    // The fresh tree is refined on the next update even if nobody moved
+    Observers.Reset();
+    ConfigHash = ComputeConfigHash();
     this->DefaultSize = InitialSize;
-    // Inicializar el QuadTree con un Depth de 3
-  
-    InitializeNodeRecursive(RootNode);
 
-    GenerateMesh(RootNode);  // Generar la malla después de la subdivisión inicial
+    // The tile lattice only anchors the collision cells, there is no visual tree to build
+    if (bHeadless)
+    {
+        ChunkCache.Empty();
+        return;
+    }
+
+    TilePool.SetNum(bInfiniteWorld ? MaxLoadedTiles : 1);
+    for (int32 Slot = TilePool.Num() - 1; Slot >= 0; --Slot)
+    {
+        FreeTiles.Add(Slot);
+    }
+
+    // Infinite worlds load their tiles around the observers, within the per update budget
+    if (bInfiniteWorld)
+    {
+        bTileStreamingPending = true;
+    }
+    else
+    {
+        LoadTile(FIntPoint::ZeroValue);
+    }
+
+    RequestChunks(LastLocalCamera + GetOwner()->GetActorLocation());  // Generar la malla después de la subdivisión inicial
+}
+
+uint64 UQuadTreeComponent::ComputeDiskCacheHash() const
+{
+    // Same FNV-1a as the noise hash, GetTypeHash of values is content based so it holds across runs
+    uint64 Hash = NoiseFunc->GetConfigHash();
+    auto Mix = [&Hash](uint32 Value)
+    {
+        Hash = (Hash ^ Value) * 1099511628211ull;
+    };
+    Mix(GetTypeHash(Height));
+    Mix(GetTypeHash(FMath::Max(PatchResolution, 1)));
+    Mix(GetTypeHash(TileOrigin));
+    Mix(GetTypeHash(TileExtent));
+    return Hash;
+}
+
+void UQuadTreeComponent::UpdateDiskCache()
+{
+    const uint64 Hash = ComputeDiskCacheHash();
+    if (bEnableDiskCache && DiskCache && DiskCache->GetConfigHash() == Hash)
+    {
+        return;
+    }
+
+    // Whatever the old configuration generated stays in its own directory, so going back to it finds it again
+    if (DiskCache)
+    {
+        DiskCache->Flush();
+        DiskCache.Reset();
+    }
+    if (bEnableDiskCache)
+    {
+        const FString Directory = FPaths::ProjectSavedDir() / TEXT("TerrainCache") / GetOwner()->GetName();
+        DiskCache = MakeShared<FTerrainDiskCache, ESPMode::ThreadSafe>(Directory, Hash, FMath::Max(PatchResolution, 1), int64(DiskCacheMaxMB) * 1024 * 1024);
+    }
+    Scheduler->SetDiskCache(DiskCache);
+}
+
+void UQuadTreeComponent::UpdateBakedData()
+{
+    const FString Path = BakedTerrainFile.FilePath.IsEmpty() ? FString() : FPaths::ConvertRelativePathToFull(FPaths::ProjectDir(), BakedTerrainFile.FilePath);
+    if (!BakedData || BakedData->GetPath() != Path)
+    {
+        BakedData.Reset();
+        if (!Path.IsEmpty())
+        {
+            BakedData = MakeShared<FTerrainBakedData, ESPMode::ThreadSafe>(Path, SIZE_T(BakedTileCacheMB) * 1024 * 1024);
+            if (!BakedData->IsValid())
+            {
+                UE_LOG(LogQuadTree, Warning, TEXT("%s: %s is not a terrain bake, sampling the noise instead"), *GetOwner()->GetName(), *Path);
+                BakedData.Reset();
+            }
+        }
+    }
+
+    // Checked on every settings change too. A bake of other settings is another terrain: its chunks would not meet
+    // the sampled ones and its min/max would hand occlusion and ray marching bounds that do not hold, so it is
+    // dropped and reopened once the settings match again.
+    if (BakedData)
+    {
+        const FTerrainBakeHeader& Header = BakedData->GetHeader();
+        if (Header.Height != Height)
+        {
+            UE_LOG(LogQuadTree, Warning, TEXT("%s: %s was baked with height %.1f, not %.1f, sampling the noise instead"), *GetOwner()->GetName(), *Path, Header.Height, Height);
+            BakedData.Reset();
+        }
+        else if (Header.NoiseHash != NoiseFunc->GetConfigHash())
+        {
+            UE_LOG(LogQuadTree, Warning, TEXT("%s: %s was baked from other noise settings (%016llx, not %016llx), sampling the noise instead"),
+                *GetOwner()->GetName(), *Path, Header.NoiseHash, NoiseFunc->GetConfigHash());
+            BakedData.Reset();
+        }
+    }
+    Scheduler->SetBakedData(BakedData);
+}
+
+void UQuadTreeComponent::OnComponentDestroyed(bool bDestroyingHierarchy)
+{
+    if (DiskCache)
+    {
+        DiskCache->Flush();
+    }
+    DestroyOwnedComponent(TerrainMesh);
+    DestroyOwnedComponent(PatchInstances);
+    DestroyOwnedComponent(CollisionMesh);
+    Super::OnComponentDestroyed(bDestroyingHierarchy);
+}
+
+uint32 UQuadTreeComponent::ComputeConfigHash() const
+{
+    uint32 Hash = GetTypeHash(NoiseType);
+    Hash = HashCombine(Hash, GetTypeHash(NoiseFractalType));
+    Hash = HashCombine(Hash, GetTypeHash(NoiseFrequency));
+    Hash = HashCombine(Hash, GetTypeHash(CellularJitter));
+    Hash = HashCombine(Hash, GetTypeHash(FractalGain));
+    Hash = HashCombine(Hash, GetTypeHash(FractalLacunarity));
+    Hash = HashCombine(Hash, GetTypeHash(FractalWeightedStrength));
+    Hash = HashCombine(Hash, GetTypeHash(FractalOctaves));
+    Hash = HashCombine(Hash, GetTypeHash(PingPongStrength));
+    Hash = HashCombine(Hash, GetTypeHash(Height));
+    Hash = HashCombine(Hash, GetTypeHash(PatchResolution));
+    Hash = HashCombine(Hash, GetTypeHash(UVScale));
+    Hash = HashCombine(Hash, GetTypeHash(IsHeadless()));
+    Hash = HashCombine(Hash, GetTypeHash(bUseHeightfieldCollision));
+    Hash = HashCombine(Hash, GetTypeHash(RenderMode));
+    Hash = HashCombine(Hash, GetTypeHash(InstancedMaterial != nullptr));
+    Hash = HashCombine(Hash, GetTypeHash(BakedTerrainFile.FilePath));
+    // Node keys are lattice cells of the tiles, so their placement is part of the identity too
+    Hash = HashCombine(Hash, GetTypeHash(TileOrigin));
+    return HashCombine(Hash, GetTypeHash(TileExtent));
 }
 
 void UQuadTreeComponent::InitializeNodeRecursive(FQuadTreeNode& Node)
@@ -35,266 +362,2217 @@ void UQuadTreeComponent::InitializeNodeRecursive(FQuadTreeNode& Node)
         {
             Child.Depth = Node.Depth + 1;
             Child.InitialSize = Node.InitialSize;
+            UpdateNodeBounds(Child);
 
             InitializeNodeRecursive(Child);
         }
+        Node.MergeChildBounds();
+    }
+}
+
+void UQuadTreeComponent::StreamTiles()
+{
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_StreamTiles);
+
+    // Farthest tiles go first, only past the margin so a tile on the edge of the radius stays put
+    TArray<TPair<float, FIntPoint>> ToUnload;
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        const float Distance = GetTileDistance(Tile.Key);
+        if (Distance > TileStreamingRadius + TileUnloadMargin)
+        {
+            ToUnload.Add({Distance, Tile.Key});
+        }
+    }
+    ToUnload.Sort([](const TPair<float, FIntPoint>& A, const TPair<float, FIntPoint>& B) { return A.Key > B.Key; });
+    const int32 NumUnloads = FMath::Min(ToUnload.Num(), MaxTileUnloadsPerUpdate);
+    for (int32 Index = 0; Index < NumUnloads; ++Index)
+    {
+        UnloadTile(ToUnload[Index].Value);
+    }
+
+    // Nearest missing tiles go first
+    TMap<FIntPoint, float> Missing;
+    for (const FTerrainObserver& Observer : Observers)
+    {
+        const FVector2D Location(Observer.Location);
+        const FIntPoint MinTile = GetTileAt(Location - FVector2D(TileStreamingRadius, TileStreamingRadius));
+        const FIntPoint MaxTile = GetTileAt(Location + FVector2D(TileStreamingRadius, TileStreamingRadius));
+        for (int32 Y = MinTile.Y; Y <= MaxTile.Y; ++Y)
+        {
+            for (int32 X = MinTile.X; X <= MaxTile.X; ++X)
+            {
+                const FIntPoint Tile(X, Y);
+                if (!LoadedTiles.Contains(Tile) && !Missing.Contains(Tile))
+                {
+                    const float Distance = GetTileDistance(Tile);
+                    if (Distance <= TileStreamingRadius)
+                    {
+                        Missing.Add(Tile, Distance);
+                    }
+                }
+            }
+        }
+    }
+    Missing.ValueSort(TLess<float>());
+
+    int32 NumLoads = 0;
+    for (const TPair<FIntPoint, float>& Tile : Missing)
+    {
+        if (NumLoads >= MaxTileLoadsPerUpdate || FreeTiles.Num() == 0)
+        {
+            break;
+        }
+        LoadTile(Tile.Key);
+        NumLoads++;
+    }
+
+    // Keep updating while there is work left that can actually make progress
+    bTileStreamingPending = ToUnload.Num() > NumUnloads || (Missing.Num() > NumLoads && FreeTiles.Num() > 0);
+    SET_DWORD_STAT(STAT_QuadTree_LoadedTiles, LoadedTiles.Num());
+}
+
+void UQuadTreeComponent::LoadTile(const FIntPoint& Tile)
+{
+    const int32 Slot = FreeTiles.Pop(false);
+    const FTerrainChunkDesc Desc = GetTileDesc(Tile);
+
+    // Reset in place so the slot keeps its child array allocation
+    FQuadTreeNode& Root = TilePool[Slot];
+    Root.Children.Reset();
+    Root.Position = Desc.Position;
+    Root.Size = Desc.Size;
+    Root.InitialSize = Desc.Size;
+    Root.Depth = 0;
+    Root.Coord = Tile;
+    Root.bNeedsUpdate = true;
+    Root.bOccluded = false;
+    UpdateNodeBounds(Root);
+    InitializeNodeRecursive(Root);
+
+    LoadedTiles.Add(Tile, Slot);
+}
+
+void UQuadTreeComponent::UnloadTile(const FIntPoint& Tile)
+{
+    // Resident chunks of the tile go back to the cache on the next mesh rebuild, which no longer displays them
+    int32 Slot;
+    if (LoadedTiles.RemoveAndCopyValue(Tile, Slot))
+    {
+        TilePool[Slot].Children.Reset();
+        FreeTiles.Add(Slot);
+    }
+}
+
+FIntPoint UQuadTreeComponent::GetTileAt(const FVector2D& Location) const
+{
+    return FIntPoint(FMath::FloorToInt((Location.X - TileOrigin.X) / TileExtent), FMath::FloorToInt((Location.Y - TileOrigin.Y) / TileExtent));
+}
+
+FTerrainChunkDesc UQuadTreeComponent::GetTileDesc(const FIntPoint& Tile) const
+{
+    return {FTerrainChunkKey(0, Tile), TileOrigin + FVector2D(Tile) * TileExtent, TileExtent};
+}
+
+float UQuadTreeComponent::GetTileDistance(const FIntPoint& Tile) const
+{
+    const FTerrainChunkDesc Desc = GetTileDesc(Tile);
+    const FBox2D Footprint(Desc.Position, Desc.Position + FVector2D(Desc.Size, Desc.Size));
+
+    float Distance = MAX_flt;
+    for (const FTerrainObserver& Observer : Observers)
+    {
+        Distance = FMath::Min(Distance, FMath::Sqrt(Footprint.ComputeSquaredDistanceToPoint(FVector2D(Observer.Location))));
     }
+    return Distance;
 }
 
 void UQuadTreeComponent::UpdateQuadTree(const FVector& CameraLocation, float SubdivisionThreshold)
 {
-    if (!PauseSubdivision)
+    const FTerrainObserver Camera {CameraLocation, 1.0f};
+    UpdateQuadTree(MakeArrayView(&Camera, 1), SubdivisionThreshold);
+}
+
+void UQuadTreeComponent::UpdateQuadTree(TConstArrayView<FTerrainObserver> InObservers, float SubdivisionThreshold)
+{
+    if (PauseSubdivision)
+    {
+        return;
+    }
+
+    const FVector ActorLocation = GetOwner()->GetActorLocation();
+    TArray<FTerrainObserver> NewObservers;
+    NewObservers.Reserve(InObservers.Num() + ObserverActors.Num());
+    for (const FTerrainObserver& Observer : InObservers)
+    {
+        NewObservers.Add({Observer.Location - ActorLocation, FMath::Max(Observer.Weight, UE_SMALL_NUMBER)});
+    }
+    for (const TPair<TWeakObjectPtr<AActor>, float>& ObserverActor : ObserverActors)
+    {
+        if (ObserverActor.Key.IsValid())
+        {
+            NewObservers.Add({ObserverActor.Key->GetActorLocation() - ActorLocation, ObserverActor.Value});
+        }
+    }
+
+    // Nothing moved, the tree is already right
+    bool bChanged = NewObservers.Num() != Observers.Num();
+    for (int32 Index = 0; !bChanged && Index < NewObservers.Num(); ++Index)
+    {
+        bChanged = NewObservers[Index].Location != Observers[Index].Location || NewObservers[Index].Weight != Observers[Index].Weight;
+    }
+    if (NewObservers.Num() == 0 || (!bChanged && !bTileStreamingPending))
+    {
+        return;
+    }
+    Observers = MoveTemp(NewObservers);
+    LastSubdivisionThreshold = SubdivisionThreshold;
+
+    // Morph factors follow the observers even when the displayed set stays the same, only the
+    // instances whose factor changed are updated
+    if (bDrawInstancedPatches)
+    {
+        bMeshDirty = true;
+    }
+
+    if (bInfiniteWorld)
+    {
+        StreamTiles();
+    }
+
+    if (bEnableHorizonOcclusion)
     {
-        SubdivideNode(RootNode, CameraLocation, SubdivisionThreshold);
-        GenerateMesh(RootNode); 
+        UpdateOcclusion();
+    }
+    {
+        SCOPE_CYCLE_COUNTER(STAT_QuadTree_UpdateLOD);
+        TArray<int32, TInlineAllocator<8>> AllObservers;
+        for (int32 Index = 0; Index < Observers.Num(); ++Index)
+        {
+            AllObservers.Add(Index);
+        }
+        NumObserverTests = 0;
+        for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+        {
+            SubdivideNode(TilePool[Tile.Value], AllObservers, SubdivisionThreshold);
+        }
+        if (bBalanceTree)
+        {
+            BalanceTree();
+        }
+        PublishSnapshot();
+        SET_DWORD_STAT(STAT_QuadTree_Observers, Observers.Num());
+        SET_DWORD_STAT(STAT_QuadTree_ObserverTests, NumObserverTests);
     }
+    RequestChunks(Observers[0].Location + ActorLocation);
 }
 
 void UQuadTreeComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
 {
     Super::PostEditChangeProperty(PropertyChangedEvent);
+    ApplyNoiseSettings(*NoiseFunc);
+
+    if (TerrainMesh)
+    {
+        TerrainMesh->SetMaterial(0, Material);
+    }
+    
+    InitializeQuadTree(FVector2D::ZeroVector, DefaultSize);
+}
+
+void UQuadTreeComponent::ApplyNoiseSettings(FastNoiseLite& Noise) const
+{
     switch (NoiseType)
     {
         case NoiseType::Cellular:
-            NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_Cellular);
+            Noise.SetNoiseType(FastNoiseLite::NoiseType_Cellular);
             break;
         case NoiseType::Perlin:
-            NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+            Noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
             break;
         case NoiseType::Value:
-            NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_Value);
+            Noise.SetNoiseType(FastNoiseLite::NoiseType_Value);
             break;
         case NoiseType::OpenSimplex2:
-            NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
+            Noise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
             break;
         case NoiseType::ValueCubic:
-            NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_ValueCubic);
+            Noise.SetNoiseType(FastNoiseLite::NoiseType_ValueCubic);
             break;
         case NoiseType::OpenSimplex2S:
-            NoiseFunc->SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2S);
+            Noise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2S);
             break;
     }
     
     switch (NoiseFractalType)
     {
         case NoiseFractalTypes::None:
-            NoiseFunc->SetFractalType(FastNoiseLite::FractalType_None);
+            Noise.SetFractalType(FastNoiseLite::FractalType_None);
             break;
         case NoiseFractalTypes::FBm:
-            NoiseFunc->SetFractalType(FastNoiseLite::FractalType_FBm);
+            Noise.SetFractalType(FastNoiseLite::FractalType_FBm);
             break;
         case NoiseFractalTypes::Rigid:
-            NoiseFunc->SetFractalType(FastNoiseLite::FractalType_Ridged);
+            Noise.SetFractalType(FastNoiseLite::FractalType_Ridged);
             break;
         case NoiseFractalTypes::PingPong:
-            NoiseFunc->SetFractalType(FastNoiseLite::FractalType_PingPong);
+            Noise.SetFractalType(FastNoiseLite::FractalType_PingPong);
             break;
         case NoiseFractalTypes::DomainWarpProgressive:
-            NoiseFunc->SetFractalType(FastNoiseLite::FractalType_DomainWarpProgressive);
+            Noise.SetFractalType(FastNoiseLite::FractalType_DomainWarpProgressive);
             break;
         case NoiseFractalTypes::DomainWarpIndependent:
-            NoiseFunc->SetFractalType(FastNoiseLite::FractalType_DomainWarpIndependent);
+            Noise.SetFractalType(FastNoiseLite::FractalType_DomainWarpIndependent);
             break;
     }
     
-    NoiseFunc->SetFrequency(NoiseFrequency);
-    NoiseFunc->SetCellularJitter(CellularJitter);
-    NoiseFunc->SetFractalGain(FractalGain);
-    NoiseFunc->SetFractalLacunarity(FractalLacunarity);
-    NoiseFunc->SetFractalWeightedStrength(FractalWeightedStrength);
-    NoiseFunc->SetFractalOctaves(FractalOctaves);
-    NoiseFunc->SetFractalPingPongStrength(PingPongStrength);
-
-    RootNode.Children.Empty();
-    RootNode.Size = DefaultSize;
-    RootNode.Depth = 0;
-    ProceduralMesh->SetMaterial(0, Material);
-    
-    InitializeQuadTree(FVector2D::ZeroVector, DefaultSize);
+    Noise.SetFrequency(NoiseFrequency);
+    Noise.SetCellularJitter(CellularJitter);
+    Noise.SetFractalGain(FractalGain);
+    Noise.SetFractalLacunarity(FractalLacunarity);
+    Noise.SetFractalWeightedStrength(FractalWeightedStrength);
+    Noise.SetFractalOctaves(FractalOctaves);
+    Noise.SetFractalPingPongStrength(PingPongStrength);
 }
 
 
 void FQuadTreeNode::Subdivide()
 {
-    float HalfSize = Size / 2.0f;
+    const double HalfSize = Size / 2.0;
     
     Children.Add(FQuadTreeNode(FVector2D(Position.X, Position.Y), HalfSize, InitialSize));
     Children.Add(FQuadTreeNode(FVector2D(Position.X + HalfSize, Position.Y), HalfSize, InitialSize));
     Children.Add(FQuadTreeNode(FVector2D(Position.X, Position.Y + HalfSize), HalfSize, InitialSize));
     Children.Add(FQuadTreeNode(FVector2D(Position.X + HalfSize, Position.Y + HalfSize), HalfSize, InitialSize));
-}
-
-void UQuadTreeComponent::SubdivideNode(FQuadTreeNode& Node, const FVector& CameraLocation, float SubdivisionThreshold)
-{
-    FVector ActorLocation = GetOwner()->GetActorLocation();
-    FVector2D NodeCenter = FVector2D(ActorLocation.X, ActorLocation.Y) + Node.Position + FVector2D(Node.Size / 2.0f, Node.Size / 2.0f);
-    float DistanceToCamera = FVector2D::Distance(NodeCenter, FVector2D(CameraLocation.X, CameraLocation.Y));
 
-    // Determine desired depth based on distance
-    int DesiredDepth = MaxDepth;
-    if (DistanceToCamera > SubdivisionThreshold * 5)
+    for (int32 Index = 0; Index < Children.Num(); ++Index)
     {
-        DesiredDepth = InitialDepth;
+        Children[Index].Coord = Coord * 2 + FIntPoint(Index & 1, Index >> 1);
     }
-    else if (DistanceToCamera > SubdivisionThreshold * 4)
+}
+
+void FQuadTreeNode::MergeChildBounds()
+{
+    if (Children.Num() == 0)
     {
-        DesiredDepth = FMath::Clamp(InitialDepth + 1, InitialDepth, MaxDepth);
+        return;
     }
-    else if (DistanceToCamera > SubdivisionThreshold * 3)
+
+    float ChildMin = MAX_flt;
+    float ChildMax = -MAX_flt;
+    for (const FQuadTreeNode& Child : Children)
     {
-        DesiredDepth = FMath::Clamp(InitialDepth + 2, InitialDepth, MaxDepth);
+        ChildMin = FMath::Min(ChildMin, Child.MinHeight);
+        ChildMax = FMath::Max(ChildMax, Child.MaxHeight);
     }
-    else if (DistanceToCamera > SubdivisionThreshold * 2)
+    MinHeight = FMath::Max(MinHeight, ChildMin);
+    MaxHeight = FMath::Min(MaxHeight, ChildMax);
+}
+
+void UQuadTreeComponent::UpdateNodeBounds(FQuadTreeNode& Node) const
+{
+    // Baked terrain knows the exact range of its samples
+    if (BakedData && BakedData->GetHeightRange(Node.GetFootprint(), Node.MinHeight, Node.MaxHeight))
     {
-        DesiredDepth = FMath::Clamp(InitialDepth + 3, InitialDepth, MaxDepth);
+        return;
     }
-    else if (DistanceToCamera > SubdivisionThreshold)
+
+    // Hidden nodes are dropped from meshing, so the range has to hold the whole surface, not just the samples
+    const float Range = NoiseFunc->GetOutputBound() * FMath::Abs(Height);
+    Node.MinHeight = -Range;
+    Node.MaxHeight = Range;
+    const float GradientBound = NoiseFunc->GetGradientBound();
+    if (GradientBound < 0.0f)
     {
-        DesiredDepth = FMath::Clamp(InitialDepth + 4, InitialDepth, MaxDepth);
+        return;
     }
 
-    // Subdivide if necessary
-    if (Node.Depth < DesiredDepth && Node.Size > 50.0f)
+    // 3x3 samples, no point of the node is further than a quarter diagonal from one of them
+    float SampledMin = MAX_flt;
+    float SampledMax = -MAX_flt;
+    for (int32 Y = 0; Y <= 2; ++Y)
     {
-        if (Node.Children.Num() == 0)
-        {
-            Node.Subdivide();
-
-            for (FQuadTreeNode& Child : Node.Children)
-            {
-                Child.Depth = Node.Depth + 1;
-                Child.InitialSize = Node.InitialSize;
-            }
-        }
-
-        for (FQuadTreeNode& Child : Node.Children)
+        for (int32 X = 0; X <= 2; ++X)
         {
-            SubdivideNode(Child, CameraLocation, SubdivisionThreshold);
+            const FVector2D Sample = Node.Position + FVector2D(X, Y) * (Node.Size / 2.0f);
+            const float SampleHeight = NoiseFunc->GetNoise(Sample.X, Sample.Y) * Height;
+            SampledMin = FMath::Min(SampledMin, SampleHeight);
+            SampledMax = FMath::Max(SampledMax, SampleHeight);
         }
     }
-    else
+    const float Slack = GradientBound * FMath::Abs(Height) * float(Node.Size * UE_SQRT_2 / 4.0);
+    Node.MinHeight = FMath::Max(Node.MinHeight, SampledMin - Slack);
+    Node.MaxHeight = FMath::Min(Node.MaxHeight, SampledMax + Slack);
+}
+
+static void MarkSubtreeOccluded(FQuadTreeNode& Node)
+{
+    Node.bOccluded = true;
+    for (FQuadTreeNode& Child : Node.Children)
     {
-        // Collapse node if it has children but should be at a lower detail
-        if (Node.Children.Num() > 0)
-        {
-            bool ShouldCollapse = true;
+        MarkSubtreeOccluded(Child);
+    }
+}
 
-            for (FQuadTreeNode& Child : Node.Children)
-            {
-                if (FVector2D::Distance(FVector2D(CameraLocation.X, CameraLocation.Y), Child.Position) < SubdivisionThreshold)
-                {
-                    ShouldCollapse = false;
-                    break;
-                }
-            }
+static int32 CountOccludedNodes(const FQuadTreeNode& Node)
+{
+    if (Node.bOccluded)
+    {
+        return 1;
+    }
 
-            if (ShouldCollapse)
-            {
-                Node.Children.Empty();
-            }
-            else
-            {
-                for (FQuadTreeNode& Child : Node.Children)
-                {
-                    SubdivideNode(Child, CameraLocation, SubdivisionThreshold);
-                }
-            }
-        }
+    int32 NumOccluded = 0;
+    for (const FQuadTreeNode& Child : Node.Children)
+    {
+        NumOccluded += CountOccludedNodes(Child);
     }
+    return NumOccluded;
 }
 
-void UQuadTreeComponent::GenerateMesh(FQuadTreeNode& Node)
+void UQuadTreeComponent::UpdateOcclusion()
 {
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_Occlusion);
 
-    TFuture<FGeometryData> FutureData = Async(EAsyncExecution::LargeThreadPool,[&]
+    // A node stays hidden only if no observer sees it
+    int32 NumOccluded = 0;
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
     {
-        TArray<FVector> AccumulatedVertices;
-        TArray<int32> AccumulatedIndices;
-        TMap<FVector, int32> VertexMap;
-        
-        GenerateMeshRecursive(Node, AccumulatedVertices, AccumulatedIndices, VertexMap);
-        FGeometryData VertexData;
-        VertexData.Vertices = AccumulatedVertices;
-        VertexData.Triangles = AccumulatedIndices;
+        MarkSubtreeOccluded(TilePool[Tile.Value]);
+    }
+    for (const FTerrainObserver& Observer : Observers)
+    {
+        UpdateOcclusionFrom(Observer.Location);
+    }
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        NumOccluded += CountOccludedNodes(TilePool[Tile.Value]);
+    }
+
+    SET_DWORD_STAT(STAT_QuadTree_OccludedNodes, NumOccluded);
+}
+
+void UQuadTreeComponent::UpdateOcclusionFrom(const FVector& Eye)
+{
+    struct FPendingNode
+    {
+        FQuadTreeNode* Node;
+        float Distance;
+
+        bool operator<(const FPendingNode& Other) const { return Distance < Other.Distance; }
+    };
+
+    const FVector2D Eye2D(Eye.X, Eye.Y);
+    const float Margin = OcclusionHeightMargin * Height;
+
+    FHorizonBuffer Horizon;
+    Horizon.Reset(Eye, HorizonResolution);
+
+    // Nearest node first, so every occluder is in the buffer before the nodes it hides
+    TArray<FPendingNode> Pending;
+    // Tiles compete in the same queue, a near ridge hides the tiles behind it as well
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        FQuadTreeNode& Root = TilePool[Tile.Value];
+        Pending.HeapPush({&Root, FMath::Sqrt(Root.GetFootprint().ComputeSquaredDistanceToPoint(Eye2D))});
+    }
+
+    while (Pending.Num() > 0)
+    {
+        FPendingNode Current;
+        Pending.HeapPop(Current, false);
+        FQuadTreeNode& Node = *Current.Node;
+        const FBox2D Footprint = Node.GetFootprint();
+
+        if (Horizon.IsOccluded(Footprint, Node.MaxHeight + Margin))
+        {
+            continue;
+        }
+        Node.bOccluded = false;
+
+        if (Node.Children.Num() == 0)
+        {
+            Horizon.AddOccluder(Footprint, Node.MinHeight - Margin);
+            continue;
+        }
+
+        for (FQuadTreeNode& Child : Node.Children)
+        {
+            Pending.HeapPush({&Child, FMath::Sqrt(Child.GetFootprint().ComputeSquaredDistanceToPoint(Eye2D))});
+        }
+    }
+}
+
+int32 UQuadTreeComponent::ComputeDesiredDepth(const FVector2D& NodeCenter, const FVector& CameraLocation, float SubdivisionThreshold) const
+{
+    return ComputeDepthForDistance(FVector2D::Distance(NodeCenter, FVector2D(CameraLocation.X, CameraLocation.Y)), SubdivisionThreshold);
+}
+
+int32 UQuadTreeComponent::ComputeDepthForDistance(float DistanceToCamera, float SubdivisionThreshold) const
+{
+
+    // Determine desired depth based on distance
+    int DesiredDepth = MaxDepth;
+    if (DistanceToCamera > SubdivisionThreshold * 5)
+    {
+        DesiredDepth = InitialDepth;
+    }
+    else if (DistanceToCamera > SubdivisionThreshold * 4)
+    {
+        DesiredDepth = FMath::Clamp(InitialDepth + 1, InitialDepth, MaxDepth);
+    }
+    else if (DistanceToCamera > SubdivisionThreshold * 3)
+    {
+        DesiredDepth = FMath::Clamp(InitialDepth + 2, InitialDepth, MaxDepth);
+    }
+    else if (DistanceToCamera > SubdivisionThreshold * 2)
+    {
+        DesiredDepth = FMath::Clamp(InitialDepth + 3, InitialDepth, MaxDepth);
+    }
+    else if (DistanceToCamera > SubdivisionThreshold)
+    {
+        DesiredDepth = FMath::Clamp(InitialDepth + 4, InitialDepth, MaxDepth);
+    }
+
+    return DesiredDepth;
+}
+
+void UQuadTreeComponent::SubdivideNode(FQuadTreeNode& Node, TConstArrayView<int32> Candidates, float SubdivisionThreshold)
+{
+    if (bEnableHorizonOcclusion && Node.bOccluded)
+    {
+        // Hidden behind the horizon, keep it coarse until it shows up again
+        Node.Children.Empty();
+        return;
+    }
+
+    // Beyond five thresholds an observer asks for nothing above InitialDepth anywhere in the node, so it is
+    // dropped for the whole subtree. Overlapping observers share the nodes near them and distant ones stop costing early.
+    const FBox2D Footprint = Node.GetFootprint();
+    const float Reach = SubdivisionThreshold * 5.0f;
+    TArray<int32, TInlineAllocator<8>> Active;
+    for (int32 Index : Candidates)
+    {
+        const FTerrainObserver& Observer = Observers[Index];
+        if (Footprint.ComputeSquaredDistanceToPoint(FVector2D(Observer.Location)) <= FMath::Square(Reach * Observer.Weight))
+        {
+            Active.Add(Index);
+        }
+    }
+    NumObserverTests += Candidates.Num();
+
+    const FVector2D NodeCenter = Footprint.GetCenter();
+    int DesiredDepth = InitialDepth;
+    for (int32 Index : Active)
+    {
+        const FTerrainObserver& Observer = Observers[Index];
+        DesiredDepth = FMath::Max(DesiredDepth, ComputeDepthForDistance(FVector2D::Distance(NodeCenter, FVector2D(Observer.Location)) / Observer.Weight, SubdivisionThreshold));
+        if (DesiredDepth >= MaxDepth)
+        {
+            break;
+        }
+    }
+
+    // Subdivide if necessary
+    if (Node.Depth < DesiredDepth && Node.Size > 50.0f)
+    {
+        if (Node.Children.Num() == 0)
+        {
+            SplitNode(Node);
+        }
+
+        for (FQuadTreeNode& Child : Node.Children)
+        {
+            SubdivideNode(Child, Active, SubdivisionThreshold);
+        }
+        Node.MergeChildBounds();
+    }
+    else
+    {
+        // Collapse node if it has children but should be at a lower detail
+        if (Node.Children.Num() > 0)
+        {
+            bool ShouldCollapse = true;
+
+            for (FQuadTreeNode& Child : Node.Children)
+            {
+                for (int32 Index : Active)
+                {
+                    if (FVector2D::Distance(FVector2D(Observers[Index].Location), Child.Position) < SubdivisionThreshold * Observers[Index].Weight)
+                    {
+                        ShouldCollapse = false;
+                        break;
+                    }
+                }
+            }
+
+            if (ShouldCollapse)
+            {
+                Node.Children.Empty();
+            }
+            else
+            {
+                for (FQuadTreeNode& Child : Node.Children)
+                {
+                    SubdivideNode(Child, Active, SubdivisionThreshold);
+                }
+            }
+        }
+    }
+}
+
+void UQuadTreeComponent::SplitNode(FQuadTreeNode& Node) const
+{
+    Node.Subdivide();
+
+    for (FQuadTreeNode& Child : Node.Children)
+    {
+        Child.Depth = Node.Depth + 1;
+        Child.InitialSize = Node.InitialSize;
+        UpdateNodeBounds(Child);
+    }
+}
+
+void UQuadTreeComponent::BalanceTree()
+{
+    FTerrainLinearQuadTree Tree;
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        CollectLeafCodes(TilePool[Tile.Value], Tree);
+    }
+
+    // Hidden leaves are not in the tree, so they neither need a split nor force one
+    const int32 NumSplit = Tree.Balance([this](const FTerrainNodeCode& Code)
+    {
+        FQuadTreeNode* Node = FindNode(Code.ToKey());
+        if (!Node || Node->Children.Num() > 0 || Node->Depth >= MaxDepth || Node->Size <= 50.0f)
+        {
+            return false;
+        }
+        SplitNode(*Node);
+        return true;
+    });
+    SET_DWORD_STAT(STAT_QuadTree_BalanceSplits, NumSplit);
+}
+
+void UQuadTreeComponent::PublishSnapshot()
+{
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_PublishSnapshot);
+
+    // Breadth first from the root tiles, so the four children of a node always sit together
+    const float Margin = OcclusionHeightMargin * Height;
+    TArray<const FQuadTreeNode*> Sources;
+    TArray<FTerrainQuadTreeSnapshot::FNode> Nodes;
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        Sources.Add(&TilePool[Tile.Value]);
+    }
+    const int32 NumRoots = Sources.Num();
+
+    for (int32 Index = 0; Index < Sources.Num(); ++Index)
+    {
+        const FQuadTreeNode& Source = *Sources[Index];
+        FTerrainQuadTreeSnapshot::FNode& Node = Nodes.AddDefaulted_GetRef();
+        Node.Bounds = FBox(FVector(Source.Position, Source.MinHeight - Margin), FVector(Source.Position + FVector2D(Source.Size, Source.Size), Source.MaxHeight + Margin));
+        Node.Key = Source.GetKey();
+        Node.bOccluded = bEnableHorizonOcclusion && Source.bOccluded;
+        if (Source.Children.Num() > 0)
+        {
+            Node.FirstChild = Sources.Num();
+            for (const FQuadTreeNode& Child : Source.Children)
+            {
+                Sources.Add(&Child);
+            }
+        }
+    }
+
+    FTerrainQuadTreeSnapshotPtr NewSnapshot = MakeShared<const FTerrainQuadTreeSnapshot, ESPMode::ThreadSafe>(MoveTemp(Nodes), NumRoots, GetOwner()->GetActorLocation());
+    FScopeLock Lock(&SnapshotMutex);
+    Snapshot = MoveTemp(NewSnapshot);
+}
+
+void UQuadTreeComponent::CollectLeafCodes(const FQuadTreeNode& Node, FTerrainLinearQuadTree& OutTree) const
+{
+    if (bEnableHorizonOcclusion && Node.bOccluded)
+    {
+        return;
+    }
+
+    if (Node.Children.Num() == 0)
+    {
+        OutTree.Add(FTerrainNodeCode(Node.GetKey()));
+    }
+
+    for (const FQuadTreeNode& Child : Node.Children)
+    {
+        CollectLeafCodes(Child, OutTree);
+    }
+}
+
+FQuadTreeNode* UQuadTreeComponent::FindNode(const FTerrainChunkKey& Key)
+{
+    const int32* TileIndex = LoadedTiles.Find(FIntPoint(Key.Coord.X >> Key.Depth, Key.Coord.Y >> Key.Depth));
+    FQuadTreeNode* Node = TileIndex ? &TilePool[*TileIndex] : nullptr;
+    for (int32 Level = Key.Depth - 1; Node && Level >= 0; --Level)
+    {
+        const int32 Child = ((Key.Coord.X >> Level) & 1) | (((Key.Coord.Y >> Level) & 1) << 1);
+        Node = Node->Children.Num() > 0 ? &Node->Children[Child] : nullptr;
+    }
+    return Node;
+}
+
+const FQuadTreeNode* UQuadTreeComponent::FindLeafAt(const FTerrainChunkKey& Key) const
+{
+    const int32* TileIndex = LoadedTiles.Find(FIntPoint(Key.Coord.X >> Key.Depth, Key.Coord.Y >> Key.Depth));
+    const FQuadTreeNode* Node = TileIndex ? &TilePool[*TileIndex] : nullptr;
+    for (int32 Level = Key.Depth - 1; Node && Node->Children.Num() > 0 && Level >= 0; --Level)
+    {
+        Node = &Node->Children[((Key.Coord.X >> Level) & 1) | (((Key.Coord.Y >> Level) & 1) << 1)];
+    }
+    return Node && Node->Children.Num() == 0 ? Node : nullptr;
+}
+
+const FQuadTreeNode* UQuadTreeComponent::FindCoveringNode(const FTerrainChunkKey& Key) const
+{
+    const int32* TileIndex = LoadedTiles.Find(FIntPoint(Key.Coord.X >> Key.Depth, Key.Coord.Y >> Key.Depth));
+    const FQuadTreeNode* Node = TileIndex ? &TilePool[*TileIndex] : nullptr;
+    for (int32 Level = Key.Depth - 1; Node && Node->Children.Num() > 0 && Level >= 0; --Level)
+    {
+        Node = &Node->Children[((Key.Coord.X >> Level) & 1) | (((Key.Coord.Y >> Level) & 1) << 1)];
+    }
+    return Node;
+}
+
+void UQuadTreeComponent::RequestChunks(const FVector& CameraLocation)
+{
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_RequestChunks);
+
+    const FVector LocalCamera = CameraLocation - GetOwner()->GetActorLocation();
+    if (FVector::Dist(LocalCamera, LastLocalCamera) > TeleportDistance)
+    {
+        TeleportStartTime = FPlatformTime::Seconds();
+        bAwaitingNearChunks = true;
+    }
+    LastLocalCamera = LocalCamera;
+
+    Leaves.Reset();
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        CollectLeaves(TilePool[Tile.Value], Leaves);
+    }
+
+    WantedChunks.Reset();
+    for (const FTerrainChunkDesc& Leaf : Leaves)
+    {
+        WantedChunks.Add(Leaf.Key);
+    }
+
+    // Take what is already held or cached, the scheduler builds the rest.
+    // Chunks that are no longer wanted stay held until RebuildMesh no longer displays them.
+    for (const FTerrainChunkDesc& Leaf : Leaves)
+    {
+        if (ResidentChunks.Contains(Leaf.Key))
+        {
+            continue;
+        }
+
+        bool bPrefetched = false;
+        if (TakeCachedChunk(Leaf.Key, &bPrefetched))
+        {
+            PrefetchHits += bPrefetched ? 1 : 0;
+            continue;
+        }
+
+        if (bEnablePrefetch)
+        {
+            PrefetchMisses++;
+        }
+        Scheduler->Enqueue(Leaf, false);
+    }
+
+    const FTerrainObserver Camera {LocalCamera, 1.0f};
+    Scheduler->Reprioritize(Observers.Num() > 0 ? TConstArrayView<FTerrainObserver>(Observers) : MakeArrayView(&Camera, 1), WantedChunks.Union(CollisionWanted));
+    bMeshDirty = true;
+
+    SET_DWORD_STAT(STAT_QuadTree_Leaves, Leaves.Num());
+    UpdatePrefetchStats();
+}
+
+void UQuadTreeComponent::ProcessCompletedChunks()
+{
+    if (!Scheduler.IsValid())
+    {
+        return;
+    }
+
+    // Headless only keeps what collision holds right now
+    ChunkCache.SetBudget(IsHeadless() ? 0 : SIZE_T(ChunkCacheBudgetMB) * 1024 * 1024);
+
+    FTerrainChunkResult Result;
+    while (Scheduler->Dequeue(Result))
+    {
+        const bool bForCollision = CollisionWanted.Contains(Result.Key);
+        if (bForCollision)
+        {
+            CollisionChunks.Add(Result.Key, Result.Chunk);
+            bCollisionDirty = true;
+        }
+
+        if (WantedChunks.Contains(Result.Key))
+        {
+            ResidentChunks.Add(Result.Key, MoveTemp(Result.Chunk));
+            bMeshDirty = true;
+        }
+        else
+        {
+            ChunkCache.Add(GetCacheKey(Result.Key), MoveTemp(Result.Chunk), !bForCollision);
+        }
+    }
+
+    const FTerrainPipelineDepths Depths = Scheduler->GetQueueDepths();
+    SET_DWORD_STAT(STAT_QuadTree_QueueSample, Depths.Sample);
+    SET_DWORD_STAT(STAT_QuadTree_QueueMesh, Depths.Mesh);
+    SET_DWORD_STAT(STAT_QuadTree_QueueAttributes, Depths.Attributes);
+    SET_DWORD_STAT(STAT_QuadTree_QueueUpload, Depths.Upload);
+    SET_DWORD_STAT(STAT_QuadTree_ChunkWorkers, Scheduler->GetNumWorkers());
+    UpdatePrefetchStats();
+
+    if (DiskCache)
+    {
+        if (DiskCache->GetPendingBytes() >= SIZE_T(DiskCacheFlushMB) * 1024 * 1024)
+        {
+            DiskCache->Flush();
+        }
+        SET_MEMORY_STAT(STAT_QuadTree_DiskCacheMapped, DiskCache->GetMappedBytes());
+        SET_DWORD_STAT(STAT_QuadTree_DiskCacheHits, DiskCache->GetNumHits());
+    }
+    if (BakedData)
+    {
+        SET_MEMORY_STAT(STAT_QuadTree_BakedTilesDecoded, BakedData->GetDecodedBytes());
+        SET_DWORD_STAT(STAT_QuadTree_BakedChunks, BakedData->GetNumChunks());
+    }
+
+    // Only the slots that changed are sent to the render thread, so this can run every update
+    if (bMeshDirty)
+    {
+        RebuildMesh();
+    }
+    UpdateCollision();
+}
+
+void UQuadTreeComponent::RebuildMesh()
+{
+    bMeshDirty = false;
+
+    // Ancestors of every resident chunk, so the cover only descends below the live tree where there is something to find
+    TSet<FTerrainChunkKey> HeldAncestors;
+    auto AddAncestors = [&HeldAncestors](FTerrainChunkKey Key)
+    {
+        while (Key.Depth > 0)
+        {
+            Key = FTerrainChunkKey(Key.Depth - 1, FIntPoint(Key.Coord.X >> 1, Key.Coord.Y >> 1));
+            bool bAlreadyAdded = false;
+            HeldAncestors.Add(Key, &bAlreadyAdded);
+            if (bAlreadyAdded)
+            {
+                break;
+            }
+        }
+    };
+    for (const TPair<FTerrainChunkKey, FTerrainChunkPtr>& Held : ResidentChunks)
+    {
+        AddAncestors(Held.Key);
+    }
+
+    TArray<FTerrainChunkKey> Keys;
+    TArray<FTerrainChunkPtr> Chunks;
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        const FQuadTreeNode& Root = TilePool[Tile.Value];
+        CollectDisplayedChunks(&Root, Root.GetKey(), HeldAncestors, Keys, Chunks);
+    }
+    ReleaseChunks(TSet<FTerrainChunkKey>(Keys));
+
+    // Grid point nearest the camera, it only moves once the camera crosses into another grid cell
+    const FVector2D Origin = FVector2D(
+        FMath::GridSnap(LastLocalCamera.X, double(RenderOriginGrid)),
+        FMath::GridSnap(LastLocalCamera.Y, double(RenderOriginGrid)));
+
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_StageUpload);
+    const uint64 StartCycles = FPlatformTime::Cycles64();
+
+    // Codes are global across tiles, so a neighbour lookup works the same at tile borders
+    FTerrainLinearQuadTree Displayed;
+    for (const FTerrainChunkKey& Key : Keys)
+    {
+        Displayed.Add(FTerrainNodeCode(Key));
+    }
+
+    if (!TerrainMesh || !PatchInstances)
+    {
+        // Headless, chunks are only held for collision
+        LastMeshRebuild = FMeshRebuildStats();
+    }
+    else if (bDrawInstancedPatches)
+    {
+        TArray<FTerrainPatchInstance> Patches;
+        Patches.Reserve(Keys.Num());
+        for (int32 Index = 0; Index < Keys.Num(); ++Index)
+        {
+            Patches.Add({Keys[Index], Chunks[Index], ComputeMorph(Chunks[Index]->Desc), Displayed.GetCoarserEdges(FTerrainNodeCode(Keys[Index]))});
+        }
+
+        // The patch is displaced by at most the noise output bound, the same range the packed heights cover
+        PatchInstances->SetPatches(Patches, Origin, NoiseFunc->GetOutputBound() * FMath::Abs(Height));
+
+        // Only heights of chunks that entered the set go to the atlas
+        const int32 NumUploaded = PatchInstances->GetLastUploadTexels();
+        LastMeshRebuild.NumVertices = NumUploaded;
+        LastMeshRebuild.BytesRead = NumUploaded * sizeof(float);
+        LastMeshRebuild.BytesWritten = NumUploaded * sizeof(float);
+    }
+    else
+    {
+        TArray<FTerrainMeshChunk> MeshChunks;
+        MeshChunks.Reserve(Keys.Num());
+        for (int32 Index = 0; Index < Keys.Num(); ++Index)
+        {
+            MeshChunks.Add({Keys[Index], MoveTemp(Chunks[Index]), Displayed.GetCoarserEdges(FTerrainNodeCode(Keys[Index]))});
+        }
+
+        TerrainMesh->SetBatchVertices(RenderBatchVertices);
+        TerrainMesh->SetChunks(MeshChunks, Origin);
+
+        // Only chunks that entered the set, or all of them after a rebase, are expanded and written,
+        // plus the indices of the batches around them
+        const int32 NumUploaded = TerrainMesh->GetLastUploadVertices();
+        LastMeshRebuild.NumVertices = NumUploaded;
+        LastMeshRebuild.BytesRead = NumUploaded * sizeof(FTerrainPackedVertex);
+        LastMeshRebuild.BytesWritten = NumUploaded * UTerrainMeshComponent::GetGPUVertexBytes() + TerrainMesh->GetLastUploadIndexBytes();
+    }
+    LastMeshRebuild.BuildMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles);
+    SET_MEMORY_STAT(STAT_QuadTree_MeshRebuildRead, LastMeshRebuild.BytesRead);
+    SET_MEMORY_STAT(STAT_QuadTree_MeshRebuildWritten, LastMeshRebuild.BytesWritten);
+
+    VisibleChunks = TSet<FTerrainChunkKey>(MoveTemp(Keys));
+    CheckNearChunksVisible();
+}
+
+float UQuadTreeComponent::ComputeMorph(const FTerrainChunkDesc& Desc) const
+{
+    if (Observers.Num() == 0 || LastSubdivisionThreshold <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    // Same distance the subdivision uses, the nearest observer after weighting
+    const FVector2D Center = Desc.Position + FVector2D(Desc.Size / 2.0, Desc.Size / 2.0);
+    double Distance = MAX_dbl;
+    for (const FTerrainObserver& Observer : Observers)
+    {
+        Distance = FMath::Min(Distance, FVector2D::Distance(Center, FVector2D(Observer.Location)) / Observer.Weight);
+    }
+
+    // Depth bands are whole multiples of the threshold, morph across the outer half of this chunk's band
+    for (int32 Band = 1; Band <= 5; ++Band)
+    {
+        const float BandEnd = LastSubdivisionThreshold * Band;
+        if (ComputeDepthForDistance(BandEnd * 1.001f, LastSubdivisionThreshold) < Desc.Key.Depth)
+        {
+            const double Fraction = (Distance - (BandEnd - LastSubdivisionThreshold)) / LastSubdivisionThreshold;
+            return float(FMath::Clamp(Fraction * 2.0 - 1.0, 0.0, 1.0));
+        }
+    }
+    return 0.0f;
+}
+
+bool UQuadTreeComponent::CollectDisplayedChunks(const FQuadTreeNode* Node, const FTerrainChunkKey& Key, const TSet<FTerrainChunkKey>& HeldAncestors, TArray<FTerrainChunkKey>& OutKeys, TArray<FTerrainChunkPtr>& OutChunks)
+{
+    // Hidden nodes are drawn too, at the coarse LOD they are held at, so they still cast shadows
+    // and are on screen the moment they show up
+    const bool bSplit = Node && Node->Children.Num() > 0;
+    FTerrainChunkPtr Own = FindHeldChunk(Key);
+    if (Own && !bSplit)
+    {
+        OutKeys.Add(Key);
+        OutChunks.Add(MoveTemp(Own));
+        return true;
+    }
+
+    // Split nodes show their children, a collapsed leaf that is not ready yet keeps showing
+    // the chunks it was collapsed from. Either way all four have to be there to replace it.
+    const int32 FirstChild = OutKeys.Num();
+    bool bChildrenReady = bSplit || HeldAncestors.Contains(Key);
+    if (bChildrenReady)
+    {
+        for (int32 Index = 0; Index < 4; ++Index)
+        {
+            const FTerrainChunkKey ChildKey(Key.Depth + 1, Key.Coord * 2 + FIntPoint(Index & 1, Index >> 1));
+            const FQuadTreeNode* Child = bSplit ? &Node->Children[Index] : nullptr;
+            bChildrenReady &= CollectDisplayedChunks(Child, ChildKey, HeldAncestors, OutKeys, OutChunks);
+        }
+    }
+
+    if (bChildrenReady)
+    {
+        return true;
+    }
+
+    if (Own)
+    {
+        OutKeys.SetNum(FirstChild, false);
+        OutChunks.SetNum(FirstChild, false);
+        OutKeys.Add(Key);
+        OutChunks.Add(MoveTemp(Own));
+        return true;
+    }
+
+    // Nothing complete to show yet, keep whatever part is there
+    return false;
+}
+
+FTerrainChunkPtr UQuadTreeComponent::FindHeldChunk(const FTerrainChunkKey& Key)
+{
+    if (const FTerrainChunkPtr* Chunk = ResidentChunks.Find(Key))
+    {
+        return *Chunk;
+    }
+    return ChunkCache.Find(GetCacheKey(Key));
+}
+
+bool UQuadTreeComponent::TakeCachedChunk(const FTerrainChunkKey& Key, bool* bOutPrefetched)
+{
+    if (FTerrainChunkPtr Cached = ChunkCache.Take(GetCacheKey(Key), bOutPrefetched))
+    {
+        ResidentChunks.Add(Key, MoveTemp(Cached));
+        return true;
+    }
+    return false;
+}
+
+void UQuadTreeComponent::ReleaseChunks(const TSet<FTerrainChunkKey>& Displayed)
+{
+    int32 NumFallback = 0;
+
+    // Cached chunks that are on screen again can no longer be evicted
+    for (const FTerrainChunkKey& Key : Displayed)
+    {
+        if (!ResidentChunks.Contains(Key))
+        {
+            TakeCachedChunk(Key);
+        }
+    }
+
+    for (auto It = ResidentChunks.CreateIterator(); It; ++It)
+    {
+        if (WantedChunks.Contains(It.Key()))
+        {
+            continue;
+        }
+
+        if (Displayed.Contains(It.Key()))
+        {
+            NumFallback++;
+            continue;
+        }
+
+        ChunkCache.Add(GetCacheKey(It.Key()), MoveTemp(It.Value()), false);
+        It.RemoveCurrent();
+    }
+
+    SET_DWORD_STAT(STAT_QuadTree_FallbackChunks, NumFallback);
+}
+
+void UQuadTreeComponent::UpdateCollision()
+{
+    const double Now = FPlatformTime::Seconds();
+    if (!Scheduler.IsValid() || Now - LastCollisionUpdateTime < CollisionUpdateInterval)
+    {
+        return;
+    }
+
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_StageCollision);
+    LastCollisionUpdateTime = Now;
+
+    TArray<FVector2D> Anchors;
+    TArray<const AActor*> AnchorActors;
+    GatherCollisionAnchors(Anchors, &AnchorActors);
+
+    // Fixed depth cells around every anchor, the visual LOD never changes this set
+    const int32 NumCells = 1 << CollisionDepth;
+    const double CellSize = TileExtent / NumCells;
+    CollisionWanted.Reset();
+    TArray<TArray<FTerrainChunkKey>> AnchorKeys;
+    AnchorKeys.SetNum(Anchors.Num());
+    for (int32 AnchorIndex = 0; AnchorIndex < Anchors.Num(); ++AnchorIndex)
+    {
+        const FVector2D& Anchor = Anchors[AnchorIndex];
+        FIntPoint MinCell(FMath::FloorToInt((Anchor.X - CollisionRadius - TileOrigin.X) / CellSize), FMath::FloorToInt((Anchor.Y - CollisionRadius - TileOrigin.Y) / CellSize));
+        FIntPoint MaxCell(FMath::FloorToInt((Anchor.X + CollisionRadius - TileOrigin.X) / CellSize), FMath::FloorToInt((Anchor.Y + CollisionRadius - TileOrigin.Y) / CellSize));
+
+        // Cells continue across tiles in an infinite world, a finite one ends at its single root
+        if (!bInfiniteWorld)
+        {
+            MinCell = MinCell.ComponentMax(FIntPoint::ZeroValue);
+            MaxCell = MaxCell.ComponentMin(FIntPoint(NumCells - 1, NumCells - 1));
+        }
+
+        for (int32 Y = MinCell.Y; Y <= MaxCell.Y; ++Y)
+        {
+            for (int32 X = MinCell.X; X <= MaxCell.X; ++X)
+            {
+                const FTerrainChunkDesc Desc {FTerrainChunkKey(CollisionDepth, FIntPoint(X, Y)), TileOrigin + FVector2D(X, Y) * CellSize, CellSize};
+                const FBox2D Footprint(Desc.Position, Desc.Position + FVector2D(CellSize, CellSize));
+                if (Footprint.ComputeSquaredDistanceToPoint(Anchor) > FMath::Square(CollisionRadius))
+                {
+                    continue;
+                }
+
+                AnchorKeys[AnchorIndex].Add(Desc.Key);
+                bool bAlreadyWanted = false;
+                CollisionWanted.Add(Desc.Key, &bAlreadyWanted);
+                if (bAlreadyWanted || CollisionChunks.Contains(Desc.Key))
+                {
+                    continue;
+                }
+
+                if (FTerrainChunkPtr Held = FindHeldChunk(Desc.Key))
+                {
+                    CollisionChunks.Add(Desc.Key, MoveTemp(Held));
+                    bCollisionDirty = true;
+                }
+                else
+                {
+                    Scheduler->Enqueue(Desc, false);
+                }
+            }
+        }
+    }
+
+    for (auto It = CollisionChunks.CreateIterator(); It; ++It)
+    {
+        if (!CollisionWanted.Contains(It.Key()))
+        {
+            It.RemoveCurrent();
+            bCollisionDirty = true;
+        }
+    }
+
+    SET_DWORD_STAT(STAT_QuadTree_CollisionChunks, CollisionChunks.Num());
+
+    if (bCollisionDirty)
+    {
+        RebuildCollisionMesh();
+    }
+
+    UpdateAnchorReports(AnchorKeys, AnchorActors, (FPlatformTime::Seconds() - Now) * 1000.0);
+}
+
+void UQuadTreeComponent::UpdateAnchorReports(const TArray<TArray<FTerrainChunkKey>>& AnchorKeys, const TArray<const AActor*>& AnchorActors, double UpdateMs)
+{
+    TMap<FTerrainChunkKey, int32> NumSharers;
+    for (const TArray<FTerrainChunkKey>& Keys : AnchorKeys)
+    {
+        for (const FTerrainChunkKey& Key : Keys)
+        {
+            NumSharers.FindOrAdd(Key)++;
+        }
+    }
+
+    AnchorReports.Reset(AnchorKeys.Num());
+    double TotalBytes = 0.0;
+    double TotalBuildMs = 0.0;
+    for (int32 AnchorIndex = 0; AnchorIndex < AnchorKeys.Num(); ++AnchorIndex)
+    {
+        FCollisionAnchorReport& Report = AnchorReports.AddDefaulted_GetRef();
+        const AActor* AnchorActor = AnchorActors[AnchorIndex];
+        const APlayerController* PlayerController = Cast<APlayerController>(AnchorActor);
+        Report.Name = PlayerController && PlayerController->PlayerState ? PlayerController->PlayerState->GetPlayerName()
+            : AnchorActor ? AnchorActor->GetName() : TEXT("None");
+
+        for (const FTerrainChunkKey& Key : AnchorKeys[AnchorIndex])
+        {
+            const FTerrainChunkPtr* Chunk = CollisionChunks.Find(Key);
+            if (!Chunk)
+            {
+                continue;
+            }
+
+            SIZE_T Bytes = (*Chunk)->GetAllocatedSize();
+            const TWeakObjectPtr<UTerrainHeightfieldCollisionComponent>* Component = HeightfieldComponents.Find(Key);
+            if (Component && Component->IsValid())
+            {
+                Bytes += (*Component)->GetHeightfieldMemory();
+            }
+
+            const double Share = 1.0 / NumSharers[Key];
+            Report.NumChunks++;
+            Report.Bytes += Bytes * Share;
+            Report.BuildMs += FPlatformTime::ToMilliseconds64((*Chunk)->BuildCycles) * Share;
+        }
+
+        TotalBytes += Report.Bytes;
+        TotalBuildMs += Report.BuildMs;
+    }
+
+    const int32 NumAnchors = FMath::Max(AnchorReports.Num(), 1);
+    SET_DWORD_STAT(STAT_QuadTree_CollisionAnchors, AnchorReports.Num());
+    SET_MEMORY_STAT(STAT_QuadTree_MemoryPerAnchor, SIZE_T(TotalBytes / NumAnchors));
+    SET_FLOAT_STAT(STAT_QuadTree_BuildPerAnchor, float(TotalBuildMs / NumAnchors));
+    SET_FLOAT_STAT(STAT_QuadTree_UpdatePerAnchor, float(UpdateMs / NumAnchors));
+}
+
+void UQuadTreeComponent::LogCollisionReport() const
+{
+    UE_LOG(LogQuadTree, Log, TEXT("%s: %d collision anchors, %d collision chunks%s"),
+        *GetOwner()->GetName(), AnchorReports.Num(), CollisionChunks.Num(), IsHeadless() ? TEXT(", headless") : TEXT(""));
+    for (const FCollisionAnchorReport& Report : AnchorReports)
+    {
+        UE_LOG(LogQuadTree, Log, TEXT("  %s: %d chunks, %.1f KB, %.2f ms to build"), *Report.Name, Report.NumChunks, Report.Bytes / 1024.0, Report.BuildMs);
+    }
+}
+
+bool UQuadTreeComponent::IsHeadless() const
+{
+    return bForceHeadless || IsRunningDedicatedServer();
+}
+
+void UQuadTreeComponent::GatherCollisionAnchors(TArray<FVector2D>& OutAnchors, TArray<const AActor*>* OutActors) const
+{
+    const FVector ActorLocation = GetOwner()->GetActorLocation();
+
+    for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+    {
+        const APlayerController* PlayerController = It->Get();
+        if (PlayerController && PlayerController->GetPawn())
+        {
+            OutAnchors.Add(FVector2D(PlayerController->GetPawn()->GetActorLocation() - ActorLocation));
+            if (OutActors)
+            {
+                OutActors->Add(PlayerController);
+            }
+        }
+    }
+
+    for (const TWeakObjectPtr<AActor>& Actor : CollisionActors)
+    {
+        if (Actor.IsValid())
+        {
+            OutAnchors.Add(FVector2D(Actor->GetActorLocation() - ActorLocation));
+            if (OutActors)
+            {
+                OutActors->Add(Actor.Get());
+            }
+        }
+    }
+}
+
+void UQuadTreeComponent::RebuildCollisionMesh()
+{
+    bCollisionDirty = false;
+
+    const double StartTime = FPlatformTime::Seconds();
+    if (bUseHeightfieldCollision)
+    {
+        RebuildHeightfieldCollision();
+    }
+    else
+    {
+        RebuildTrimeshCollision();
+    }
+    SET_FLOAT_STAT(STAT_QuadTree_CollisionRebuild, float((FPlatformTime::Seconds() - StartTime) * 1000.0));
+}
+
+void UQuadTreeComponent::RebuildHeightfieldCollision()
+{
+    for (auto It = HeightfieldComponents.CreateIterator(); It; ++It)
+    {
+        if (!CollisionChunks.Contains(It.Key()) || !It.Value().IsValid())
+        {
+            if (It.Value().IsValid())
+            {
+                It.Value()->DestroyComponent();
+            }
+            It.RemoveCurrent();
+        }
+    }
+
+    // Every component is built once for its chunk and destroyed with it, the geometry never changes underneath Chaos
+    SIZE_T Memory = 0;
+    for (const TPair<FTerrainChunkKey, FTerrainChunkPtr>& Chunk : CollisionChunks)
+    {
+        TWeakObjectPtr<UTerrainHeightfieldCollisionComponent>& Component = HeightfieldComponents.FindOrAdd(Chunk.Key);
+        if (!Component.IsValid())
+        {
+            UTerrainHeightfieldCollisionComponent* NewComponent = NewObject<UTerrainHeightfieldCollisionComponent>(GetOwner());
+            NewComponent->SetChunk(*Chunk.Value);
+
+            // Left unattached: a static component cannot sit under the movable actor root, so it is placed in world space
+            NewComponent->SetWorldLocation(GetOwner()->GetActorLocation() + FVector(Chunk.Value->Desc.Position, 0.0f));
+            NewComponent->RegisterComponent();
+            Component = NewComponent;
+        }
+        Memory += Component->GetHeightfieldMemory();
+    }
+
+    SET_MEMORY_STAT(STAT_QuadTree_CollisionMemory, Memory);
+}
+
+void UQuadTreeComponent::RebuildTrimeshCollision()
+{
+    DestroyHeightfieldCollision();
+    UpdateOwnedComponents();
+
+    if (CollisionChunks.Num() == 0)
+    {
+        CollisionMesh->ClearMeshSection(0);
+        SET_MEMORY_STAT(STAT_QuadTree_CollisionMemory, 0);
+        return;
+    }
+
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_TrimeshSection);
+
+    // Same idea as the render mesh, vertices relative to a grid point next to the collision set
+    const FVector2D FirstOrigin = CollisionChunks.CreateConstIterator()->Value->Desc.Position;
+    const FVector2D Origin(FMath::GridSnap(FirstOrigin.X, double(RenderOriginGrid)), FMath::GridSnap(FirstOrigin.Y, double(RenderOriginGrid)));
+
+    TArray<FVector> Vertices;
+    TArray<int32> Triangles;
+    for (const TPair<FTerrainChunkKey, FTerrainChunkPtr>& Chunk : CollisionChunks)
+    {
+        const int32 BaseVertex = Vertices.Num();
+        const FVector Offset = Chunk.Value->GetOrigin() - FVector(Origin, 0.0);
+        for (const FTerrainPackedVertex& Vertex : Chunk.Value->Vertices)
+        {
+            Vertices.Add(Offset + FVector(Chunk.Value->GetVertexPosition(Vertex)));
+        }
+        for (int32 Triangle : Chunk.Value->Triangles)
+        {
+            Triangles.Add(BaseVertex + Triangle);
+        }
+    }
+
+    // Source data only, the cooked BVH comes on top of this
+    SET_MEMORY_STAT(STAT_QuadTree_CollisionMemory, Vertices.GetAllocatedSize() + Triangles.GetAllocatedSize());
+
+    // Cooking happens off the game thread through bUseAsyncCooking
+    CollisionMesh->SetRelativeLocation(FVector(Origin, 0.0));
+    CollisionMesh->CreateMeshSection(
+        0,
+        Vertices,
+        Triangles,
+        TArray<FVector>(),
+        TArray<FVector2D>(),
+        TArray<FColor>(),
+        TArray<FProcMeshTangent>(),
+        true
+    );
+}
+
+void UQuadTreeComponent::DestroyHeightfieldCollision()
+{
+    for (const TPair<FTerrainChunkKey, TWeakObjectPtr<UTerrainHeightfieldCollisionComponent>>& Component : HeightfieldComponents)
+    {
+        if (Component.Value.IsValid())
+        {
+            Component.Value->DestroyComponent();
+        }
+    }
+    HeightfieldComponents.Empty();
+}
+
+FTerrainHeightFieldPtr UQuadTreeComponent::GetHeightField() const
+{
+    FScopeLock Lock(&HeightFieldMutex);
+    return HeightField;
+}
+
+FTerrainQuadTreeSnapshotPtr UQuadTreeComponent::GetQuadTreeSnapshot() const
+{
+    FScopeLock Lock(&SnapshotMutex);
+    return Snapshot;
+}
+
+void UQuadTreeComponent::GetLeavesInBox(const FBox& Box, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    if (const FTerrainQuadTreeSnapshotPtr Tree = GetQuadTreeSnapshot())
+    {
+        Tree->GetLeavesInBox(Box, OutLeaves);
+    }
+}
+
+void UQuadTreeComponent::GetLeavesInSphere(const FVector& Center, double Radius, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    if (const FTerrainQuadTreeSnapshotPtr Tree = GetQuadTreeSnapshot())
+    {
+        Tree->GetLeavesInSphere(Center, Radius, OutLeaves);
+    }
+}
+
+void UQuadTreeComponent::GetLeavesAlongRay(const FVector& Start, const FVector& End, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    if (const FTerrainQuadTreeSnapshotPtr Tree = GetQuadTreeSnapshot())
+    {
+        Tree->GetLeavesAlongRay(Start, End, OutLeaves);
+    }
+}
+
+float UQuadTreeComponent::GetHeightAt(const FVector2D& Location) const
+{
+    const FTerrainHeightFieldPtr Field = GetHeightField();
+    return Field.IsValid() ? Field->GetHeightAt(Location) : 0.0f;
+}
+
+FVector UQuadTreeComponent::GetNormalAt(const FVector2D& Location) const
+{
+    const FTerrainHeightFieldPtr Field = GetHeightField();
+    return Field.IsValid() ? Field->GetNormalAt(Location) : FVector::UpVector;
+}
+
+bool UQuadTreeComponent::Raycast(const FVector& Start, const FVector& End, FTerrainRayHit& OutHit) const
+{
+    const FTerrainHeightFieldPtr Field = GetHeightField();
+    OutHit = FTerrainRayHit();
+    return Field.IsValid() && Field->Raycast(Start, End, OutHit);
+}
+
+void UQuadTreeComponent::GetHeightsAt(TConstArrayView<FVector2D> Locations, TArrayView<float> OutHeights) const
+{
+    if (const FTerrainHeightFieldPtr Field = GetHeightField())
+    {
+        Field->GetHeightsAt(Locations, OutHeights);
+    }
+    else
+    {
+        for (float& OutHeight : OutHeights)
+        {
+            OutHeight = 0.0f;
+        }
+    }
+}
+
+void UQuadTreeComponent::GetNormalsAt(TConstArrayView<FVector2D> Locations, TArrayView<FVector> OutNormals) const
+{
+    if (const FTerrainHeightFieldPtr Field = GetHeightField())
+    {
+        Field->GetNormalsAt(Locations, OutNormals);
+    }
+    else
+    {
+        for (FVector& OutNormal : OutNormals)
+        {
+            OutNormal = FVector::UpVector;
+        }
+    }
+}
+
+void UQuadTreeComponent::RaycastBatch(TConstArrayView<FVector> Starts, TConstArrayView<FVector> Ends, TArrayView<FTerrainRayHit> OutHits) const
+{
+    if (const FTerrainHeightFieldPtr Field = GetHeightField())
+    {
+        Field->RaycastBatch(Starts, Ends, OutHits);
+    }
+    else
+    {
+        for (FTerrainRayHit& OutHit : OutHits)
+        {
+            OutHit = FTerrainRayHit();
+        }
+    }
+}
+
+void UQuadTreeComponent::RunCollisionTraceBenchmark(int32 NumTraces) const
+{
+    TArray<FVector2D> Anchors;
+    GatherCollisionAnchors(Anchors);
+    if (Anchors.Num() == 0 || NumTraces <= 0)
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Collision trace benchmark needs a player pawn or a registered collision actor"));
+        return;
+    }
+
+    // Same stream every run so both collision modes trace the same points
+    FRandomStream Random(NumTraces);
+    const FVector ActorLocation = GetOwner()->GetActorLocation();
+    const float TraceHalfHeight = FMath::Max(Height, 1.0f) * 2.0f;
+    TArray<FVector> Starts;
+    Starts.Reserve(NumTraces);
+    for (int32 Index = 0; Index < NumTraces; ++Index)
+    {
+        const float Angle = Random.FRandRange(0.0f, 2.0f * PI);
+        const FVector2D Point = Anchors[Index % Anchors.Num()] + FVector2D(FMath::Cos(Angle), FMath::Sin(Angle)) * Random.FRandRange(0.0f, CollisionRadius);
+        Starts.Add(ActorLocation + FVector(Point, TraceHalfHeight));
+    }
+
+    int32 NumHits = 0;
+    FHitResult Hit;
+    const double StartTime = FPlatformTime::Seconds();
+    for (const FVector& Start : Starts)
+    {
+        NumHits += GetWorld()->LineTraceSingleByChannel(Hit, Start, Start - FVector(0.0f, 0.0f, TraceHalfHeight * 2.0f), ECC_Visibility) ? 1 : 0;
+    }
+    const double ElapsedUs = (FPlatformTime::Seconds() - StartTime) * 1000000.0;
+
+    UE_LOG(LogQuadTree, Log, TEXT("%s collision: %d traces, %d hits, %.2f us per trace over %d chunks"),
+        bUseHeightfieldCollision ? TEXT("Heightfield") : TEXT("Trimesh"), NumTraces, NumHits, ElapsedUs / NumTraces, CollisionChunks.Num());
+}
+
+void UQuadTreeComponent::RunNeighbourBenchmark(int32 NumQueries) const
+{
+    FTerrainLinearQuadTree Tree;
+    for (const TPair<FIntPoint, int32>& Tile : LoadedTiles)
+    {
+        CollectLeafCodes(TilePool[Tile.Value], Tree);
+    }
+    if (Tree.Num() == 0 || NumQueries <= 0)
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Neighbour benchmark needs a built quadtree"));
+        return;
+    }
+
+    // Same-level neighbours of random leaves, each answered with the leaf that covers it
+    const TArray<FTerrainNodeCode> Leaves = Tree.GetLeaves();
+    FRandomStream Random(NumQueries);
+    TArray<FTerrainNodeCode> Queries;
+    Queries.Reserve(NumQueries);
+    for (int32 Index = 0; Index < NumQueries; ++Index)
+    {
+        const FTerrainNodeCode& Leaf = Leaves[Random.RandHelper(Leaves.Num())];
+        const int32 Axis = Index & 1;
+        const int32 Sign = Index & 2 ? 1 : -1;
+        Queries.Add(Leaf.GetNeighbour(Axis == 0 ? Sign : 0, Axis == 1 ? Sign : 0));
+    }
+
+    int32 LinearFound = 0;
+    FTerrainNodeCode Found;
+    const uint64 LinearStart = FPlatformTime::Cycles64();
+    for (const FTerrainNodeCode& Query : Queries)
+    {
+        LinearFound += Tree.FindCoveringLeaf(Query, Found) ? 1 : 0;
+    }
+    const uint64 DescentStart = FPlatformTime::Cycles64();
+    int32 DescentFound = 0;
+    for (const FTerrainNodeCode& Query : Queries)
+    {
+        DescentFound += FindLeafAt(Query.ToKey()) ? 1 : 0;
+    }
+    const uint64 DescentEnd = FPlatformTime::Cycles64();
+
+    const double LinearSeconds = FMath::Max(FPlatformTime::ToSeconds64(DescentStart - LinearStart), UE_DOUBLE_SMALL_NUMBER);
+    const double DescentSeconds = FMath::Max(FPlatformTime::ToSeconds64(DescentEnd - DescentStart), UE_DOUBLE_SMALL_NUMBER);
+    UE_LOG(LogQuadTree, Log, TEXT("Neighbour queries over %d leaves: linear quadtree %.2f M/s (%d found), descent from the root %.2f M/s (%d found), %.2fx"),
+        Leaves.Num(), NumQueries / LinearSeconds / 1.0e6, LinearFound, NumQueries / DescentSeconds / 1.0e6, DescentFound, DescentSeconds / LinearSeconds);
+}
 
-        return VertexData;
-        
+void UQuadTreeComponent::RunSpatialQueryBenchmark(int32 NumQueries, float Radius) const
+{
+    const FTerrainQuadTreeSnapshotPtr Tree = GetQuadTreeSnapshot();
+    if (!Tree || Tree->GetNumNodes() == 0 || Observers.Num() == 0 || NumQueries <= 0)
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Spatial query benchmark needs a built quadtree and an observer"));
+        return;
+    }
+
+    FRandomStream Random(NumQueries);
+    const FVector ActorLocation = GetOwner()->GetActorLocation();
+    TArray<FVector> Centers;
+    Centers.Reserve(NumQueries);
+    for (int32 Index = 0; Index < NumQueries; ++Index)
+    {
+        const FVector& Observer = Observers[Index % Observers.Num()].Location;
+        Centers.Add(ActorLocation + Observer + Random.VRand().GetSafeNormal2D() * Random.FRandRange(0.0f, LastSubdivisionThreshold * 5.0f));
+    }
+
+    // One result array per query, as a gameplay task would have
+    TArray<int32> Found;
+    Found.SetNumZeroed(NumQueries);
+    const uint64 StartCycles = FPlatformTime::Cycles64();
+    ParallelFor(NumQueries, [&](int32 Index)
+    {
+        TArray<FTerrainLeaf> Results;
+        Tree->GetLeavesInSphere(Centers[Index], Radius, Results);
+        Found[Index] = Results.Num();
     });
-    
-    FutureData.Next([this](FGeometryData VertexData)
-    {
-        AsyncTask(ENamedThreads::GameThread, [this, VertexData]()
-        {
-            ProceduralMesh->CreateMeshSection(
-                0,
-                VertexData.Vertices,
-                VertexData.Triangles,
-                TArray<FVector>(),       
-                TArray<FVector2D>(),    
-                TArray<FColor>(),       
-                TArray<FProcMeshTangent>(), 
-                true                    
-            );
-        });
+    const double ElapsedMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles);
+
+    int64 NumFound = 0;
+    for (int32 Count : Found)
+    {
+        NumFound += Count;
+    }
+    UE_LOG(LogQuadTree, Log, TEXT("Spatial queries: %d spheres of radius %.0f over %d leaves in %.2f ms (%.2f us each across workers), %.1f leaves per query"),
+        NumQueries, Radius, Tree->GetNumLeaves(), ElapsedMs, ElapsedMs * 1000.0 / NumQueries, double(NumFound) / NumQueries);
+}
+
+void UQuadTreeComponent::RunHeightCodecBenchmark(int32 NumTiles, float MaxError) const
+{
+    if (!NoiseFunc || TileExtent <= 0.0 || NumTiles <= 0)
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Height codec benchmark needs an initialized quadtree"));
+        return;
+    }
+
+    // Tiles of every size the quadtree builds, at random places on the streamed lattice
+    FRandomStream Random(NumTiles);
+    FTerrainGenerationSettings Settings;
+    Settings.Height = Height;
+    Settings.Resolution = 256;
+    Settings.bBuildMesh = false;
+    Settings.bBuildAttributes = false;
+    TArray<FTerrainChunkData> Tiles;
+    Tiles.SetNum(NumTiles);
+    for (FTerrainChunkData& Tile : Tiles)
+    {
+        const int32 Depth = Random.RandRange(0, FMath::Clamp(MaxDepth, 0, 20));
+        const FVector2D Origin(Random.FRandRange(-TileExtent, TileExtent), Random.FRandRange(-TileExtent, TileExtent));
+        Tile.Desc = {FTerrainChunkKey(Depth, FIntPoint::ZeroValue), TileOrigin + Origin, TileExtent / (1 << Depth)};
+    }
+    ParallelFor(NumTiles, [&](int32 Index)
+    {
+        FastNoiseLite Noise = *NoiseFunc;
+        SampleTerrainChunk(Noise, Settings, Tiles[Index]);
     });
+
+    const int32 GridSize = Tiles[0].GetGridSize();
+    const double RawBytes = double(NumTiles) * GridSize * GridSize * sizeof(float);
+    static constexpr int32 DecodePasses = 4;
+
+    auto LogResult = [&](const TCHAR* Name, int64 EncodedBytes, double EncodeSeconds, double DecodeSeconds, const FString& Detail)
+    {
+        UE_LOG(LogQuadTree, Log, TEXT("%-16s %.2fx (%.2f bytes per sample), encode %.1f MB/s, decode %.2f GB/s%s"),
+            Name, RawBytes / FMath::Max<int64>(EncodedBytes, 1), EncodedBytes / (RawBytes / sizeof(float)),
+            RawBytes / FMath::Max(EncodeSeconds, UE_DOUBLE_SMALL_NUMBER) / 1.0e6,
+            RawBytes * DecodePasses / FMath::Max(DecodeSeconds, UE_DOUBLE_SMALL_NUMBER) / 1.0e9, *Detail);
+    };
+
+    UE_LOG(LogQuadTree, Log, TEXT("Height codec on %d tiles of %d^2 samples, %.1f MB of floats, one core:"), NumTiles, GridSize, RawBytes / (1024.0 * 1024.0));
+
+    TArray<float> Errors = {0.0f};
+    if (MaxError > 0.0f)
+    {
+        Errors.Add(MaxError);
+    }
+    TArray<float> Decoded;
+    for (const float Error : Errors)
+    {
+        TArray<uint8> Stream;
+        const uint64 EncodeStart = FPlatformTime::Cycles64();
+        for (const FTerrainChunkData& Tile : Tiles)
+        {
+            EncodeTerrainHeights(Tile.Heights, GridSize, GridSize, Error, Stream);
+        }
+        const uint64 DecodeStart = FPlatformTime::Cycles64();
+        bool bDecoded = true;
+        for (int32 Pass = 0; Pass < DecodePasses; ++Pass)
+        {
+            int32 Offset = 0;
+            for (int32 Index = 0; Index < NumTiles && bDecoded; ++Index)
+            {
+                int32 Width, Rows;
+                const int32 Bytes = DecodeTerrainHeights(TConstArrayView<uint8>(Stream).RightChop(Offset), Decoded, Width, Rows);
+                bDecoded = Bytes > 0;
+                Offset += Bytes;
+            }
+        }
+        const uint64 DecodeEnd = FPlatformTime::Cycles64();
+
+        // Checked apart from the timing, against the sampled floats
+        double WorstError = 0.0;
+        bool bExact = bDecoded;
+        int32 Offset = 0;
+        for (int32 Index = 0; Index < NumTiles && bDecoded; ++Index)
+        {
+            int32 Width, Rows;
+            Offset += DecodeTerrainHeights(TConstArrayView<uint8>(Stream).RightChop(Offset), Decoded, Width, Rows);
+            bExact &= FMemory::Memcmp(Decoded.GetData(), Tiles[Index].Heights.GetData(), Decoded.Num() * sizeof(float)) == 0;
+            for (int32 Sample = 0; Sample < Decoded.Num(); ++Sample)
+            {
+                WorstError = FMath::Max(WorstError, double(FMath::Abs(Decoded[Sample] - Tiles[Index].Heights[Sample])));
+            }
+        }
+
+        const FString Detail = !bDecoded ? TEXT(", FAILED to decode")
+            : Error == 0.0f ? (bExact ? TEXT(", bit exact") : TEXT(", NOT bit exact"))
+            : FString::Printf(TEXT(", worst error %.3f of %.3f allowed"), WorstError, Error);
+        LogResult(Error == 0.0f ? TEXT("Codec lossless") : TEXT("Codec bounded"), Stream.Num(), FPlatformTime::ToSeconds64(DecodeStart - EncodeStart),
+            FPlatformTime::ToSeconds64(DecodeEnd - DecodeStart), Detail);
+    }
+
+    // General purpose compressors on the same floats, one buffer per tile as the caches would keep them
+    Decoded.SetNumUninitialized(GridSize * GridSize);
+    for (const FName Format : {NAME_Zlib, NAME_Oodle})
+    {
+        if (!FCompression::IsFormatValid(Format))
+        {
+            continue;
+        }
+
+        TArray<TArray<uint8>> Compressed;
+        Compressed.SetNum(NumTiles);
+        int64 CompressedBytes = 0;
+        const int32 TileBytes = Decoded.Num() * sizeof(float);
+        const uint64 EncodeStart = FPlatformTime::Cycles64();
+        for (int32 Index = 0; Index < NumTiles; ++Index)
+        {
+            int32 Size = FCompression::CompressMemoryBound(Format, TileBytes);
+            Compressed[Index].SetNumUninitialized(Size);
+            FCompression::CompressMemory(Format, Compressed[Index].GetData(), Size, Tiles[Index].Heights.GetData(), TileBytes);
+            Compressed[Index].SetNum(Size);
+            CompressedBytes += Size;
+        }
+        const uint64 DecodeStart = FPlatformTime::Cycles64();
+        bool bDecoded = true;
+        for (int32 Pass = 0; Pass < DecodePasses; ++Pass)
+        {
+            for (const TArray<uint8>& Tile : Compressed)
+            {
+                bDecoded &= FCompression::UncompressMemory(Format, Decoded.GetData(), TileBytes, Tile.GetData(), Tile.Num());
+            }
+        }
+        const uint64 DecodeEnd = FPlatformTime::Cycles64();
+
+        LogResult(*FString::Printf(TEXT("%s floats"), *Format.ToString()), CompressedBytes, FPlatformTime::ToSeconds64(DecodeStart - EncodeStart),
+            FPlatformTime::ToSeconds64(DecodeEnd - DecodeStart), bDecoded ? FString() : FString(TEXT(", FAILED to decode")));
+    }
 }
 
-void UQuadTreeComponent::AddVertex(const FVector& Vertex, TArray<FVector>& OutVertices, TMap<FVector, int32>& VertexMap, int32& OutVertexIndex)
+void UQuadTreeComponent::ValidatePrecision(double Distance) const
 {
-    int32* ExistingIndex = VertexMap.Find(Vertex);
-    if (ExistingIndex)
+    if (!NoiseFunc)
     {
-        OutVertexIndex = *ExistingIndex;
+        return;
     }
-    else
+
+    // A finest level chunk, where precision problems show up first
+    FastNoiseLite Noise = *NoiseFunc;
+    FTerrainGenerationSettings Settings;
+    Settings.Height = Height;
+    Settings.HeightBound = NoiseFunc->GetOutputBound() * FMath::Abs(Height);
+    Settings.Resolution = FMath::Max(PatchResolution, 1);
+    FTerrainChunkData Chunk;
+    Chunk.Desc = {FTerrainChunkKey(MaxDepth, FIntPoint::ZeroValue), FVector2D(Distance, Distance), TileExtent / (1 << MaxDepth)};
+    SampleTerrainChunk(Noise, Settings, Chunk);
+    BuildTerrainChunkMesh(Settings, Chunk);
+
+    const int32 GridSize = Chunk.GetGridSize();
+    const double Step = Chunk.Desc.Size / Chunk.Resolution;
+    const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Chunk.Resolution);
+    double MaxVertexError = 0.0;
+    double MaxFloatVertexError = 0.0;
+    double MaxFloatNoiseError = 0.0;
+    for (int32 Y = 0; Y < GridSize; ++Y)
+    {
+        for (int32 X = 0; X < GridSize; ++X)
+        {
+            const int32 Index = Y * GridSize + X;
+            const FVector2D Sample = Chunk.Desc.Position + FVector2D(X, Y) * Step;
+            const FVector Exact(Sample, Chunk.Heights[Index]);
+
+            // Origin plus 32-bit local offset against an absolute 32-bit position
+            MaxVertexError = FMath::Max(MaxVertexError, FVector::Dist(Chunk.GetOrigin() + FVector(Chunk.GetVertexPosition(Chunk.Vertices[Layout.GridToVertex[Index]])), Exact));
+            MaxFloatVertexError = FMath::Max(MaxFloatVertexError, FVector::Dist(FVector(FVector3f(Exact)), Exact));
+
+            // Same sample with the coordinates narrowed to float before they reach the noise
+            const double FloatHeight = Noise.GetNoise(float(Sample.X), float(Sample.Y)) * Height;
+            MaxFloatNoiseError = FMath::Max(MaxFloatNoiseError, FMath::Abs(FloatHeight - Chunk.Heights[Index]));
+        }
+    }
+
+    // Near the origin both paths see the same values, so the difference is only the cost of doubles
+    const int32 NumTimingSamples = 100000;
+    float Sink = 0.0f;
+    const uint64 DoubleStart = FPlatformTime::Cycles64();
+    for (int32 Index = 0; Index < NumTimingSamples; ++Index)
+    {
+        Sink += Noise.GetNoise(double(Index % 317) * Step, double(Index / 317) * Step);
+    }
+    const uint64 FloatStart = FPlatformTime::Cycles64();
+    for (int32 Index = 0; Index < NumTimingSamples; ++Index)
     {
-        OutVertexIndex = OutVertices.Num();
-        VertexMap.Add(Vertex, OutVertexIndex);
-        OutVertices.Add(Vertex);
+        Sink += Noise.GetNoise(float((Index % 317) * Step), float((Index / 317) * Step));
     }
+    const uint64 FloatEnd = FPlatformTime::Cycles64();
+
+    UE_LOG(LogQuadTree, Log, TEXT("Precision at %.0f: vertex error %.6f (absolute float %.6f), noise height error of float coordinates %.6f, double sampling %.2fx float near the origin (%f)"),
+        Distance, MaxVertexError, MaxFloatVertexError, MaxFloatNoiseError,
+        FloatEnd > FloatStart ? double(FloatStart - DoubleStart) / double(FloatEnd - FloatStart) : 0.0, Sink);
 }
 
-void UQuadTreeComponent::GenerateMeshRecursive(FQuadTreeNode& Node, TArray<FVector>& OutVertices, TArray<int32>& OutIndices, TMap<FVector, int32>& VertexMap)
+static FAutoConsoleCommandWithWorldAndArgs ValidatePrecisionCommand(
+    TEXT("QuadTree.ValidatePrecision"),
+    TEXT("Logs vertex and noise precision of a terrain chunk far from the origin. Usage: QuadTree.ValidatePrecision [Distance]"),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+    {
+        const double Distance = Args.Num() > 0 ? FCString::Atod(*Args[0]) : 1.0e7;
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->ValidatePrecision(Distance);
+            }
+        }
+    }));
+
+void UQuadTreeComponent::LogVertexFormatReport() const
 {
-    
+    const FMeshRebuildStats& Stats = LastMeshRebuild;
+    const double FullBytesRead = double(Stats.NumVertices) * FullChunkVertexBytes;
+
+    UE_LOG(LogQuadTree, Log, TEXT("%s: chunk vertex %d bytes (%d as full vectors), GPU vertex %d bytes"),
+        *GetOwner()->GetName(), int32(sizeof(FTerrainPackedVertex)), int32(FullChunkVertexBytes), int32(UTerrainMeshComponent::GetGPUVertexBytes()));
+    UE_LOG(LogQuadTree, Log, TEXT("  last rebuild: %d vertices uploaded, %.1f KB read (%.1f KB as full vectors), %.1f KB written to the GPU, %.2f ms on the game thread"),
+        Stats.NumVertices, Stats.BytesRead / 1024.0, FullBytesRead / 1024.0, Stats.BytesWritten / 1024.0, Stats.BuildMs);
+    if (!TerrainMesh || !PatchInstances)
+    {
+        UE_LOG(LogQuadTree, Log, TEXT("  headless, no render components"));
+        return;
+    }
+    UE_LOG(LogQuadTree, Log, TEXT("  slot mesh: %d chunks in %d batches of up to %d vertices, %.1f KB of indices rebuilt"),
+        TerrainMesh->GetNumChunks(), TerrainMesh->GetNumBatches(), RenderBatchVertices, TerrainMesh->GetLastUploadIndexBytes() / 1024.0);
+
+    // Footprint of one patch in either render mode, and what a chunk costs to generate in the current one
+    const int32 GridSize = FMath::Max(PatchResolution, 1) + 1;
+    const SIZE_T SlotBytes = FMath::Square(GridSize) * UTerrainMeshComponent::GetGPUVertexBytes();
+    const SIZE_T InstancedBytes = FMath::Square(GridSize) * sizeof(float) + PatchInstances->GetInstanceBytes();
+    uint64 BuildCycles = 0;
+    for (const TPair<FTerrainChunkKey, FTerrainChunkPtr>& Resident : ResidentChunks)
+    {
+        BuildCycles += Resident.Value->BuildCycles;
+    }
+    UE_LOG(LogQuadTree, Log, TEXT("  per patch: %d bytes as slots, %d bytes instanced (height atlas %.1f KB); %s, %.3f ms average chunk build over %d resident chunks"),
+        int32(SlotBytes), int32(InstancedBytes), PatchInstances->GetAtlasBytes() / 1024.0,
+        bDrawInstancedPatches ? TEXT("instanced patches") : TEXT("slots"),
+        ResidentChunks.Num() > 0 ? FPlatformTime::ToMilliseconds64(BuildCycles) / ResidentChunks.Num() : 0.0, ResidentChunks.Num());
+}
+
+static FAutoConsoleCommandWithWorld VertexFormatReportCommand(
+    TEXT("QuadTree.VertexFormatReport"),
+    TEXT("Logs bytes per terrain vertex and patch in each format and render mode, the last mesh rebuild and the average chunk build time."),
+    FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+    {
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->LogVertexFormatReport();
+            }
+        }
+    }));
+
+void UQuadTreeComponent::LogPatchLayoutReport() const
+{
+    const int32 Resolution = FMath::Max(PatchResolution, 1);
+    const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Resolution);
+
+    // Typical post-transform cache sizes, the optimizer itself assumes 32
+    const int32 CacheSizes[] = {16, 32};
+    for (int32 CacheSize : CacheSizes)
+    {
+        double RowMajorACMR = 0.0;
+        double OptimizedACMR = 0.0;
+        TArray<int32> RowMajor;
+        for (int32 Stitch = 0; Stitch < int32(UE_ARRAY_COUNT(Layout.Indices)); ++Stitch)
+        {
+            BuildTerrainRowMajorPatchIndices(Resolution, ETerrainStitch(Stitch), RowMajor);
+            RowMajorACMR += ComputeTerrainIndexACMR(RowMajor, CacheSize);
+            OptimizedACMR += ComputeTerrainIndexACMR(Layout.Indices[Stitch], CacheSize);
+        }
+
+        BuildTerrainRowMajorPatchIndices(Resolution, ETerrainStitch::None, RowMajor);
+        UE_LOG(LogQuadTree, Log, TEXT("%s: patch %d, cache %d: ACMR %.3f row-major, %.3f optimized (%.3f / %.3f averaged over stitch masks)"),
+            *GetOwner()->GetName(), Resolution, CacheSize,
+            ComputeTerrainIndexACMR(RowMajor, CacheSize), ComputeTerrainIndexACMR(Layout.Indices[uint8(ETerrainStitch::None)], CacheSize),
+            RowMajorACMR / UE_ARRAY_COUNT(Layout.Indices), OptimizedACMR / UE_ARRAY_COUNT(Layout.Indices));
+    }
+}
+
+static FAutoConsoleCommandWithWorld PatchLayoutReportCommand(
+    TEXT("QuadTree.PatchLayoutReport"),
+    TEXT("Logs post-transform cache misses per triangle of the terrain patch index buffers, row-major against optimized."),
+    FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+    {
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->LogPatchLayoutReport();
+            }
+        }
+    }));
+
+void UQuadTreeComponent::LogDiskCacheReport() const
+{
+    if (!DiskCache)
+    {
+        UE_LOG(LogQuadTree, Log, TEXT("%s: disk cache disabled"), *GetOwner()->GetName());
+        return;
+    }
+
+    const int32 Hits = DiskCache->GetNumHits();
+    const int32 Misses = DiskCache->GetNumMisses();
+    UE_LOG(LogQuadTree, Log, TEXT("%s: disk cache %016llx, %d tiles, %.1f MB mapped, %.1f MB pending, %d hits, %d misses (%.1f%%)"),
+        *GetOwner()->GetName(), DiskCache->GetConfigHash(), DiskCache->GetNumEntries(), DiskCache->GetMappedBytes() / (1024.0 * 1024.0),
+        DiskCache->GetPendingBytes() / (1024.0 * 1024.0), Hits, Misses, Hits + Misses > 0 ? 100.0 * Hits / (Hits + Misses) : 0.0);
+}
+
+static FAutoConsoleCommandWithWorld DiskCacheReportCommand(
+    TEXT("QuadTree.DiskCacheReport"),
+    TEXT("Logs the tiles held by the terrain disk cache and how often sampling was served from it."),
+    FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+    {
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->LogDiskCacheReport();
+            }
+        }
+    }));
+
+void UQuadTreeComponent::LogBakedTerrainReport() const
+{
+    if (!BakedData)
+    {
+        UE_LOG(LogQuadTree, Log, TEXT("%s: no baked terrain"), *GetOwner()->GetName());
+        return;
+    }
+
+    const FTerrainBakeHeader& Header = BakedData->GetHeader();
+    const FBox2D Area = BakedData->GetArea();
+    const int32 Decodes = BakedData->GetNumDecodes();
+    const double DecodeSeconds = BakedData->GetDecodeSeconds();
+    UE_LOG(LogQuadTree, Log, TEXT("%s: %s, %d x %d tiles of %d samples over (%.0f, %.0f) - (%.0f, %.0f), %.1f MB mapped, %.1f MB decoded"),
+        *GetOwner()->GetName(), *BakedData->GetPath(), Header.NumTilesX, Header.NumTilesY, Header.TileSamples, Area.Min.X, Area.Min.Y,
+        Area.Max.X, Area.Max.Y, BakedData->GetFileBytes() / (1024.0 * 1024.0), BakedData->GetDecodedBytes() / (1024.0 * 1024.0));
+    UE_LOG(LogQuadTree, Log, TEXT("%s: %d chunks sampled from the bake, %d tiles decoded in %.1f ms (%.1f tiles/s)"),
+        *GetOwner()->GetName(), BakedData->GetNumChunks(), Decodes, DecodeSeconds * 1000.0, DecodeSeconds > 0.0 ? Decodes / DecodeSeconds : 0.0);
+}
+
+static FAutoConsoleCommandWithWorld BakedTerrainReportCommand(
+    TEXT("QuadTree.BakedTerrainReport"),
+    TEXT("Logs the baked terrain each component samples, the chunks it served and its tile decode throughput."),
+    FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+    {
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->LogBakedTerrainReport();
+            }
+        }
+    }));
+
+static FAutoConsoleCommandWithWorld CollisionReportCommand(
+    TEXT("QuadTree.CollisionReport"),
+    TEXT("Logs the terrain chunks, memory and build CPU held for each player and registered collision actor."),
+    FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+    {
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->LogCollisionReport();
+            }
+        }
+    }));
+
+static FAutoConsoleCommandWithWorldAndArgs SpatialQueryBenchmarkCommand(
+    TEXT("QuadTree.SpatialQueryBenchmark"),
+    TEXT("Times sphere queries against the quadtree snapshot from worker threads. Usage: QuadTree.SpatialQueryBenchmark [NumQueries] [Radius]"),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+    {
+        const int32 NumQueries = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10000;
+        const float Radius = Args.Num() > 1 ? FCString::Atof(*Args[1]) : 2000.0f;
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->RunSpatialQueryBenchmark(NumQueries, Radius);
+            }
+        }
+    }));
+
+static FAutoConsoleCommandWithWorldAndArgs NeighbourBenchmarkCommand(
+    TEXT("QuadTree.NeighbourBenchmark"),
+    TEXT("Times leaf neighbour lookups through the linear quadtree against descending from the root. Usage: QuadTree.NeighbourBenchmark [NumQueries]"),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+    {
+        const int32 NumQueries = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1000000;
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->RunNeighbourBenchmark(NumQueries);
+            }
+        }
+    }));
+
+static FAutoConsoleCommandWithWorldAndArgs HeightCodecBenchmarkCommand(
+    TEXT("QuadTree.HeightCodecBenchmark"),
+    TEXT("Times the height codec against zlib and Oodle on sampled height tiles, on one core. Usage: QuadTree.HeightCodecBenchmark [NumTiles] [MaxError]"),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+    {
+        const int32 NumTiles = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 64;
+        const float MaxError = Args.Num() > 1 ? FCString::Atof(*Args[1]) : 0.5f;
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->RunHeightCodecBenchmark(NumTiles, MaxError);
+            }
+        }
+    }));
+
+static FAutoConsoleCommandWithWorldAndArgs CollisionTraceBenchmarkCommand(
+    TEXT("QuadTree.CollisionTraceBenchmark"),
+    TEXT("Times random downward line traces against the terrain collision. Usage: QuadTree.CollisionTraceBenchmark [NumTraces]"),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+    {
+        const int32 NumTraces = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10000;
+        for (TObjectIterator<UQuadTreeComponent> It; It; ++It)
+        {
+            if (It->GetWorld() == World)
+            {
+                It->RunCollisionTraceBenchmark(NumTraces);
+            }
+        }
+    }));
+
+void UQuadTreeComponent::RegisterCollisionActor(AActor* Actor)
+{
+    if (Actor)
+    {
+        CollisionActors.AddUnique(Actor);
+    }
+}
+
+void UQuadTreeComponent::UnregisterCollisionActor(AActor* Actor)
+{
+    CollisionActors.Remove(Actor);
+}
+
+void UQuadTreeComponent::RegisterObserver(AActor* Actor, float Weight)
+{
+    if (!Actor)
+    {
+        return;
+    }
+
+    UnregisterObserver(Actor);
+    ObserverActors.Emplace(Actor, FMath::Max(Weight, UE_SMALL_NUMBER));
+}
+
+void UQuadTreeComponent::UnregisterObserver(AActor* Actor)
+{
+    ObserverActors.RemoveAll([Actor](const TPair<TWeakObjectPtr<AActor>, float>& ObserverActor) { return ObserverActor.Key == Actor; });
+}
+
+void UQuadTreeComponent::CheckNearChunksVisible()
+{
+    if (!bAwaitingNearChunks)
+    {
+        return;
+    }
+
+    const FVector2D Camera2D(LastLocalCamera);
+    for (const FTerrainChunkDesc& Leaf : Leaves)
+    {
+        const FBox2D Footprint(Leaf.Position, Leaf.Position + FVector2D(Leaf.Size, Leaf.Size));
+        if (Footprint.ComputeSquaredDistanceToPoint(Camera2D) < FMath::Square(NearChunkRadius) && !VisibleChunks.Contains(Leaf.Key))
+        {
+            return;
+        }
+    }
+
+    bAwaitingNearChunks = false;
+    const float ElapsedMs = float((FPlatformTime::Seconds() - TeleportStartTime) * 1000.0);
+    SET_FLOAT_STAT(STAT_QuadTree_TeleportNearReady, ElapsedMs);
+    UE_LOG(LogQuadTree, Log, TEXT("Chunks within %.0f of the camera on screen %.1f ms after teleport"), NearChunkRadius, ElapsedMs);
+}
+
+void UQuadTreeComponent::CollectLeaves(const FQuadTreeNode& Node, TArray<FTerrainChunkDesc>& OutLeaves) const
+{
+    // Hidden nodes are leaves already, SubdivideNode keeps them coarse, and they still need their chunk
     if (Node.Children.Num() == 0)
     {
-        int32 VertexIndex;
-        FVector BottomLeft = FVector(Node.Position, 0.0f);
-        FVector BottomRight = FVector(Node.Position + FVector2D(Node.Size, 0.0f), 0.0f);
-        FVector TopLeft = FVector(Node.Position + FVector2D(0.0f, Node.Size), 0.0f);
-        FVector TopRight = FVector(Node.Position + FVector2D(Node.Size, Node.Size), 0.0f);
+        OutLeaves.Add({Node.GetKey(), Node.Position, Node.Size});
+    }
+
+    for (const FQuadTreeNode& Child : Node.Children)
+    {
+        CollectLeaves(Child, OutLeaves);
+    }
+}
+
+void UQuadTreeComponent::CollectPredictedLeaves(const FTerrainChunkDesc& Node, const FVector& CameraLocation, float SubdivisionThreshold, TArray<FTerrainChunkDesc>& OutLeaves) const
+{
+    const FVector ActorLocation = GetOwner()->GetActorLocation();
+    const FVector2D NodeCenter = FVector2D(ActorLocation.X, ActorLocation.Y) + Node.Position + FVector2D(Node.Size / 2.0f, Node.Size / 2.0f);
+
+    // Same split rule as SubdivideNode, evaluated without touching the live tree
+    if (Node.Key.Depth < ComputeDesiredDepth(NodeCenter, CameraLocation, SubdivisionThreshold) && Node.Size > 50.0f)
+    {
+        const double HalfSize = Node.Size / 2.0;
+        for (int32 Child = 0; Child < 4; ++Child)
+        {
+            const FIntPoint Offset(Child & 1, Child >> 1);
+            const FTerrainChunkDesc ChildDesc {FTerrainChunkKey(Node.Key.Depth + 1, Node.Key.Coord * 2 + Offset), Node.Position + FVector2D(Offset) * HalfSize, HalfSize};
+            CollectPredictedLeaves(ChildDesc, CameraLocation, SubdivisionThreshold, OutLeaves);
+        }
+    }
+    else
+    {
+        OutLeaves.Add(Node);
+    }
+}
 
-        BottomLeft.Z = NoiseFunc->GetNoise(BottomLeft.X, BottomLeft.Y) * Height; 
-        BottomRight.Z = NoiseFunc->GetNoise(BottomRight.X, BottomRight.Y) * Height;
-        TopLeft.Z = NoiseFunc->GetNoise(TopLeft.X, TopLeft.Y) * Height;
-        TopRight.Z = NoiseFunc->GetNoise(TopRight.X, TopRight.Y) * Height;
-        
-        AddVertex(BottomLeft, OutVertices, VertexMap, VertexIndex);
-        int32 BottomLeftIndex = VertexIndex;
+void UQuadTreeComponent::RefinePredictedLeaves(const FVector& Eye, TArray<FTerrainChunkDesc>& InOutLeaves) const
+{
+    // Same refusals as BalanceTree, so the leaves it splits are prefetched as well
+    FTerrainLinearQuadTree Tree;
+    for (const FTerrainChunkDesc& Leaf : InOutLeaves)
+    {
+        Tree.Add(FTerrainNodeCode(Leaf.Key));
+    }
+    Tree.Balance([this](const FTerrainNodeCode& Code)
+    {
+        return Code.Level < MaxDepth && TileExtent / double(1ll << Code.Level) > 50.0;
+    });
 
-        AddVertex(BottomRight, OutVertices, VertexMap, VertexIndex);
-        int32 BottomRightIndex = VertexIndex;
+    // Keys are lattice cells, the place of a node follows from its key alone
+    InOutLeaves.Reset();
+    for (const FTerrainNodeCode& Code : Tree.GetLeaves())
+    {
+        const FTerrainChunkKey Key = Code.ToKey();
+        const double Size = TileExtent / double(1ll << Key.Depth);
+        InOutLeaves.Add({Key, TileOrigin + FVector2D(Key.Coord) * Size, Size});
+    }
 
-        AddVertex(TopLeft, OutVertices, VertexMap, VertexIndex);
-        int32 TopLeftIndex = VertexIndex;
+    const FVector2D Eye2D(Eye.X, Eye.Y);
+    InOutLeaves.Sort([&Eye2D](const FTerrainChunkDesc& A, const FTerrainChunkDesc& B)
+    {
+        return FVector2D::DistSquared(A.Position + A.Size / 2.0f, Eye2D) < FVector2D::DistSquared(B.Position + B.Size / 2.0f, Eye2D);
+    });
+    if (!bEnableHorizonOcclusion)
+    {
+        return;
+    }
 
-        AddVertex(TopRight, OutVertices, VertexMap, VertexIndex);
-        int32 TopRightIndex = VertexIndex;
-        
-        OutIndices.Add(BottomLeftIndex);
-        OutIndices.Add(TopLeftIndex);
-        OutIndices.Add(BottomRightIndex);
+    // Nearest first, as UpdateOcclusionFrom walks the live tree, with the same margin. Bounds come from the
+    // live node or its deepest live ancestor, which is looser but still holds, so no noise is sampled here.
+    const float Margin = OcclusionHeightMargin * Height;
+    FHorizonBuffer Horizon;
+    Horizon.Reset(Eye, HorizonResolution);
+    int32 NumVisible = 0;
+    for (const FTerrainChunkDesc& Leaf : InOutLeaves)
+    {
+        const FQuadTreeNode* Node = FindCoveringNode(Leaf.Key);
+        if (!Node)
+        {
+            // Tile not loaded yet, nothing known to cull it with
+            InOutLeaves[NumVisible++] = Leaf;
+            continue;
+        }
+        const FBox2D Footprint(Leaf.Position, Leaf.Position + FVector2D(Leaf.Size, Leaf.Size));
+        if (!Horizon.IsOccluded(Footprint, Node->MaxHeight + Margin))
+        {
+            Horizon.AddOccluder(Footprint, Node->MinHeight - Margin);
+            InOutLeaves[NumVisible++] = Leaf;
+        }
+    }
+    InOutLeaves.SetNum(NumVisible, false);
+}
 
-        OutIndices.Add(TopLeftIndex);
-        OutIndices.Add(TopRightIndex);
-        OutIndices.Add(BottomRightIndex);
+void UQuadTreeComponent::PrefetchAlongPath(const FVector& CameraLocation, const FVector& CameraVelocity, float SubdivisionThreshold)
+{
+    if (PauseSubdivision || !bEnablePrefetch || !Scheduler.IsValid())
+    {
+        return;
     }
 
-    for (FQuadTreeNode& Child : Node.Children)
+    // Too slow for the prediction to reach anything the LOD pass would not already have built
+    const FVector PredictedLocation = CameraLocation + CameraVelocity * PrefetchLookahead;
+    if (FVector::Dist2D(CameraLocation, PredictedLocation) < PrefetchRestartDistance)
     {
-        GenerateMeshRecursive(Child, OutVertices, OutIndices, VertexMap);
+        return;
     }
+
+    // Still heading the same way, let the queued pass finish
+    if (bHasPrediction && FVector::Dist2D(LastPredictedLocation, PredictedLocation) < PrefetchRestartDistance)
+    {
+        return;
+    }
+    Scheduler->CancelSpeculative();
+    Scheduler->SetMaxSpeculativeJobs(MaxSpeculativeChunks);
+    LastPredictedLocation = PredictedLocation;
+    bHasPrediction = true;
+
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_Prefetch);
+
+    TSet<FTerrainChunkKey> Visited;
+    TArray<FTerrainChunkDesc> Candidates;
+
+    // Earlier points along the path come first, so the cap drops the least likely chunks
+    for (int32 Step = 1; Step <= PrefetchSteps && Candidates.Num() < MaxSpeculativeChunks; ++Step)
+    {
+        const FVector StepLocation = FMath::Lerp(CameraLocation, PredictedLocation, float(Step) / PrefetchSteps);
+        const FVector2D StepLocation2D = FVector2D(StepLocation - GetOwner()->GetActorLocation());
+
+        // Only tiles the step can refine, the predicted path may run into tiles that are not loaded yet
+        const FVector2D Reach(SubdivisionThreshold * 5.0f, SubdivisionThreshold * 5.0f);
+        FIntPoint MinTile = GetTileAt(StepLocation2D - Reach);
+        FIntPoint MaxTile = GetTileAt(StepLocation2D + Reach);
+        if (!bInfiniteWorld)
+        {
+            MinTile = MinTile.ComponentMax(FIntPoint::ZeroValue);
+            MaxTile = MaxTile.ComponentMin(FIntPoint::ZeroValue);
+        }
+
+        TArray<FTerrainChunkDesc> StepLeaves;
+        for (int32 TileY = MinTile.Y; TileY <= MaxTile.Y; ++TileY)
+        {
+            for (int32 TileX = MinTile.X; TileX <= MaxTile.X; ++TileX)
+            {
+                CollectPredictedLeaves(GetTileDesc(FIntPoint(TileX, TileY)), StepLocation, SubdivisionThreshold, StepLeaves);
+            }
+        }
+        RefinePredictedLeaves(StepLocation - GetOwner()->GetActorLocation(), StepLeaves);
+
+        for (const FTerrainChunkDesc& Leaf : StepLeaves)
+        {
+            bool bAlreadyVisited = false;
+            Visited.Add(Leaf.Key, &bAlreadyVisited);
+            if (!bAlreadyVisited && !ResidentChunks.Contains(Leaf.Key) && !ChunkCache.Contains(GetCacheKey(Leaf.Key)) && !Scheduler->IsQueued(Leaf.Key))
+            {
+                Candidates.Add(Leaf);
+                if (Candidates.Num() >= MaxSpeculativeChunks)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    for (const FTerrainChunkDesc& Candidate : Candidates)
+    {
+        Scheduler->Enqueue(Candidate, true);
+    }
+
+    UE_LOG(LogQuadTree, Verbose, TEXT("Prefetching %d chunks along the camera path, hit rate so far %.1f%% (%d hits, %d misses, %d evicted unused)"),
+        Candidates.Num(), GetPrefetchHitRate() * 100.0f, PrefetchHits, PrefetchMisses, ChunkCache.GetNumEvicted());
 }
 
+float UQuadTreeComponent::GetPrefetchHitRate() const
+{
+    const int32 Lookups = PrefetchHits + PrefetchMisses;
+    return Lookups > 0 ? float(PrefetchHits) / Lookups : 0.0f;
+}
 
+void UQuadTreeComponent::UpdatePrefetchStats() const
+{
+    SET_DWORD_STAT(STAT_QuadTree_PrefetchHits, PrefetchHits);
+    SET_DWORD_STAT(STAT_QuadTree_PrefetchMisses, PrefetchMisses);
+    SET_DWORD_STAT(STAT_QuadTree_CacheEvictions, ChunkCache.GetNumEvicted());
+    SET_DWORD_STAT(STAT_QuadTree_CachedChunks, ChunkCache.Num());
+    SET_MEMORY_STAT(STAT_QuadTree_CacheMemory, ChunkCache.GetAllocatedBytes());
+    SET_FLOAT_STAT(STAT_QuadTree_PrefetchHitRate, GetPrefetchHitRate() * 100.0f);
+}
@@ -4,6 +4,9 @@
 #include "Components/ActorComponent.h"
 #include "ProceduralMeshComponent.h"
 #include "FastNoiseLite.h"
+#include "TerrainChunk.h"
+#include "TerrainHeightField.h"
+#include "TerrainQuadTreeSnapshot.h"
 
 #include "QuadTree.generated.h"
 
@@ -12,32 +15,35 @@ struct FQuadTreeNode
 {
     GENERATED_BODY()
 
+    // Double precision so node edges stay exact far from the origin
     FVector2D Position;
-    float Size;
-    float InitialSize;
+    double Size;
+    double InitialSize;
     int32 Depth;
+    FIntPoint Coord;
     TArray<FQuadTreeNode> Children;
     bool bNeedsUpdate;
+    float MinHeight;
+    float MaxHeight;
+    bool bOccluded;
     
     FQuadTreeNode()
-        : Position(FVector2D(0.0f, 0.0f)), Size(0.0f), InitialSize(0.0f), Depth(0), bNeedsUpdate(true)
+        : Position(FVector2D(0.0f, 0.0f)), Size(0.0f), InitialSize(0.0f), Depth(0), Coord(FIntPoint::ZeroValue), bNeedsUpdate(true), MinHeight(0.0f), MaxHeight(0.0f), bOccluded(false)
     {
     }
 
-    FQuadTreeNode(FVector2D InPosition, float InSize, float InInitialSize)
-        : Position(InPosition), Size(InSize), InitialSize(InInitialSize), Depth(0), bNeedsUpdate(true)
+    FQuadTreeNode(FVector2D InPosition, double InSize, double InInitialSize)
+        : Position(InPosition), Size(InSize), InitialSize(InInitialSize), Depth(0), Coord(FIntPoint::ZeroValue), bNeedsUpdate(true), MinHeight(0.0f), MaxHeight(0.0f), bOccluded(false)
     {
     }
 
+    FTerrainChunkKey GetKey() const { return FTerrainChunkKey(Depth, Coord); }
+    FBox2D GetFootprint() const { return FBox2D(Position, Position + FVector2D(Size, Size)); }
+
     void Subdivide();
-};
 
-USTRUCT()
-struct FGeometryData
-{
-    GENERATED_BODY()
-    TArray<FVector> Vertices;
-    TArray<int32> Triangles;
+    // Narrows the height range to what the children cover, both being conservative
+    void MergeChildBounds();
 };
 
 UENUM(BlueprintType)
@@ -51,6 +57,16 @@ enum class NoiseType : uint8
     OpenSimplex2S = 5
 };
 
+UENUM(BlueprintType)
+enum class ETerrainRenderMode : uint8
+{
+    // Every chunk has its own vertices in a slot of the terrain mesh
+    Slots = 0,
+
+    // One shared patch drawn per chunk, displaced by the material from a height atlas
+    InstancedPatches = 1
+};
+
 UENUM(BlueprintType)
 enum class NoiseFractalTypes : uint8
 {
@@ -105,30 +121,388 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="QuadTreeComponent")
     int MaxDepth {8};
 
+    // Splits coarse leaves next to much finer ones after each LOD pass, so neighbouring leaves are at
+    // most one level apart, which is all the edge stitching can close
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="QuadTreeComponent")
+    bool bBalanceTree {true};
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="QuadTreeComponent")
     UMaterialInstance *Material;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="QuadTreeComponent")
     bool PauseSubdivision {false};
     
-    UPROPERTY(VisibleAnywhere)
-    class UProceduralMeshComponent* ProceduralMesh;
+    // Terrain hidden behind nearer terrain from every observer stops subdividing. It is still drawn at the
+    // depth it had when it went out of sight.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Occlusion")
+    bool bEnableHorizonOcclusion {true};
+
+    // Number of azimuth bins in the horizon buffer
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Occlusion", meta=(ClampMin="8"))
+    int HorizonResolution {1024};
+
+    // Extra padding on node height bounds, as a fraction of Height. The bounds already hold the surface.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Occlusion", meta=(ClampMin="0.0"))
+    float OcclusionHeightMargin {0.05f};
+    
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Prefetch")
+    bool bEnablePrefetch {true};
+
+    // Seconds of predicted camera travel that are generated ahead of the LOD pass
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Prefetch", meta=(ClampMin="0.0"))
+    float PrefetchLookahead {2.0f};
+
+    // Points sampled along the predicted path
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Prefetch", meta=(ClampMin="1"))
+    int PrefetchSteps {4};
+
+    // Predicted location has to drift this far before a running pass is cancelled and restarted
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Prefetch", meta=(ClampMin="0.0"))
+    float PrefetchRestartDistance {2000.0f};
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Prefetch", meta=(ClampMin="0"))
+    int MaxSpeculativeChunks {256};
+
+    // Concurrent chunk builds, shared by demanded and speculative work
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1"))
+    int GenerationWorkers {4};
+
+    // Camera jumps longer than this start the teleport timer
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="0.0"))
+    float TeleportDistance {20000.0f};
+
+    // Radius around the camera whose chunks are timed after a teleport
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="0.0"))
+    float NearChunkRadius {5000.0f};
+
+    // Memory for chunks that left the tree or were prefetched, least recently used ones go first
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="0"))
+    int ChunkCacheBudgetMB {256};
+
+    // Keeps sampled heights in memory mapped files under Saved/TerrainCache, so later sessions map them
+    // instead of evaluating the noise again. Every noise setting and height gets a cache of its own.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation")
+    bool bEnableDiskCache {true};
+
+    // Disk taken by the caches of this terrain, the least recently used settings are deleted past it
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="0"))
+    int DiskCacheMaxMB {2048};
+
+    // Heights waiting for the disk cache are written out as one file once they add up to this much
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1"))
+    int DiskCacheFlushMB {8};
+
+    // Terrain baked by the TerrainBake commandlet. Chunks, node bounds, height queries and raycasts inside
+    // the baked area come from it instead of the noise. A bake of other noise settings or height is ignored.
+    UPROPERTY(EditAnywhere, Category="Generation", meta=(FilePathFilter="Terrain bake (*.terrainbake)|*.terrainbake", RelativeToGameDir))
+    FFilePath BakedTerrainFile;
+
+    // Decompressed baked tiles kept for sampling, least recently used ones go first
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1"))
+    int BakedTileCacheMB {64};
+
+    // Height samples per chunk edge
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1"))
+    int PatchResolution {4};
+
+    // World units per texture repeat of the terrain UVs
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1.0"))
+    float UVScale {1000.0f};
+
+    // Chunks allowed to wait between two worker stages before sampling backs off
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1"))
+    int StageQueueCapacity {16};
+
+    // Finished chunks allowed to wait for the game thread
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Generation", meta=(ClampMin="1"))
+    int UploadQueueCapacity {256};
+
+    // Seconds between collision rebuilds, the render mesh is updated every frame regardless
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Collision", meta=(ClampMin="0.0"))
+    float CollisionUpdateInterval {1.0f};
+
+    // Collision only exists within this distance of a player pawn or a registered actor
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Collision", meta=(ClampMin="0.0"))
+    float CollisionRadius {10000.0f};
+
+    // Tree depth of the collision chunks, independent of the visual LOD
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Collision", meta=(ClampMin="0", ClampMax="16"))
+    int CollisionDepth {6};
+
+    // Build collision as Chaos heightfields straight from the height samples instead of cooking a trimesh
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Collision")
+    bool bUseHeightfieldCollision {true};
+
+    // Stream a grid of root tiles around the observers instead of one fixed root
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming")
+    bool bInfiniteWorld {false};
+
+    // Edge length of one root tile in infinite mode
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming", meta=(ClampMin="1000.0"))
+    float TileSize {100000.0f};
+
+    // Tiles within this distance of any observer are loaded
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming", meta=(ClampMin="0.0"))
+    float TileStreamingRadius {250000.0f};
+
+    // Extra distance before a loaded tile is dropped, so observers on a border do not thrash it
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming", meta=(ClampMin="0.0"))
+    float TileUnloadMargin {50000.0f};
+
+    // Size of the tile root pool, the hard cap on loaded tiles
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming", meta=(ClampMin="1"))
+    int MaxLoadedTiles {64};
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming", meta=(ClampMin="1"))
+    int MaxTileLoadsPerUpdate {2};
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Streaming", meta=(ClampMin="1"))
+    int MaxTileUnloadsPerUpdate {4};
+
+    // The render mesh is placed at a grid point near the camera and its vertices are relative to it,
+    // so the 32-bit vertex buffer stays precise where it is looked at. Smaller grids rebase more often.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Precision", meta=(ClampMin="1000.0"))
+    float RenderOriginGrid {50000.0f};
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Rendering")
+    ETerrainRenderMode RenderMode {ETerrainRenderMode::Slots};
+
+    // Slot mode draws the chunks of one quadtree node together while they add up to at most this many
+    // vertices. Larger batches mean fewer draw calls but more indices rebuilt when one of their chunks changes.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Rendering", meta=(ClampMin="1"))
+    int RenderBatchVertices {65536};
+
+    // Displaces the shared patch from the height atlas, see UTerrainPatchInstancesComponent. Instanced
+    // patches need it, without one the terrain is drawn as slots.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Rendering")
+    UMaterialInterface* InstancedMaterial {nullptr};
+
+    // Behave like a dedicated server: no visual LOD or render mesh, only collision around players.
+    // Dedicated servers are always headless.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Server")
+    bool bForceHeadless {false};
+    
+    // Created on the owner only where they are used: none of the render components when headless,
+    // the collision mesh only for trimesh collision
+    UPROPERTY(VisibleAnywhere, Transient)
+    class UTerrainMeshComponent* TerrainMesh;
+
+    UPROPERTY(VisibleAnywhere, Transient)
+    class UTerrainPatchInstancesComponent* PatchInstances;
+
+    UPROPERTY(VisibleAnywhere, Transient)
+    class UProceduralMeshComponent* CollisionMesh;
     
     void InitializeQuadTree(const FVector2D& Origin, float InitialSize);
     void UpdateQuadTree(const FVector& CameraLocation, float SubdivisionThreshold);
+
+    // Refines around every observer in one traversal, each node takes the deepest level any of them asks for.
+    // Registered observer actors are added to the set. The first observer drives teleport detection.
+    void UpdateQuadTree(TConstArrayView<FTerrainObserver> InObservers, float SubdivisionThreshold);
+    void PrefetchAlongPath(const FVector& CameraLocation, const FVector& CameraVelocity, float SubdivisionThreshold);
+    void ProcessCompletedChunks();
+    float GetPrefetchHitRate() const;
+
+    // Physics actors other than player pawns that need terrain collision around them
+    UFUNCTION(BlueprintCallable, Category="Collision")
+    void RegisterCollisionActor(AActor* Actor);
+
+    UFUNCTION(BlueprintCallable, Category="Collision")
+    void UnregisterCollisionActor(AActor* Actor);
+
+    // Extra LOD observers besides the cameras, e.g. replay or cinematic capture actors
+    UFUNCTION(BlueprintCallable, Category="QuadTreeComponent")
+    void RegisterObserver(AActor* Actor, float Weight = 1.0f);
+
+    UFUNCTION(BlueprintCallable, Category="QuadTreeComponent")
+    void UnregisterObserver(AActor* Actor);
+
+    bool IsHeadless() const;
+
+    // Configures Noise from the noise properties, the seed is left alone
+    void ApplyNoiseSettings(FastNoiseLite& Noise) const;
+
+    // Logs chunks, memory and build CPU held for each collision anchor, shared chunks split evenly
+    void LogCollisionReport() const;
+
+    // Logs bytes per vertex of the packed chunk format against full vectors, and what the last mesh rebuild moved
+    void LogVertexFormatReport() const;
+
+    // Logs vertex cache misses per triangle of the shared patch indices before and after optimization
+    void LogPatchLayoutReport() const;
+
+    // Terrain queries straight from the noise, independent of chunks, meshes and collision.
+    // Safe from any thread; world space in and out.
+    float GetHeightAt(const FVector2D& Location) const;
+    FVector GetNormalAt(const FVector2D& Location) const;
+    bool Raycast(const FVector& Start, const FVector& End, FTerrainRayHit& OutHit) const;
+    void GetHeightsAt(TConstArrayView<FVector2D> Locations, TArrayView<float> OutHeights) const;
+    void GetNormalsAt(TConstArrayView<FVector2D> Locations, TArrayView<FVector> OutNormals) const;
+    void RaycastBatch(TConstArrayView<FVector> Starts, TConstArrayView<FVector> Ends, TArrayView<FTerrainRayHit> OutHits) const;
+
+    // Snapshot of the current surface, stays valid and unchanged after the terrain is rebuilt
+    FTerrainHeightFieldPtr GetHeightField() const;
+
+    // Leaves of the LOD quadtree and their bounds as of the last LOD pass. Safe from any thread;
+    // world space in and out, results are appended. Keep the snapshot to run many queries on one tree.
+    FTerrainQuadTreeSnapshotPtr GetQuadTreeSnapshot() const;
+    void GetLeavesInBox(const FBox& Box, TArray<FTerrainLeaf>& OutLeaves) const;
+    void GetLeavesInSphere(const FVector& Center, double Radius, TArray<FTerrainLeaf>& OutLeaves) const;
+    void GetLeavesAlongRay(const FVector& Start, const FVector& End, TArray<FTerrainLeaf>& OutLeaves) const;
+
+    // Runs random sphere queries around the observers from worker threads and logs their cost
+    void RunSpatialQueryBenchmark(int32 NumQueries, float Radius) const;
+
+    // Builds a chunk at the given distance from the origin and logs vertex and noise precision
+    // against an all-float path, plus the cost of double coordinates near the origin
+    void ValidatePrecision(double Distance) const;
+
+    // Fires random downward line traces around the collision anchors and logs the average cost
+    void RunCollisionTraceBenchmark(int32 NumTraces) const;
+
+    // Times edge neighbour lookups between the current leaves, through the linear quadtree and by
+    // descending the node tree from the root tile, and logs queries per second for both
+    void RunNeighbourBenchmark(int32 NumQueries) const;
+
+    // Samples random 256^2 height tiles and logs compression ratio and single core encode and decode
+    // throughput of the height codec, lossless and within MaxError, against zlib and Oodle on the floats
+    void RunHeightCodecBenchmark(int32 NumTiles, float MaxError) const;
     void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+    virtual void OnRegister() override;
+    virtual void OnComponentDestroyed(bool bDestroyingHierarchy) override;
+
+    // Logs tiles held by the disk cache, how much of it is mapped and how sampling used it
+    void LogDiskCacheReport() const;
+
+    // Logs the baked terrain in use, the chunks it served and how fast its tiles decode
+    void LogBakedTerrainReport() const;
     
 
 private:
+    struct FMeshRebuildStats
+    {
+        int32 NumVertices {0};
+        SIZE_T BytesRead {0};
+        SIZE_T BytesWritten {0};
+        double BuildMs {0.0};
+    };
+
+    struct FCollisionAnchorReport
+    {
+        FString Name;
+        int32 NumChunks {0};
+        double Bytes {0.0};
+        double BuildMs {0.0};
+    };
+
     void InitializeNodeRecursive(FQuadTreeNode& Node);
-    FQuadTreeNode RootNode;
-    void SubdivideNode(FQuadTreeNode& Node, const FVector& CameraLocation, float SubdivisionThreshold);
-    void GenerateMesh(FQuadTreeNode& Node);
-    void GenerateMeshRecursive(FQuadTreeNode& Node, TArray<FVector>& OutVertices, TArray<int32>& OutIndices, TMap<FVector, int32>& VertexMap);
-    void AddVertex(const FVector& Vertex, TArray<FVector>& OutVertices, TMap<FVector, int32>& VertexMap, int32& OutVertexIndex);
+    void StreamTiles();
+    void LoadTile(const FIntPoint& Tile);
+    void UnloadTile(const FIntPoint& Tile);
+    FIntPoint GetTileAt(const FVector2D& Location) const;
+    FTerrainChunkDesc GetTileDesc(const FIntPoint& Tile) const;
+    float GetTileDistance(const FIntPoint& Tile) const;
+    int32 ComputeDesiredDepth(const FVector2D& NodeCenter, const FVector& CameraLocation, float SubdivisionThreshold) const;
+    int32 ComputeDepthForDistance(float Distance, float SubdivisionThreshold) const;
+
+    // 0 where the chunk's own detail is wanted, 1 where the observers would already settle for its parent
+    float ComputeMorph(const FTerrainChunkDesc& Desc) const;
+    void SubdivideNode(FQuadTreeNode& Node, TConstArrayView<int32> Candidates, float SubdivisionThreshold);
+    void SplitNode(FQuadTreeNode& Node) const;
+    void BalanceTree();
+    void PublishSnapshot();
+    void CollectLeafCodes(const FQuadTreeNode& Node, class FTerrainLinearQuadTree& OutTree) const;
+    FQuadTreeNode* FindNode(const FTerrainChunkKey& Key);
+    const FQuadTreeNode* FindLeafAt(const FTerrainChunkKey& Key) const;
+    // The node itself if the live tree reaches it, else its deepest live ancestor
+    const FQuadTreeNode* FindCoveringNode(const FTerrainChunkKey& Key) const;
+    void UpdateNodeBounds(FQuadTreeNode& Node) const;
+    void UpdateOcclusion();
+    void UpdateOcclusionFrom(const FVector& Eye);
+    void RequestChunks(const FVector& CameraLocation);
+    void RebuildMesh();
+    bool CollectDisplayedChunks(const FQuadTreeNode* Node, const FTerrainChunkKey& Key, const TSet<FTerrainChunkKey>& HeldAncestors, TArray<FTerrainChunkKey>& OutKeys, TArray<FTerrainChunkPtr>& OutChunks);
+    FTerrainChunkPtr FindHeldChunk(const FTerrainChunkKey& Key);
+    bool TakeCachedChunk(const FTerrainChunkKey& Key, bool* bOutPrefetched = nullptr);
+    void ReleaseChunks(const TSet<FTerrainChunkKey>& Displayed);
+    FTerrainChunkCacheKey GetCacheKey(const FTerrainChunkKey& Key) const { return {Key, ConfigHash}; }
+    uint32 ComputeConfigHash() const;
+
+    // Everything the sampled heights depend on, stable across sessions
+    uint64 ComputeDiskCacheHash() const;
+    void UpdateDiskCache();
+    void UpdateBakedData();
+    void UpdateCollision();
+    void GatherCollisionAnchors(TArray<FVector2D>& OutAnchors, TArray<const AActor*>* OutActors = nullptr) const;
+    void UpdateAnchorReports(const TArray<TArray<FTerrainChunkKey>>& AnchorKeys, const TArray<const AActor*>& AnchorActors, double UpdateMs);
+    // Creates or destroys the render and collision mesh components to match headless and collision settings
+    void UpdateOwnedComponents();
+    void RebuildCollisionMesh();
+    void RebuildHeightfieldCollision();
+    void RebuildTrimeshCollision();
+    void DestroyHeightfieldCollision();
+    void CheckNearChunksVisible();
+    void CollectLeaves(const FQuadTreeNode& Node, TArray<FTerrainChunkDesc>& OutLeaves) const;
+    void CollectPredictedLeaves(const FTerrainChunkDesc& Node, const FVector& CameraLocation, float SubdivisionThreshold, TArray<FTerrainChunkDesc>& OutLeaves) const;
+
+    // What BalanceTree and the horizon test would do to predicted leaves seen from Eye, in local space.
+    // Leaves are sorted nearest first on return, hidden ones are dropped.
+    void RefinePredictedLeaves(const FVector& Eye, TArray<FTerrainChunkDesc>& InOutLeaves) const;
+    void UpdatePrefetchStats() const;
     
     FastNoiseLite* NoiseFunc;
     float DefaultSize;
 
+    // Root tiles live in a fixed pool, an unloaded slot is reset and reused by the next tile.
+    // Finite worlds are a single tile at (0, 0).
+    TArray<FQuadTreeNode> TilePool;
+    TArray<int32> FreeTiles;
+    TMap<FIntPoint, int32> LoadedTiles;
+    FVector2D TileOrigin {FVector2D::ZeroVector};
+    double TileExtent {0.0};
+    bool bTileStreamingPending {false};
+
+    TSharedPtr<class FTerrainChunkScheduler, ESPMode::ThreadSafe> Scheduler;
+    TArray<FTerrainChunkDesc> Leaves;
+    TSet<FTerrainChunkKey> WantedChunks;
+    TMap<FTerrainChunkKey, FTerrainChunkPtr> ResidentChunks;
+    TSet<FTerrainChunkKey> VisibleChunks;
+    bool bMeshDirty {false};
+    FMeshRebuildStats LastMeshRebuild;
+
+    TArray<TWeakObjectPtr<AActor>> CollisionActors;
+    TSet<FTerrainChunkKey> CollisionWanted;
+    TMap<FTerrainChunkKey, FTerrainChunkPtr> CollisionChunks;
+    bool bCollisionDirty {false};
+    double LastCollisionUpdateTime {0.0};
+    TMap<FTerrainChunkKey, TWeakObjectPtr<class UTerrainHeightfieldCollisionComponent>> HeightfieldComponents;
+    TArray<FCollisionAnchorReport> AnchorReports;
+
+    FTerrainChunkCache ChunkCache;
+    TSharedPtr<class FTerrainDiskCache, ESPMode::ThreadSafe> DiskCache;
+    TSharedPtr<class FTerrainBakedData, ESPMode::ThreadSafe> BakedData;
+    mutable FCriticalSection HeightFieldMutex;
+    FTerrainHeightFieldPtr HeightField;
+    mutable FCriticalSection SnapshotMutex;
+    FTerrainQuadTreeSnapshotPtr Snapshot;
+    uint32 ConfigHash {0};
+    FVector LastPredictedLocation {FVector::ZeroVector};
+    bool bHasPrediction {false};
+
+    // RenderMode as drawn, instanced patches only with a material that reads the height atlas
+    bool bDrawInstancedPatches {false};
+    int32 PrefetchHits {0};
+    int32 PrefetchMisses {0};
+
+    FVector LastLocalCamera {FVector::ZeroVector};
+    float LastSubdivisionThreshold {0.0f};
+
+    // Observers of the last LOD update, in terrain space
+    TArray<FTerrainObserver> Observers;
+    TArray<TPair<TWeakObjectPtr<AActor>, float>> ObserverActors;
+    int32 NumObserverTests {0};
+    double TeleportStartTime {0.0};
+    bool bAwaitingNearChunks {false};
+
     mutable FWindowsRWLock DataGuard;
 };
\ No newline at end of file
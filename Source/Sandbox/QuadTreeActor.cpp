@@ -1,8 +1,10 @@
 ﻿#include "QuadTreeActor.h"
 
+#include "GameFramework/PlayerController.h"
+#if WITH_EDITOR
 #include "Editor.h"
-#include "Kismet/GameplayStatics.h"
 #include "Subsystems/UnrealEditorSubsystem.h"
+#endif
 
 AQuadTreeActor::AQuadTreeActor()
 {
@@ -10,8 +12,12 @@ AQuadTreeActor::AQuadTreeActor()
 	PrimaryActorTick.bStartWithTickEnabled = true;
 	
 	QuadTreeComponent = CreateDefaultSubobject<UQuadTreeComponent>(TEXT("QuadTreeComponent"));
-	RootComponent = QuadTreeComponent->ProceduralMesh;
+	// Plain root so the render mesh can sit at its camera relative origin
+	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
 	SubdivisionThreshold = 10000.0f;
+	CameraVelocity = FVector::ZeroVector;
+	VelocitySmoothing = 4.0f;
+	MaxPredictedSpeed = 100000.0f;
 }
 
 void AQuadTreeActor::BeginPlay()
@@ -32,32 +38,63 @@ void AQuadTreeActor::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
-	UpdateQuadTree();
+	UpdateQuadTree(DeltaTime);
 }
 
-void AQuadTreeActor::UpdateQuadTree()
+void AQuadTreeActor::UpdateQuadTree(float DeltaTime)
 {
-	FVector CurrCameraPosition;
-	FRotator CurrCameraRotator;
+	// No camera to follow, collision around the players is all that is left
+	if (QuadTreeComponent->IsHeadless())
+	{
+		QuadTreeComponent->ProcessCompletedChunks();
+		return;
+	}
+
+	// Every local view is an observer: the editor viewport, or each split-screen player in game
+	TArray<FTerrainObserver> Observers;
 	
-	if (GEditor)
+#if WITH_EDITOR
+	if (GEditor && !GetWorld()->IsGameWorld())
 	{
-		GEditor->GetEditorSubsystem<UUnrealEditorSubsystem>()->GetLevelViewportCameraInfo(CurrCameraPosition, CurrCameraRotator);
+		FVector ViewportLocation;
+		FRotator ViewportRotation;
+		GEditor->GetEditorSubsystem<UUnrealEditorSubsystem>()->GetLevelViewportCameraInfo(ViewportLocation, ViewportRotation);
+		Observers.Add({ViewportLocation, 1.0f});
 	}
 	else
+#endif
 	{
-		APlayerController* PlayerController = UGameplayStatics::GetPlayerController(this, 0);
-		if (PlayerController)
+		for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
 		{
-			CurrCameraPosition = PlayerController->PlayerCameraManager->GetCameraLocation();
+			const APlayerController* PlayerController = It->Get();
+			if (PlayerController && PlayerController->IsLocalController() && PlayerController->PlayerCameraManager)
+			{
+				Observers.Add({PlayerController->PlayerCameraManager->GetCameraLocation(), 1.0f});
+			}
 		}
 	}
 
-	if (CameraPosition != CurrCameraPosition)
+	// The first view drives path prediction and prefetching
+	const FVector CurrCameraPosition = Observers.Num() > 0 ? Observers[0].Location : CameraPosition;
+
+	if (DeltaTime > 0.0f)
 	{
-		CameraPosition = CurrCameraPosition;
-		QuadTreeComponent->UpdateQuadTree(CameraPosition, SubdivisionThreshold);
+		const FVector InstantVelocity = (CurrCameraPosition - CameraPosition) / DeltaTime;
+		if (InstantVelocity.Size() > MaxPredictedSpeed)
+		{
+			CameraVelocity = FVector::ZeroVector;
+		}
+		else
+		{
+			CameraVelocity = FMath::Lerp(CameraVelocity, InstantVelocity, FMath::Clamp(DeltaTime * VelocitySmoothing, 0.0f, 1.0f));
+		}
 	}
+
+	CameraPosition = CurrCameraPosition;
+	// Returns early when no observer moved
+	QuadTreeComponent->UpdateQuadTree(Observers, SubdivisionThreshold);
+	QuadTreeComponent->PrefetchAlongPath(CameraPosition, CameraVelocity, SubdivisionThreshold);
+	QuadTreeComponent->ProcessCompletedChunks();
 }
 
 bool AQuadTreeActor::ShouldTickIfViewportsOnly() const
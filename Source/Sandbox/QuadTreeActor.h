@@ -21,7 +21,7 @@ protected:
 public:
 	// Tick override
 	virtual void Tick(float DeltaTime) override;
-	void UpdateQuadTree();
+	void UpdateQuadTree(float DeltaTime);
 	virtual bool ShouldTickIfViewportsOnly() const override;
 
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "QuadTree")
@@ -29,4 +29,10 @@ public:
 	
 	float SubdivisionThreshold;
 	FVector CameraPosition;
+
+	// Smoothed camera velocity used to predict where terrain is needed next
+	FVector CameraVelocity;
+	float VelocitySmoothing;
+	// Camera jumps faster than this are treated as teleports and reset the prediction
+	float MaxPredictedSpeed;
 };
\ No newline at end of file
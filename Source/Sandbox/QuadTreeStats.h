@@ -0,0 +1,8 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(LogQuadTree, Log, All);
+
+DECLARE_STATS_GROUP(TEXT("QuadTree"), STATGROUP_QuadTree, STATCAT_Advanced);
@@ -8,7 +8,7 @@ public class Sandbox : ModuleRules
 	{
 		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore", "ProceduralMeshComponent" });
 
-		PrivateDependencyModuleNames.AddRange(new string[] { });
+		PrivateDependencyModuleNames.AddRange(new string[] { "PhysicsCore", "Chaos", "RenderCore", "RHI", "MeshDescription", "StaticMeshDescription" });
 
 		if (Target.bBuildEditor)
 		{
@@ -0,0 +1,166 @@
+﻿#include "TerrainBakeCommandlet.h"
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+#include "QuadTree.h"
+#include "QuadTreeActor.h"
+#include "QuadTreeStats.h"
+#include "Tasks/Task.h"
+#include "TerrainBakedData.h"
+
+UTerrainBakeCommandlet::UTerrainBakeCommandlet()
+{
+    IsClient = false;
+    IsServer = false;
+    IsEditor = false;
+    LogToConsole = true;
+}
+
+int32 UTerrainBakeCommandlet::Main(const FString& Params)
+{
+    UClass* ActorClass = AQuadTreeActor::StaticClass();
+    FString ActorPath;
+    if (FParse::Value(*Params, TEXT("Actor="), ActorPath))
+    {
+        ActorClass = LoadClass<AActor>(nullptr, *ActorPath);
+    }
+    const AActor* DefaultActor = ActorClass ? ActorClass->GetDefaultObject<AActor>() : nullptr;
+    const UQuadTreeComponent* Component = DefaultActor ? DefaultActor->FindComponentByClass<UQuadTreeComponent>() : nullptr;
+    if (!Component)
+    {
+        UE_LOG(LogQuadTree, Error, TEXT("%s has no QuadTree component to bake"), *ActorPath);
+        return 1;
+    }
+
+    FastNoiseLite Noise;
+    Component->ApplyNoiseSettings(Noise);
+
+    // One tile of the streaming lattice by default, as fine as a chunk at MaxDepth
+    double Size = Component->TileSize;
+    FParse::Value(*Params, TEXT("Size="), Size);
+    double Spacing = Size / (double(1ll << FMath::Clamp(Component->MaxDepth, 0, 30)) * FMath::Max(Component->PatchResolution, 1));
+    FParse::Value(*Params, TEXT("Spacing="), Spacing);
+    int32 TileSamples = 256;
+    FParse::Value(*Params, TEXT("TileSamples="), TileSamples);
+    TileSamples = FMath::Clamp(int32(FMath::RoundUpToPowerOfTwo(FMath::Max(TileSamples, 2))), 2, 4096);
+    if (Size <= 0.0 || Spacing <= 0.0)
+    {
+        UE_LOG(LogQuadTree, Error, TEXT("Bake size and spacing have to be positive"));
+        return 1;
+    }
+
+    FTerrainBakeHeader Header {};
+    Header.Magic = TerrainBake::Magic;
+    Header.Version = TerrainBake::Version;
+    Header.NoiseHash = Noise.GetConfigHash();
+    FParse::Value(*Params, TEXT("OriginX="), Header.Origin.X);
+    FParse::Value(*Params, TEXT("OriginY="), Header.Origin.Y);
+    Header.TileSamples = TileSamples;
+    Header.NumMips = int32(FMath::FloorLog2(TileSamples)) + 1;
+    Header.TileWorldSize = Spacing * TileSamples;
+    Header.NumTilesX = FMath::Max(1, FMath::CeilToInt32(Size / Header.TileWorldSize));
+    Header.NumTilesY = Header.NumTilesX;
+    Header.Height = Component->Height;
+    Header.MaxHeightError = 0.5f;
+    FParse::Value(*Params, TEXT("MaxHeightError="), Header.MaxHeightError);
+    Header.MaxHeightError = FMath::Max(Header.MaxHeightError, 0.0f);
+
+    FString CompressionName = TEXT("Oodle");
+    FParse::Value(*Params, TEXT("Compression="), CompressionName);
+    Header.Compression = CompressionName == TEXT("None") ? ETerrainBakeCompression::None
+        : CompressionName == TEXT("Zlib") ? ETerrainBakeCompression::Zlib : ETerrainBakeCompression::Oodle;
+    if (Header.Compression == ETerrainBakeCompression::Oodle && !FCompression::IsFormatValid(NAME_Oodle))
+    {
+        Header.Compression = ETerrainBakeCompression::Zlib;
+    }
+
+    int32 TilesInFlight = FPlatformMisc::NumberOfCoresIncludingHyperthreads() * 2;
+    FParse::Value(*Params, TEXT("TilesInFlight="), TilesInFlight);
+    TilesInFlight = FMath::Max(TilesInFlight, 1);
+
+    FString OutputPath = FPaths::ProjectSavedDir() / TEXT("TerrainBake") / ActorClass->GetName() + TEXT(".terrainbake");
+    FParse::Value(*Params, TEXT("Output="), OutputPath);
+    OutputPath = FPaths::ConvertRelativePathToFull(OutputPath);
+
+    // Written under a temporary name first, so a bake file that exists is always complete
+    const FString TempPath = OutputPath + TEXT(".tmp");
+    TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath));
+    if (!Writer)
+    {
+        UE_LOG(LogQuadTree, Error, TEXT("Could not create %s"), *TempPath);
+        return 1;
+    }
+
+    const int32 NumTiles = Header.GetNumTiles();
+    UE_LOG(LogQuadTree, Display, TEXT("Baking %d x %d tiles of %d samples, %.1f units apart, %d mips, heights within %.2f, %s, to %s"),
+        Header.NumTilesX, Header.NumTilesY, TileSamples, Spacing, Header.NumMips, Header.MaxHeightError,
+        *TerrainBake::GetCompressionName(Header.Compression).ToString(), *OutputPath);
+
+    // The header is written again with the table offset once every tile is out
+    Writer->Serialize(&Header, sizeof(Header));
+
+    // One wave bakes on every core while the one before it is written, nothing else is held
+    TArray<FTerrainBakeTileEntry> Entries;
+    Entries.SetNumZeroed(NumTiles);
+    TArray<TArray<uint8>> Baking;
+    TArray<TArray<uint8>> Writing;
+    UE::Tasks::FTask WriteTask;
+    const uint64 StartCycles = FPlatformTime::Cycles64();
+    double LastProgressTime = FPlatformTime::Seconds();
+    for (int32 First = 0; First < NumTiles; First += TilesInFlight)
+    {
+        Baking.SetNum(FMath::Min(TilesInFlight, NumTiles - First));
+        ParallelFor(Baking.Num(), [&](int32 Index)
+        {
+            const int32 Tile = First + Index;
+            TerrainBake::BakeTile(Noise, Header, FIntPoint(Tile % Header.NumTilesX, Tile / Header.NumTilesX), Baking[Index], Entries[Tile]);
+        });
+
+        if (WriteTask.IsValid())
+        {
+            WriteTask.Wait();
+        }
+        Swap(Baking, Writing);
+        WriteTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [&Writer, &Writing, &Entries, First]()
+        {
+            for (int32 Index = 0; Index < Writing.Num(); ++Index)
+            {
+                Entries[First + Index].Offset = Writer->Tell();
+                Writer->Serialize(Writing[Index].GetData(), Writing[Index].Num());
+                Writing[Index].Empty();
+            }
+        });
+
+        if (FPlatformTime::Seconds() - LastProgressTime > 5.0)
+        {
+            LastProgressTime = FPlatformTime::Seconds();
+            UE_LOG(LogQuadTree, Display, TEXT("%d / %d tiles"), First + Baking.Num(), NumTiles);
+        }
+    }
+    if (WriteTask.IsValid())
+    {
+        WriteTask.Wait();
+    }
+
+    Header.TableOffset = Writer->Tell();
+    Writer->Serialize(Entries.GetData(), Entries.Num() * sizeof(FTerrainBakeTileEntry));
+    const int64 FileBytes = Writer->Tell();
+    Writer->Seek(0);
+    Writer->Serialize(&Header, sizeof(Header));
+    const bool bWritten = Writer->Close() && !Writer->IsError();
+    Writer.Reset();
+    if (!bWritten || !IFileManager::Get().Move(*OutputPath, *TempPath))
+    {
+        UE_LOG(LogQuadTree, Error, TEXT("Could not write %s"), *OutputPath);
+        IFileManager::Get().Delete(*TempPath, false, true, true);
+        return 1;
+    }
+
+    const double Seconds = FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles);
+    const double Samples = double(NumTiles) * FMath::Square(TileSamples + 1);
+    UE_LOG(LogQuadTree, Display, TEXT("Baked %d tiles in %.2f s: %.1f tiles/s, %.1f M samples/s, %d tiles in flight, %.1f MB written (%.2f bytes per sample, every mip included)"),
+        NumTiles, Seconds, NumTiles / FMath::Max(Seconds, 1e-6), Samples / FMath::Max(Seconds, 1e-6) / 1e6, TilesInFlight,
+        FileBytes / (1024.0 * 1024.0), FileBytes / FMath::Max(Samples, 1.0));
+    return 0;
+}
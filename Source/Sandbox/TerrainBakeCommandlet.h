@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+
+#include "TerrainBakeCommandlet.generated.h"
+
+// Bakes the terrain of a UQuadTreeComponent into a tiled, mip-mapped and compressed file that the
+// component then samples instead of the noise, see FTerrainBakedData and BakedTerrainFile. Tiles are
+// baked on every core in waves, and each wave is written while the next one bakes, so memory stays
+// bounded by two waves however large the area is.
+//
+// -run=TerrainBake [-Actor=<actor class path>] [-Output=<file>] [-OriginX= -OriginY= -Size=<world units>]
+//     [-Spacing=<world units>] [-TileSamples=256] [-MaxHeightError=0.5] [-Compression=Oodle|Zlib|None] [-TilesInFlight=<tiles>]
+//
+// Settings come from the QuadTree component default of the actor class, AQuadTreeActor unless given.
+// The area defaults to one tile of TileSize from the origin, sampled as finely as the deepest chunks.
+UCLASS()
+class UTerrainBakeCommandlet : public UCommandlet
+{
+    GENERATED_BODY()
+
+public:
+    UTerrainBakeCommandlet();
+
+    virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,589 @@
+﻿#include "TerrainBakedData.h"
+#include "Async/MappedFileHandle.h"
+#include "FastNoiseLite.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Compression.h"
+#include "QuadTreeStats.h"
+#include "TerrainHeightCodec.h"
+
+static constexpr float MaxQuantized = 65535.0f;
+
+int32 FTerrainBakeHeader::GetRawTileBytes() const
+{
+    int32 Bytes = 0;
+    for (int32 Mip = 0; Mip < NumMips; ++Mip)
+    {
+        // Two 8-bit normal components per sample
+        Bytes += FMath::Square((TileSamples >> Mip) + 1) * 2;
+    }
+    for (int32 Level = 1; Level < NumMips; ++Level)
+    {
+        // 16-bit min and max per cell
+        Bytes += FMath::Square(TileSamples >> Level) * 4;
+    }
+    return Bytes;
+}
+
+SIZE_T FTerrainBakedTile::GetAllocatedSize() const
+{
+    SIZE_T Bytes = Mips.GetAllocatedSize() + Bounds.GetAllocatedSize();
+    for (const FMip& Mip : Mips)
+    {
+        Bytes += Mip.Heights.GetAllocatedSize() + Mip.Gradients.GetAllocatedSize();
+    }
+    for (const TArray<FVector2f>& Level : Bounds)
+    {
+        Bytes += Level.GetAllocatedSize();
+    }
+    return Bytes;
+}
+
+// Hemi-octahedral mapping of the upper hemisphere onto a square, a byte per axis
+static void EncodeNormal(const FVector2f& Gradient, uint8* Out)
+{
+    const FVector3f Normal = FVector3f(-Gradient.X, -Gradient.Y, 1.0f).GetUnsafeNormal();
+    const float InvLength = 1.0f / (FMath::Abs(Normal.X) + FMath::Abs(Normal.Y) + Normal.Z);
+    const float X = Normal.X * InvLength;
+    const float Y = Normal.Y * InvLength;
+    Out[0] = uint8(FMath::RoundToInt((X + Y) * 127.5f + 127.5f));
+    Out[1] = uint8(FMath::RoundToInt((X - Y) * 127.5f + 127.5f));
+}
+
+static FVector2f DecodeGradient(const uint8* In)
+{
+    const float U = In[0] / 127.5f - 1.0f;
+    const float V = In[1] / 127.5f - 1.0f;
+    const float X = (U + V) * 0.5f;
+    const float Y = (U - V) * 0.5f;
+
+    // Only the slope matters, so the normal is never normalized
+    const float Z = FMath::Max(1.0f - FMath::Abs(X) - FMath::Abs(Y), 1e-3f);
+    return FVector2f(-X / Z, -Y / Z);
+}
+
+FName TerrainBake::GetCompressionName(ETerrainBakeCompression Compression)
+{
+    switch (Compression)
+    {
+        case ETerrainBakeCompression::Zlib:
+            return NAME_Zlib;
+        case ETerrainBakeCompression::Oodle:
+            return NAME_Oodle;
+        default:
+            return NAME_None;
+    }
+}
+
+void TerrainBake::BakeTile(const FastNoiseLite& Noise, const FTerrainBakeHeader& Header, const FIntPoint& Tile, TArray<uint8>& OutData, FTerrainBakeTileEntry& OutEntry)
+{
+    // Mip 0 is sampled as one chunk the size of the tile, by the same code as the runtime chunks
+    FTerrainChunkData Chunk;
+    Chunk.Desc.Key = FTerrainChunkKey(0, Tile);
+    Chunk.Desc.Position = Header.Origin + FVector2D(Tile) * Header.TileWorldSize;
+    Chunk.Desc.Size = Header.TileWorldSize;
+
+    FTerrainGenerationSettings Settings;
+    Settings.Height = Header.Height;
+    Settings.Resolution = Header.TileSamples;
+    Settings.bBuildMesh = false;
+    Settings.bBuildAttributes = true;
+    FastNoiseLite LocalNoise = Noise;
+    SampleTerrainChunk(LocalNoise, Settings, Chunk);
+
+    const TArray<float>& Heights = Chunk.Heights;
+    float MinHeight = MAX_flt;
+    float MaxHeight = -MAX_flt;
+    for (float Sample : Heights)
+    {
+        MinHeight = FMath::Min(MinHeight, Sample);
+        MaxHeight = FMath::Max(MaxHeight, Sample);
+    }
+
+    // Bounds round outwards so they still hold after quantization
+    const float Scale = MaxHeight > MinHeight ? MaxQuantized / (MaxHeight - MinHeight) : 0.0f;
+    auto QuantizeDown = [MinHeight, Scale](float Sample) { return uint16(FMath::Clamp(FMath::FloorToInt((Sample - MinHeight) * Scale), 0, 65535)); };
+    auto QuantizeUp = [MinHeight, Scale](float Sample) { return uint16(FMath::Clamp(FMath::CeilToInt((Sample - MinHeight) * Scale), 0, 65535)); };
+
+    // Heights of every mip lead the tile, behind their total size. The codec quantizes from zero, so a
+    // sample shared by several mips decodes the same in each and coarse and fine chunks still meet.
+    OutData.Reset();
+    OutData.AddZeroed(sizeof(int32));
+    TArray<float> MipHeights;
+    const int32 GridSize = Header.TileSamples + 1;
+    for (int32 Mip = 0; Mip < Header.NumMips; ++Mip)
+    {
+        const int32 Stride = 1 << Mip;
+        const int32 MipSize = (Header.TileSamples >> Mip) + 1;
+        MipHeights.SetNumUninitialized(MipSize * MipSize);
+        for (int32 Y = 0; Y < MipSize; ++Y)
+        {
+            for (int32 X = 0; X < MipSize; ++X)
+            {
+                MipHeights[Y * MipSize + X] = Heights[Y * Stride * GridSize + X * Stride];
+            }
+        }
+        EncodeTerrainHeights(MipHeights, MipSize, MipSize, Header.MaxHeightError, OutData);
+    }
+    const int32 HeightBytes = OutData.Num() - int32(sizeof(int32));
+    FMemory::Memcpy(OutData.GetData(), &HeightBytes, sizeof(HeightBytes));
+
+    TArray<uint8> Raw;
+    Raw.SetNumUninitialized(Header.GetRawTileBytes());
+    uint8* Out = Raw.GetData();
+    for (int32 Mip = 0; Mip < Header.NumMips; ++Mip)
+    {
+        const int32 Stride = 1 << Mip;
+        const int32 MipSize = (Header.TileSamples >> Mip) + 1;
+        for (int32 Y = 0; Y < MipSize; ++Y)
+        {
+            for (int32 X = 0; X < MipSize; ++X)
+            {
+                EncodeNormal(Chunk.Gradients[Y * Stride * GridSize + X * Stride], Out);
+                Out += 2;
+            }
+        }
+    }
+
+    // Min/max pyramid, level 1 from the samples and every further level from the one below
+    TArray<FVector2f> Level;
+    TArray<FVector2f> Below;
+    for (int32 LevelIndex = 1; LevelIndex < Header.NumMips; ++LevelIndex)
+    {
+        const int32 Cells = Header.TileSamples >> LevelIndex;
+        Level.SetNumUninitialized(Cells * Cells);
+        for (int32 CellY = 0; CellY < Cells; ++CellY)
+        {
+            for (int32 CellX = 0; CellX < Cells; ++CellX)
+            {
+                FVector2f Range(MAX_flt, -MAX_flt);
+                for (int32 Y = 0; Y < (LevelIndex == 1 ? 3 : 2); ++Y)
+                {
+                    for (int32 X = 0; X < (LevelIndex == 1 ? 3 : 2); ++X)
+                    {
+                        const FVector2f Child = LevelIndex == 1
+                            ? FVector2f(Heights[(CellY * 2 + Y) * GridSize + CellX * 2 + X])
+                            : Below[(CellY * 2 + Y) * Cells * 2 + CellX * 2 + X];
+                        Range.X = FMath::Min(Range.X, Child.X);
+                        Range.Y = FMath::Max(Range.Y, Child.Y);
+                    }
+                }
+                Level[CellY * Cells + CellX] = Range;
+
+                const uint16 Packed[2] = {QuantizeDown(Range.X), QuantizeUp(Range.Y)};
+                FMemory::Memcpy(Out, Packed, sizeof(Packed));
+                Out += sizeof(Packed);
+            }
+        }
+        Swap(Level, Below);
+    }
+    check(Out == Raw.GetData() + Raw.Num());
+
+    OutEntry.Offset = 0;
+    OutEntry.RawSize = Raw.Num();
+    OutEntry.MinHeight = MinHeight;
+    OutEntry.MaxHeight = MaxHeight;
+
+    // The rest is stored as is where compression does not help, and then never decompressed
+    const FName Format = GetCompressionName(Header.Compression);
+    const int32 RestOffset = OutData.Num();
+    if (!Format.IsNone())
+    {
+        int32 CompressedSize = FCompression::CompressMemoryBound(Format, Raw.Num());
+        OutData.AddUninitialized(CompressedSize);
+        if (FCompression::CompressMemory(Format, OutData.GetData() + RestOffset, CompressedSize, Raw.GetData(), Raw.Num()) && CompressedSize < Raw.Num())
+        {
+            OutData.SetNum(RestOffset + CompressedSize, false);
+            OutEntry.CompressedSize = OutData.Num();
+            return;
+        }
+        OutData.SetNum(RestOffset, false);
+    }
+    OutData.Append(Raw);
+    OutEntry.CompressedSize = OutData.Num();
+}
+
+bool TerrainBake::DecodeTile(const FTerrainBakeHeader& Header, const FTerrainBakeTileEntry& Entry, const uint8* Data, FTerrainBakedTile& OutTile)
+{
+    int32 HeightBytes = 0;
+    if (Entry.RawSize != Header.GetRawTileBytes() || Entry.CompressedSize < int32(sizeof(HeightBytes)))
+    {
+        return false;
+    }
+    FMemory::Memcpy(&HeightBytes, Data, sizeof(HeightBytes));
+    const int32 RestBytes = Entry.CompressedSize - int32(sizeof(HeightBytes)) - HeightBytes;
+    if (HeightBytes < 0 || RestBytes < 0)
+    {
+        return false;
+    }
+
+    OutTile.Mips.SetNum(Header.NumMips);
+    TConstArrayView<uint8> Encoded(Data + sizeof(HeightBytes), HeightBytes);
+    for (int32 Mip = 0; Mip < Header.NumMips; ++Mip)
+    {
+        const int32 MipSize = (Header.TileSamples >> Mip) + 1;
+        int32 Width = 0;
+        int32 Height = 0;
+        const int32 Bytes = DecodeTerrainHeights(Encoded, OutTile.Mips[Mip].Heights, Width, Height);
+        if (Bytes == 0 || Width != MipSize || Height != MipSize)
+        {
+            return false;
+        }
+        Encoded = Encoded.RightChop(Bytes);
+    }
+
+    TArray<uint8> Raw;
+    const uint8* In = Data + sizeof(HeightBytes) + HeightBytes;
+    if (RestBytes != Entry.RawSize)
+    {
+        Raw.SetNumUninitialized(Entry.RawSize);
+        if (!FCompression::UncompressMemory(GetCompressionName(Header.Compression), Raw.GetData(), Raw.Num(), In, RestBytes))
+        {
+            return false;
+        }
+        In = Raw.GetData();
+    }
+
+    for (int32 Mip = 0; Mip < Header.NumMips; ++Mip)
+    {
+        const int32 MipSize = (Header.TileSamples >> Mip) + 1;
+        FTerrainBakedTile::FMip& Target = OutTile.Mips[Mip];
+        Target.Gradients.SetNumUninitialized(MipSize * MipSize);
+        for (FVector2f& Gradient : Target.Gradients)
+        {
+            Gradient = DecodeGradient(In);
+            In += 2;
+        }
+    }
+
+    // Widened by the height error, so they hold the decoded heights as well as the sampled ones
+    const float Step = (Entry.MaxHeight - Entry.MinHeight) / MaxQuantized;
+    OutTile.Bounds.SetNum(Header.NumMips - 1);
+    for (int32 Level = 1; Level < Header.NumMips; ++Level)
+    {
+        TArray<FVector2f>& Target = OutTile.Bounds[Level - 1];
+        Target.SetNumUninitialized(FMath::Square(Header.TileSamples >> Level));
+        for (FVector2f& Range : Target)
+        {
+            uint16 Packed[2];
+            FMemory::Memcpy(Packed, In, sizeof(Packed));
+            In += sizeof(Packed);
+            Range = FVector2f(Entry.MinHeight + Packed[0] * Step - Header.MaxHeightError, Entry.MinHeight + Packed[1] * Step + Header.MaxHeightError);
+        }
+    }
+    return true;
+}
+
+FTerrainBakedData::FTerrainBakedData(const FString& InPath, SIZE_T InDecodedBudget)
+    : Path(InPath), DecodedBudget(InDecodedBudget)
+{
+    TUniquePtr<IMappedFileHandle> NewHandle(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+    if (!NewHandle || NewHandle->GetFileSize() < int64(sizeof(FTerrainBakeHeader)))
+    {
+        return;
+    }
+    TUniquePtr<IMappedFileRegion> NewRegion(NewHandle->MapRegion());
+    if (!NewRegion)
+    {
+        return;
+    }
+
+    const uint8* Data = NewRegion->GetMappedPtr();
+    const int64 Size = NewRegion->GetMappedSize();
+    FMemory::Memcpy(&Header, Data, sizeof(Header));
+    if (Header.Magic != TerrainBake::Magic || Header.Version != TerrainBake::Version || Header.TileSamples < 2
+        || !FMath::IsPowerOfTwo(Header.TileSamples) || Header.NumMips != int32(FMath::FloorLog2(Header.TileSamples)) + 1
+        || Header.NumTilesX < 1 || Header.NumTilesY < 1 || Header.TileWorldSize <= 0.0 || Header.TableOffset < int64(sizeof(Header))
+        || Header.TableOffset + int64(Header.GetNumTiles()) * int64(sizeof(FTerrainBakeTileEntry)) > Size)
+    {
+        return;
+    }
+
+    Entries.SetNumUninitialized(Header.GetNumTiles());
+    FMemory::Memcpy(Entries.GetData(), Data + Header.TableOffset, Entries.Num() * sizeof(FTerrainBakeTileEntry));
+    for (const FTerrainBakeTileEntry& Entry : Entries)
+    {
+        if (Entry.Offset < int64(sizeof(Header)) || Entry.CompressedSize < 0 || Entry.Offset + Entry.CompressedSize > Header.TableOffset)
+        {
+            return;
+        }
+    }
+
+    Handle = MoveTemp(NewHandle);
+    Region = MoveTemp(NewRegion);
+}
+
+FTerrainBakedData::~FTerrainBakedData()
+{
+    // The region has to go before the handle it was mapped from
+    Region.Reset();
+    Handle.Reset();
+}
+
+FBox2D FTerrainBakedData::GetArea() const
+{
+    return FBox2D(Header.Origin, Header.Origin + FVector2D(Header.NumTilesX, Header.NumTilesY) * Header.TileWorldSize);
+}
+
+bool FTerrainBakedData::Contains(const FBox2D& Area) const
+{
+    return GetArea().ExpandBy(Header.GetSpacing() * 1e-3).IsInside(Area);
+}
+
+FTerrainBakedData::FTilePtr FTerrainBakedData::GetTile(int32 Index) const
+{
+    {
+        FScopeLock Lock(&Mutex);
+        if (FDecoded* Found = Decoded.Find(Index))
+        {
+            Found->LastUse = ++UseCounter;
+            return Found->Tile;
+        }
+    }
+
+    // Decoded outside the lock. Two threads missing the same tile both decode it and the first one is kept.
+    const uint64 StartCycles = FPlatformTime::Cycles64();
+    const FTerrainBakeTileEntry& Entry = Entries[Index];
+    TSharedPtr<FTerrainBakedTile, ESPMode::ThreadSafe> Tile = MakeShared<FTerrainBakedTile, ESPMode::ThreadSafe>();
+    if (!TerrainBake::DecodeTile(Header, Entry, Region->GetMappedPtr() + Entry.Offset, *Tile))
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Could not decode tile %d of terrain bake %s"), Index, *Path);
+        return nullptr;
+    }
+    DecodeCycles += FPlatformTime::Cycles64() - StartCycles;
+    NumDecodes++;
+
+    FScopeLock Lock(&Mutex);
+    if (FDecoded* Found = Decoded.Find(Index))
+    {
+        Found->LastUse = ++UseCounter;
+        return Found->Tile;
+    }
+
+    const SIZE_T Bytes = Tile->GetAllocatedSize();
+    Decoded.Add(Index, {Tile, Bytes, ++UseCounter});
+    DecodedBytes += Bytes;
+
+    // Least recently used tiles go first, the one just decoded always stays
+    while (DecodedBytes > DecodedBudget && Decoded.Num() > 1)
+    {
+        int32 Oldest = INDEX_NONE;
+        uint64 OldestUse = MAX_uint64;
+        for (const TPair<int32, FDecoded>& Pair : Decoded)
+        {
+            if (Pair.Value.LastUse < OldestUse)
+            {
+                Oldest = Pair.Key;
+                OldestUse = Pair.Value.LastUse;
+            }
+        }
+        DecodedBytes -= Decoded.FindChecked(Oldest).Bytes;
+        Decoded.Remove(Oldest);
+    }
+    return Tile;
+}
+
+bool FTerrainBakedData::SampleChunk(const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk) const
+{
+    const FTerrainChunkDesc& Desc = Chunk.Desc;
+    if (!IsValid() || !Contains(FBox2D(Desc.Position, Desc.Position + FVector2D(Desc.Size, Desc.Size))))
+    {
+        return false;
+    }
+
+    const int32 Resolution = FMath::Max(Settings.Resolution, 1);
+    const int32 GridSize = Resolution + 1;
+    const double Step = Desc.Size / Resolution;
+
+    // Coarsest mip that does not skip over any of the chunk's samples
+    int32 Mip = 0;
+    while (Mip + 1 < Header.NumMips && Header.GetSpacing() * (1 << (Mip + 1)) <= Step * (1.0 + UE_DOUBLE_KINDA_SMALL_NUMBER))
+    {
+        ++Mip;
+    }
+    const int32 Cells = Header.TileSamples >> Mip;
+    const int32 MipSize = Cells + 1;
+    const double InvSpacing = 1.0 / (Header.GetSpacing() * (1 << Mip));
+
+    // A chunk spans few tiles, each is looked up once
+    TArray<TPair<int32, FTilePtr>, TInlineAllocator<4>> Tiles;
+    auto FindTile = [this, &Tiles](int32 Index) -> const FTerrainBakedTile*
+    {
+        for (const TPair<int32, FTilePtr>& Pair : Tiles)
+        {
+            if (Pair.Key == Index)
+            {
+                return Pair.Value.Get();
+            }
+        }
+        return Tiles.Emplace_GetRef(Index, GetTile(Index)).Value.Get();
+    };
+
+    const bool bNeedGradients = Settings.bBuildAttributes;
+    Chunk.Resolution = Resolution;
+    Chunk.Heights.SetNumUninitialized(GridSize * GridSize);
+    if (bNeedGradients)
+    {
+        Chunk.Gradients.SetNumUninitialized(GridSize * GridSize);
+    }
+
+    for (int32 Y = 0; Y < GridSize; ++Y)
+    {
+        for (int32 X = 0; X < GridSize; ++X)
+        {
+            // In samples of the mip from the bake origin, a tile border belongs to the tile before it
+            const FVector2D Sample = (Desc.Position + FVector2D(X, Y) * Step - Header.Origin) * InvSpacing;
+            const int32 TileX = FMath::Clamp(FMath::FloorToInt32(Sample.X / Cells), 0, Header.NumTilesX - 1);
+            const int32 TileY = FMath::Clamp(FMath::FloorToInt32(Sample.Y / Cells), 0, Header.NumTilesY - 1);
+            const FTerrainBakedTile* Tile = FindTile(TileY * Header.NumTilesX + TileX);
+            if (!Tile)
+            {
+                return false;
+            }
+
+            const double LocalX = FMath::Clamp(Sample.X - double(TileX) * Cells, 0.0, double(Cells));
+            const double LocalY = FMath::Clamp(Sample.Y - double(TileY) * Cells, 0.0, double(Cells));
+            const int32 X0 = FMath::Min(FMath::FloorToInt32(LocalX), Cells - 1);
+            const int32 Y0 = FMath::Min(FMath::FloorToInt32(LocalY), Cells - 1);
+            const float FracX = float(LocalX - X0);
+            const float FracY = float(LocalY - Y0);
+            const int32 Base = Y0 * MipSize + X0;
+            const int32 Index = Y * GridSize + X;
+
+            const TArray<float>& Heights = Tile->Mips[Mip].Heights;
+            Chunk.Heights[Index] = FMath::Lerp(
+                FMath::Lerp(Heights[Base], Heights[Base + 1], FracX),
+                FMath::Lerp(Heights[Base + MipSize], Heights[Base + MipSize + 1], FracX), FracY);
+            if (bNeedGradients)
+            {
+                const TArray<FVector2f>& Gradients = Tile->Mips[Mip].Gradients;
+                Chunk.Gradients[Index] = FMath::Lerp(
+                    FMath::Lerp(Gradients[Base], Gradients[Base + 1], FracX),
+                    FMath::Lerp(Gradients[Base + MipSize], Gradients[Base + MipSize + 1], FracX), FracY);
+            }
+        }
+    }
+    NumChunks++;
+    return true;
+}
+
+bool FTerrainBakedData::SampleAt(const FVector2D& Location, float& OutHeight, FVector2f* OutGradient) const
+{
+    if (!IsValid() || !Contains(FBox2D(Location, Location)))
+    {
+        return false;
+    }
+
+    // Same lookup as SampleChunk on mip 0
+    const int32 Cells = Header.TileSamples;
+    const int32 MipSize = Cells + 1;
+    const FVector2D Sample = (Location - Header.Origin) / Header.GetSpacing();
+    const int32 TileX = FMath::Clamp(FMath::FloorToInt32(Sample.X / Cells), 0, Header.NumTilesX - 1);
+    const int32 TileY = FMath::Clamp(FMath::FloorToInt32(Sample.Y / Cells), 0, Header.NumTilesY - 1);
+    const FTilePtr Tile = GetTile(TileY * Header.NumTilesX + TileX);
+    if (!Tile)
+    {
+        return false;
+    }
+
+    const double LocalX = FMath::Clamp(Sample.X - double(TileX) * Cells, 0.0, double(Cells));
+    const double LocalY = FMath::Clamp(Sample.Y - double(TileY) * Cells, 0.0, double(Cells));
+    const int32 X0 = FMath::Min(FMath::FloorToInt32(LocalX), Cells - 1);
+    const int32 Y0 = FMath::Min(FMath::FloorToInt32(LocalY), Cells - 1);
+    const float FracX = float(LocalX - X0);
+    const float FracY = float(LocalY - Y0);
+    const int32 Base = Y0 * MipSize + X0;
+
+    const TArray<float>& Heights = Tile->Mips[0].Heights;
+    OutHeight = FMath::Lerp(
+        FMath::Lerp(Heights[Base], Heights[Base + 1], FracX),
+        FMath::Lerp(Heights[Base + MipSize], Heights[Base + MipSize + 1], FracX), FracY);
+    if (OutGradient)
+    {
+        const TArray<FVector2f>& Gradients = Tile->Mips[0].Gradients;
+        *OutGradient = FMath::Lerp(
+            FMath::Lerp(Gradients[Base], Gradients[Base + 1], FracX),
+            FMath::Lerp(Gradients[Base + MipSize], Gradients[Base + MipSize + 1], FracX), FracY);
+    }
+    return true;
+}
+
+bool FTerrainBakedData::GetHeightRange(const FBox2D& Area, float& OutMin, float& OutMax) const
+{
+    if (!IsValid() || !Contains(Area))
+    {
+        return false;
+    }
+
+    // In mip 0 samples from the bake origin
+    const double Spacing = Header.GetSpacing();
+    const FVector2D Min = (Area.Min - Header.Origin) / Spacing;
+    const FVector2D Max = (Area.Max - Header.Origin) / Spacing;
+
+    // Cells at least half the size of the area, so each tile adds at most 3x3 of them
+    const int32 AreaSamples = FMath::Max(1, FMath::CeilToInt32(FMath::Max(Max.X - Min.X, Max.Y - Min.Y)));
+    const int32 Level = FMath::Clamp(int32(FMath::CeilLogTwo(uint32(AreaSamples))) - 1, 1, Header.NumMips - 1);
+    const int32 Cells = Header.TileSamples >> Level;
+    const double CellSamples = double(1 << Level);
+
+    const int32 FirstTileX = FMath::Clamp(FMath::FloorToInt32(Min.X / Header.TileSamples), 0, Header.NumTilesX - 1);
+    const int32 FirstTileY = FMath::Clamp(FMath::FloorToInt32(Min.Y / Header.TileSamples), 0, Header.NumTilesY - 1);
+    const int32 LastTileX = FMath::Clamp(FMath::FloorToInt32(Max.X / Header.TileSamples), 0, Header.NumTilesX - 1);
+    const int32 LastTileY = FMath::Clamp(FMath::FloorToInt32(Max.Y / Header.TileSamples), 0, Header.NumTilesY - 1);
+
+    OutMin = MAX_flt;
+    OutMax = -MAX_flt;
+    for (int32 TileY = FirstTileY; TileY <= LastTileY; ++TileY)
+    {
+        for (int32 TileX = FirstTileX; TileX <= LastTileX; ++TileX)
+        {
+            const int32 Index = TileY * Header.NumTilesX + TileX;
+            const FVector2D LocalMin = Min - FVector2D(TileX, TileY) * Header.TileSamples;
+            const FVector2D LocalMax = Max - FVector2D(TileX, TileY) * Header.TileSamples;
+
+            // Areas over the whole tile get by with the table, without decoding anything
+            if (LocalMin.X <= 0.0 && LocalMin.Y <= 0.0 && LocalMax.X >= Header.TileSamples && LocalMax.Y >= Header.TileSamples)
+            {
+                OutMin = FMath::Min(OutMin, Entries[Index].MinHeight - Header.MaxHeightError);
+                OutMax = FMath::Max(OutMax, Entries[Index].MaxHeight + Header.MaxHeightError);
+                continue;
+            }
+
+            const FTilePtr Tile = GetTile(Index);
+            if (!Tile)
+            {
+                return false;
+            }
+            const TArray<FVector2f>& Bounds = Tile->Bounds[Level - 1];
+            const int32 FirstCellX = FMath::Clamp(FMath::FloorToInt32(LocalMin.X / CellSamples), 0, Cells - 1);
+            const int32 FirstCellY = FMath::Clamp(FMath::FloorToInt32(LocalMin.Y / CellSamples), 0, Cells - 1);
+            const int32 LastCellX = FMath::Clamp(FMath::FloorToInt32(LocalMax.X / CellSamples), 0, Cells - 1);
+            const int32 LastCellY = FMath::Clamp(FMath::FloorToInt32(LocalMax.Y / CellSamples), 0, Cells - 1);
+            for (int32 CellY = FirstCellY; CellY <= LastCellY; ++CellY)
+            {
+                for (int32 CellX = FirstCellX; CellX <= LastCellX; ++CellX)
+                {
+                    const FVector2f& Range = Bounds[CellY * Cells + CellX];
+                    OutMin = FMath::Min(OutMin, Range.X);
+                    OutMax = FMath::Max(OutMax, Range.Y);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+SIZE_T FTerrainBakedData::GetFileBytes() const
+{
+    return Region ? Region->GetMappedSize() : 0;
+}
+
+SIZE_T FTerrainBakedData::GetDecodedBytes() const
+{
+    FScopeLock Lock(&Mutex);
+    return DecodedBytes;
+}
+
+double FTerrainBakedData::GetDecodeSeconds() const
+{
+    return FPlatformTime::ToSeconds64(DecodeCycles);
+}
@@ -0,0 +1,152 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainChunk.h"
+#include <atomic>
+
+class FastNoiseLite;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+enum class ETerrainBakeCompression : uint32
+{
+    None = 0,
+    Zlib = 1,
+    Oodle = 2
+};
+
+// Leads a bake file. The baked area is a grid of NumTilesX by NumTilesY square tiles from Origin, in
+// terrain space. Each tile holds (TileSamples + 1)^2 samples at mip 0, shared with its neighbours along
+// the borders, and every further mip keeps every other sample of the one before down to a single cell.
+struct FTerrainBakeHeader
+{
+    uint32 Magic;
+    uint32 Version;
+
+    // Noise configuration the bake was sampled from, the component ignores the bake when its own differs
+    uint64 NoiseHash;
+    FVector2D Origin;
+    double TileWorldSize;
+    int32 TileSamples;
+    int32 NumMips;
+    int32 NumTilesX;
+    int32 NumTilesY;
+    float Height;
+
+    // Largest difference between a baked and a sampled height, 0 when heights are kept exact
+    float MaxHeightError;
+    ETerrainBakeCompression Compression;
+
+    // Tile entries, row by row, after the tile data
+    int64 TableOffset;
+
+    double GetSpacing() const { return TileWorldSize / TileSamples; }
+    int32 GetNumTiles() const { return NumTilesX * NumTilesY; }
+
+    // Normals and min/max pyramid of one tile before compression, heights are encoded on their own
+    int32 GetRawTileBytes() const;
+};
+
+struct FTerrainBakeTileEntry
+{
+    int64 Offset;
+    int32 CompressedSize;
+    int32 RawSize;
+    float MinHeight;
+    float MaxHeight;
+};
+
+// One tile decoded for sampling
+struct FTerrainBakedTile
+{
+    struct FMip
+    {
+        TArray<float> Heights;
+        TArray<FVector2f> Gradients;
+    };
+
+    TArray<FMip> Mips;
+
+    // Min and max height per cell of 2^Level mip 0 samples, level 1 first
+    TArray<TArray<FVector2f>> Bounds;
+
+    SIZE_T GetAllocatedSize() const;
+};
+
+namespace TerrainBake
+{
+    static constexpr uint32 Magic = 0x4B414254; // "TBAK"
+    static constexpr uint32 Version = 2;
+
+    FName GetCompressionName(ETerrainBakeCompression Compression);
+
+    // Samples one tile of the bake and encodes it: the heights of each mip through the height codec
+    // within MaxHeightError, then normals in 8-bit hemi-octahedral form and the min/max pyramid,
+    // compressed as the header asks. Safe from any thread. OutEntry gets everything but the offset.
+    void BakeTile(const FastNoiseLite& Noise, const FTerrainBakeHeader& Header, const FIntPoint& Tile, TArray<uint8>& OutData, FTerrainBakeTileEntry& OutEntry);
+
+    bool DecodeTile(const FTerrainBakeHeader& Header, const FTerrainBakeTileEntry& Entry, const uint8* Data, FTerrainBakedTile& OutTile);
+}
+
+// A bake file written by the TerrainBake commandlet, memory mapped read-only. Chunks inside the baked
+// area are sampled from it instead of the noise, and node bounds come from its min/max pyramid.
+// Tiles are decompressed on first use and the least recently used ones are dropped past the budget.
+// Everything is safe from any thread.
+class FTerrainBakedData
+{
+public:
+    FTerrainBakedData(const FString& InPath, SIZE_T InDecodedBudget);
+    ~FTerrainBakedData();
+
+    bool IsValid() const { return Region.IsValid(); }
+    const FString& GetPath() const { return Path; }
+    const FTerrainBakeHeader& GetHeader() const { return Header; }
+    FBox2D GetArea() const;
+
+    // Fills the chunk's heights, and gradients when the settings build attributes, from the coarsest mip
+    // that is at least as fine as the chunk. False when the chunk is not entirely inside the baked area.
+    bool SampleChunk(const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk) const;
+
+    // Height at a point, and its gradient if asked, bilinear between the finest samples. False outside the baked area.
+    bool SampleAt(const FVector2D& Location, float& OutHeight, FVector2f* OutGradient = nullptr) const;
+
+    // Height range of the baked samples over Area, false when it is not entirely inside the baked area
+    bool GetHeightRange(const FBox2D& Area, float& OutMin, float& OutMax) const;
+
+    SIZE_T GetFileBytes() const;
+    SIZE_T GetDecodedBytes() const;
+    int32 GetNumChunks() const { return NumChunks; }
+    int32 GetNumDecodes() const { return NumDecodes; }
+    double GetDecodeSeconds() const;
+
+private:
+    using FTilePtr = TSharedPtr<const FTerrainBakedTile, ESPMode::ThreadSafe>;
+
+    struct FDecoded
+    {
+        FTilePtr Tile;
+        SIZE_T Bytes;
+        uint64 LastUse;
+    };
+
+    bool Contains(const FBox2D& Area) const;
+    FTilePtr GetTile(int32 Index) const;
+
+    FString Path;
+    SIZE_T DecodedBudget;
+    FTerrainBakeHeader Header {};
+    TArray<FTerrainBakeTileEntry> Entries;
+    TUniquePtr<IMappedFileHandle> Handle;
+    TUniquePtr<IMappedFileRegion> Region;
+
+    mutable FCriticalSection Mutex;
+    mutable TMap<int32, FDecoded> Decoded;
+    mutable SIZE_T DecodedBytes {0};
+    mutable uint64 UseCounter {0};
+
+    mutable std::atomic<int32> NumChunks {0};
+    mutable std::atomic<int32> NumDecodes {0};
+    mutable std::atomic<uint64> DecodeCycles {0};
+};
+
+using FTerrainBakedDataPtr = TSharedPtr<FTerrainBakedData, ESPMode::ThreadSafe>;
@@ -0,0 +1,566 @@
+#include "TerrainChunk.h"
+#include "FastNoiseLite.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/VectorRegister.h"
+#include "QuadTreeStats.h"
+
+static TAutoConsoleVariable<int32> CVarValidateTerrainNormals(
+    TEXT("QuadTree.ValidateNormals"),
+    0,
+    TEXT("Compare analytic terrain normals against finite differences and log the largest error per chunk."),
+    ECVF_Default);
+
+SIZE_T FTerrainChunkData::GetAllocatedSize() const
+{
+    return sizeof(*this) + Heights.GetAllocatedSize() + Gradients.GetAllocatedSize() + Vertices.GetAllocatedSize() + Triangles.GetAllocatedSize();
+}
+
+static void ValidateTerrainChunkGradients(FastNoiseLite& Noise, float Height, double Step, const FTerrainChunkData& Chunk, uint64 AnalyticCycles)
+{
+    const int32 GridSize = Chunk.GetGridSize();
+    const double Delta = Step * 0.01;
+    const uint64 StartCycles = FPlatformTime::Cycles64();
+
+    float MaxErrorDegrees = 0.0f;
+    for (int32 Y = 0; Y < GridSize; ++Y)
+    {
+        for (int32 X = 0; X < GridSize; ++X)
+        {
+            const FVector2D Sample = Chunk.Desc.Position + FVector2D(X, Y) * Step;
+            const double Dx = (Noise.GetNoise(Sample.X + Delta, Sample.Y) - Noise.GetNoise(Sample.X - Delta, Sample.Y)) * Height / (2.0 * Delta);
+            const double Dy = (Noise.GetNoise(Sample.X, Sample.Y + Delta) - Noise.GetNoise(Sample.X, Sample.Y - Delta)) * Height / (2.0 * Delta);
+
+            const FVector2f& Gradient = Chunk.Gradients[Y * GridSize + X];
+            const FVector Analytic = FVector(-Gradient.X, -Gradient.Y, 1.0f).GetSafeNormal();
+            const FVector Numeric = FVector(-Dx, -Dy, 1.0).GetSafeNormal();
+            MaxErrorDegrees = FMath::Max(MaxErrorDegrees, float(FMath::RadiansToDegrees(FMath::Acos(FMath::Clamp(Analytic | Numeric, -1.0, 1.0)))));
+        }
+    }
+
+    const uint64 NumericCycles = FPlatformTime::Cycles64() - StartCycles;
+    UE_LOG(LogQuadTree, Log, TEXT("Chunk (%d, %d, %d): analytic normals within %.3f degrees of finite differences, %.2fx the cost of sampling them"),
+        Chunk.Desc.Key.Depth, Chunk.Desc.Key.Coord.X, Chunk.Desc.Key.Coord.Y, MaxErrorDegrees,
+        AnalyticCycles > 0 ? double(NumericCycles) / AnalyticCycles : 0.0);
+}
+
+void SampleTerrainChunk(FastNoiseLite& Noise, const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk)
+{
+    Chunk.Resolution = FMath::Max(Settings.Resolution, 1);
+    const int32 GridSize = Chunk.GetGridSize();
+    const double Step = Chunk.Desc.Size / Chunk.Resolution;
+
+    Chunk.Heights.SetNumUninitialized(GridSize * GridSize);
+
+    if (!Settings.bBuildAttributes)
+    {
+        // Nothing downstream shades this chunk, gradients would go unused
+        for (int32 Y = 0; Y < GridSize; ++Y)
+        {
+            for (int32 X = 0; X < GridSize; ++X)
+            {
+                const FVector2D Sample = Chunk.Desc.Position + FVector2D(X, Y) * Step;
+                Chunk.Heights[Y * GridSize + X] = Noise.GetNoise(Sample.X, Sample.Y) * Settings.Height;
+            }
+        }
+        return;
+    }
+
+    Chunk.Gradients.SetNumUninitialized(GridSize * GridSize);
+
+    if (!Noise.HasAnalyticGradient())
+    {
+        // One ring of apron samples around the grid, so border gradients see the same
+        // neighbours as the adjacent chunk and lighting has no seams
+        const int32 ApronSize = GridSize + 2;
+        TArray<float> Apron;
+        Apron.SetNumUninitialized(ApronSize * ApronSize);
+        for (int32 Y = 0; Y < ApronSize; ++Y)
+        {
+            for (int32 X = 0; X < ApronSize; ++X)
+            {
+                const FVector2D Sample = Chunk.Desc.Position + FVector2D(X - 1, Y - 1) * Step;
+                Apron[Y * ApronSize + X] = Noise.GetNoise(Sample.X, Sample.Y) * Settings.Height;
+            }
+        }
+
+        const float InvTwoStep = float(0.5 / Step);
+        for (int32 Y = 0; Y < GridSize; ++Y)
+        {
+            for (int32 X = 0; X < GridSize; ++X)
+            {
+                const int32 Center = (Y + 1) * ApronSize + X + 1;
+                const int32 Index = Y * GridSize + X;
+                Chunk.Heights[Index] = Apron[Center];
+                Chunk.Gradients[Index] = FVector2f(Apron[Center + 1] - Apron[Center - 1], Apron[Center + ApronSize] - Apron[Center - ApronSize]) * InvTwoStep;
+            }
+        }
+        return;
+    }
+
+    const uint64 StartCycles = FPlatformTime::Cycles64();
+    for (int32 Y = 0; Y < GridSize; ++Y)
+    {
+        for (int32 X = 0; X < GridSize; ++X)
+        {
+            const int32 Index = Y * GridSize + X;
+            const FVector2D Sample = Chunk.Desc.Position + FVector2D(X, Y) * Step;
+            float Dx, Dy;
+            Chunk.Heights[Index] = Noise.GetNoiseWithGradient(Sample.X, Sample.Y, Dx, Dy) * Settings.Height;
+            Chunk.Gradients[Index] = FVector2f(Dx, Dy) * Settings.Height;
+        }
+    }
+
+    if (CVarValidateTerrainNormals.GetValueOnAnyThread() != 0)
+    {
+        ValidateTerrainChunkGradients(Noise, Settings.Height, Step, Chunk, FPlatformTime::Cycles64() - StartCycles);
+    }
+}
+
+void BuildTerrainChunkMesh(const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk)
+{
+    const int32 GridSize = Chunk.GetGridSize();
+    check(GridSize <= MAX_uint16);
+    const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Chunk.Resolution);
+
+    // The whole output range of the noise fits in 16 bits, the clamp below never bites on noise within its bound
+    const float HeightBound = Settings.HeightBound > 0.0f ? Settings.HeightBound : FMath::Abs(Settings.Height) * 2.0f;
+    Chunk.HeightQuantum = FMath::Max(HeightBound, 1.0f) / MAX_int16;
+    const float InvHeightQuantum = 1.0f / Chunk.HeightQuantum;
+
+    Chunk.Vertices.SetNumZeroed(GridSize * GridSize);
+    for (int32 Index = 0; Index < Chunk.Vertices.Num(); ++Index)
+    {
+        const int32 GridIndex = Layout.VertexToGrid[Index];
+        FTerrainPackedVertex& Vertex = Chunk.Vertices[Index];
+        Vertex.X = uint16(GridIndex % GridSize);
+        Vertex.Y = uint16(GridIndex / GridSize);
+        Vertex.Height = int16(FMath::Clamp(FMath::RoundToInt(Chunk.Heights[GridIndex] * InvHeightQuantum), -MAX_int16, MAX_int16));
+    }
+
+    Chunk.Triangles = Layout.Indices[uint8(ETerrainStitch::None)];
+}
+
+// Row by row over the grid, with odd vertices on stitched edges folded away
+static void BuildTerrainGridIndices(int32 Resolution, ETerrainStitch Stitch, TArray<int32>& OutIndices)
+{
+    const int32 GridSize = Resolution + 1;
+
+    // Folding needs even vertices at both ends of every stitched edge
+    if (Resolution % 2 != 0)
+    {
+        Stitch = ETerrainStitch::None;
+    }
+
+    // Odd vertices on a stitched edge collapse onto the even vertex before them, so the edge follows
+    // the coarser neighbour's segments. The triangles touching them degenerate and are skipped.
+    auto GetIndex = [GridSize, Stitch](int32 X, int32 Y)
+    {
+        if ((X == 0 && EnumHasAnyFlags(Stitch, ETerrainStitch::NegX)) || (X == GridSize - 1 && EnumHasAnyFlags(Stitch, ETerrainStitch::PosX)))
+        {
+            Y &= ~1;
+        }
+        if ((Y == 0 && EnumHasAnyFlags(Stitch, ETerrainStitch::NegY)) || (Y == GridSize - 1 && EnumHasAnyFlags(Stitch, ETerrainStitch::PosY)))
+        {
+            X &= ~1;
+        }
+        return Y * GridSize + X;
+    };
+
+    auto AddTriangle = [&OutIndices](int32 A, int32 B, int32 C)
+    {
+        if (A != B && B != C && C != A)
+        {
+            OutIndices.Append({A, B, C});
+        }
+    };
+
+    OutIndices.Reset(Resolution * Resolution * 6);
+    for (int32 Y = 0; Y < Resolution; ++Y)
+    {
+        for (int32 X = 0; X < Resolution; ++X)
+        {
+            const int32 BottomLeft = GetIndex(X, Y);
+            const int32 BottomRight = GetIndex(X + 1, Y);
+            const int32 TopLeft = GetIndex(X, Y + 1);
+            const int32 TopRight = GetIndex(X + 1, Y + 1);
+
+            AddTriangle(BottomLeft, TopLeft, BottomRight);
+            AddTriangle(TopLeft, TopRight, BottomRight);
+        }
+    }
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation: greedily emit the triangle whose vertices
+// score best, favouring vertices that are in the simulated LRU cache and have few triangles left.
+static void OptimizeTerrainIndexOrder(TArray<int32>& Indices, int32 NumVertices)
+{
+    constexpr int32 CacheSize = 32;
+    const int32 NumTriangles = Indices.Num() / 3;
+
+    // Triangles of every vertex, the first Remaining[Vertex] of them are not emitted yet
+    TArray<int32> Offsets;
+    Offsets.SetNumZeroed(NumVertices + 1);
+    for (int32 Vertex : Indices)
+    {
+        Offsets[Vertex + 1]++;
+    }
+    for (int32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+    {
+        Offsets[Vertex + 1] += Offsets[Vertex];
+    }
+
+    TArray<int32> Remaining;
+    Remaining.SetNumZeroed(NumVertices);
+    TArray<int32> Adjacency;
+    Adjacency.SetNumUninitialized(Indices.Num());
+    for (int32 Index = 0; Index < Indices.Num(); ++Index)
+    {
+        const int32 Vertex = Indices[Index];
+        Adjacency[Offsets[Vertex] + Remaining[Vertex]++] = Index / 3;
+    }
+
+    TArray<int32> CachePosition;
+    CachePosition.Init(INDEX_NONE, NumVertices);
+    auto ScoreVertex = [&](int32 Vertex)
+    {
+        if (Remaining[Vertex] == 0)
+        {
+            return -1.0f;
+        }
+
+        float Score = 0.0f;
+        const int32 Position = CachePosition[Vertex];
+        if (Position >= 0)
+        {
+            // The last triangle's vertices get a fixed score so it is not simply repeated
+            Score = Position < 3 ? 0.75f : FMath::Pow(1.0f - float(Position - 3) / (CacheSize - 3), 1.5f);
+        }
+        return Score + 2.0f * FMath::InvSqrt(float(Remaining[Vertex]));
+    };
+
+    TArray<float> VertexScores;
+    VertexScores.SetNumUninitialized(NumVertices);
+    for (int32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+    {
+        VertexScores[Vertex] = ScoreVertex(Vertex);
+    }
+
+    TArray<float> TriangleScores;
+    TriangleScores.SetNumUninitialized(NumTriangles);
+    for (int32 Triangle = 0; Triangle < NumTriangles; ++Triangle)
+    {
+        TriangleScores[Triangle] = VertexScores[Indices[Triangle * 3]] + VertexScores[Indices[Triangle * 3 + 1]] + VertexScores[Indices[Triangle * 3 + 2]];
+    }
+
+    TArray<bool> Emitted;
+    Emitted.Init(false, NumTriangles);
+    TArray<int32> Output;
+    Output.Reserve(Indices.Num());
+    TArray<int32> Cache;
+    TArray<int32> NewCache;
+    int32 Best = INDEX_NONE;
+
+    for (int32 Step = 0; Step < NumTriangles; ++Step)
+    {
+        // Nothing left around the cache, start over from the best triangle anywhere
+        if (Best == INDEX_NONE)
+        {
+            float BestScore = -MAX_flt;
+            for (int32 Triangle = 0; Triangle < NumTriangles; ++Triangle)
+            {
+                if (!Emitted[Triangle] && TriangleScores[Triangle] > BestScore)
+                {
+                    BestScore = TriangleScores[Triangle];
+                    Best = Triangle;
+                }
+            }
+        }
+
+        Emitted[Best] = true;
+        NewCache.Reset();
+        for (int32 Corner = 0; Corner < 3; ++Corner)
+        {
+            const int32 Vertex = Indices[Best * 3 + Corner];
+            Output.Add(Vertex);
+            NewCache.Add(Vertex);
+
+            int32* Triangles = &Adjacency[Offsets[Vertex]];
+            for (int32 Slot = 0; Slot < Remaining[Vertex]; ++Slot)
+            {
+                if (Triangles[Slot] == Best)
+                {
+                    Swap(Triangles[Slot], Triangles[Remaining[Vertex] - 1]);
+                    Remaining[Vertex]--;
+                    break;
+                }
+            }
+        }
+
+        for (int32 Vertex : Cache)
+        {
+            if (!NewCache.Contains(Vertex))
+            {
+                NewCache.Add(Vertex);
+            }
+        }
+
+        // Vertices pushed past the end are evicted, they are rescored like the rest
+        for (int32 Position = 0; Position < NewCache.Num(); ++Position)
+        {
+            CachePosition[NewCache[Position]] = Position < CacheSize ? Position : INDEX_NONE;
+        }
+        for (int32 Vertex : NewCache)
+        {
+            VertexScores[Vertex] = ScoreVertex(Vertex);
+        }
+
+        Best = INDEX_NONE;
+        float BestScore = -MAX_flt;
+        for (int32 Vertex : NewCache)
+        {
+            for (int32 Slot = 0; Slot < Remaining[Vertex]; ++Slot)
+            {
+                const int32 Triangle = Adjacency[Offsets[Vertex] + Slot];
+                TriangleScores[Triangle] = VertexScores[Indices[Triangle * 3]] + VertexScores[Indices[Triangle * 3 + 1]] + VertexScores[Indices[Triangle * 3 + 2]];
+                if (TriangleScores[Triangle] > BestScore)
+                {
+                    BestScore = TriangleScores[Triangle];
+                    Best = Triangle;
+                }
+            }
+        }
+
+        NewCache.SetNum(FMath::Min(NewCache.Num(), CacheSize), false);
+        Swap(Cache, NewCache);
+    }
+
+    Indices = MoveTemp(Output);
+}
+
+float ComputeTerrainIndexACMR(TConstArrayView<int32> Indices, int32 CacheSize)
+{
+    // FIFO cache, as most post-transform caches behave
+    TArray<int32> Cache;
+    int32 Misses = 0;
+    for (int32 Vertex : Indices)
+    {
+        if (!Cache.Contains(Vertex))
+        {
+            Misses++;
+            Cache.Add(Vertex);
+            if (Cache.Num() > CacheSize)
+            {
+                Cache.RemoveAt(0, 1, false);
+            }
+        }
+    }
+    return Indices.Num() >= 3 ? float(Misses) / (Indices.Num() / 3) : 0.0f;
+}
+
+const FTerrainPatchLayout& GetTerrainPatchLayout(int32 Resolution)
+{
+    static FCriticalSection Mutex;
+    static TMap<int32, TUniquePtr<FTerrainPatchLayout>> Layouts;
+
+    FScopeLock Lock(&Mutex);
+    if (const TUniquePtr<FTerrainPatchLayout>* Existing = Layouts.Find(Resolution))
+    {
+        return **Existing;
+    }
+
+    TUniquePtr<FTerrainPatchLayout> Layout = MakeUnique<FTerrainPatchLayout>();
+    Layout->Resolution = Resolution;
+    const int32 GridSize = Resolution + 1;
+    const int32 NumVertices = GridSize * GridSize;
+
+    // Z-order over the grid, the gaps of a size that is not a power of two are simply skipped
+    Layout->VertexToGrid.SetNumUninitialized(NumVertices);
+    for (int32 Index = 0; Index < NumVertices; ++Index)
+    {
+        Layout->VertexToGrid[Index] = Index;
+    }
+    auto GetMortonCode = [GridSize](int32 GridIndex)
+    {
+        return FMath::MortonCode2(uint32(GridIndex % GridSize)) | (FMath::MortonCode2(uint32(GridIndex / GridSize)) << 1);
+    };
+    Layout->VertexToGrid.Sort([&GetMortonCode](int32 A, int32 B) { return GetMortonCode(A) < GetMortonCode(B); });
+
+    Layout->GridToVertex.SetNumUninitialized(NumVertices);
+    for (int32 Index = 0; Index < NumVertices; ++Index)
+    {
+        Layout->GridToVertex[Layout->VertexToGrid[Index]] = Index;
+    }
+
+    for (int32 Stitch = 0; Stitch < int32(UE_ARRAY_COUNT(Layout->Indices)); ++Stitch)
+    {
+        TArray<int32>& Indices = Layout->Indices[Stitch];
+        BuildTerrainGridIndices(Resolution, ETerrainStitch(Stitch), Indices);
+        for (int32& Index : Indices)
+        {
+            Index = Layout->GridToVertex[Index];
+        }
+        OptimizeTerrainIndexOrder(Indices, NumVertices);
+    }
+
+    return *Layouts.Add(Resolution, MoveTemp(Layout));
+}
+
+void BuildTerrainPatchIndices(int32 Resolution, ETerrainStitch Stitch, TArray<int32>& OutIndices)
+{
+    OutIndices = GetTerrainPatchLayout(Resolution).Indices[uint8(Stitch)];
+}
+
+void BuildTerrainRowMajorPatchIndices(int32 Resolution, ETerrainStitch Stitch, TArray<int32>& OutIndices)
+{
+    BuildTerrainGridIndices(Resolution, Stitch, OutIndices);
+}
+
+void BuildTerrainChunkAttributes(const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk)
+{
+    // Height field z = h(x, y): the tangent along X is (1, 0, dh/dx) and the normal is (-dh/dx, -dh/dy, 1).
+    // Vertex colours pack the normalized height in R and the slope (1 - normal.z) in G.
+    const int32 NumVertices = Chunk.Heights.Num();
+    const double Step = Chunk.Desc.Size / Chunk.Resolution;
+    const double InvUVScale = 1.0 / FMath::Max(Settings.UVScale, KINDA_SMALL_NUMBER);
+
+    // Whole texture repeats are dropped from the chunk origin, far chunks would otherwise lose UV precision.
+    // Chunks keep their own border vertices, so the integer jump between neighbours is invisible.
+    const FVector2D UVOrigin = Chunk.Desc.Position * InvUVScale;
+    const FVector2D UVBase = UVOrigin - FVector2D(FMath::FloorToDouble(UVOrigin.X), FMath::FloorToDouble(UVOrigin.Y));
+    const float HeightToUnit = Settings.Height > 0.0f ? 0.5f / Settings.Height : 0.0f;
+
+    Chunk.UVBase = FVector2f(UVBase);
+    Chunk.UVStep = float(Step * InvUVScale);
+
+    // Attributes follow the height grid, the vertices are in patch layout order
+    const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Chunk.Resolution);
+    auto WriteVertex = [&](int32 Index, float NormalX, float NormalY, float NormalZ, float TangentX, float TangentZ, float Red, float Green)
+    {
+        FTerrainPackedVertex& Vertex = Chunk.Vertices[Layout.GridToVertex[Index]];
+        Vertex.Normal = FPackedNormal(FVector4f(NormalX, NormalY, NormalZ, 1.0f));
+        Vertex.Tangent = FPackedNormal(FVector3f(TangentX, 0.0f, TangentZ));
+        Vertex.Color = FColor(uint8(Red), uint8(Green), 0, 255);
+    };
+
+    const VectorRegister4Float One = VectorOneFloat();
+    const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+    const VectorRegister4Float ByteScale = VectorSetFloat1(255.0f);
+    const VectorRegister4Float HeightScale = VectorSetFloat1(HeightToUnit);
+
+    // Four vertices per iteration, the gradients are deinterleaved into X and Y lanes
+    int32 Index = 0;
+    for (; Index + 4 <= NumVertices; Index += 4)
+    {
+        const VectorRegister4Float Gradient01 = VectorLoad(&Chunk.Gradients[Index].X);
+        const VectorRegister4Float Gradient23 = VectorLoad(&Chunk.Gradients[Index + 2].X);
+        const VectorRegister4Float Dx = VectorShuffle(Gradient01, Gradient23, 0, 2, 0, 2);
+        const VectorRegister4Float Dy = VectorShuffle(Gradient01, Gradient23, 1, 3, 1, 3);
+
+        const VectorRegister4Float NormalZ = VectorReciprocalSqrt(VectorMultiplyAdd(Dx, Dx, VectorMultiplyAdd(Dy, Dy, One)));
+        const VectorRegister4Float NormalX = VectorNegate(VectorMultiply(Dx, NormalZ));
+        const VectorRegister4Float NormalY = VectorNegate(VectorMultiply(Dy, NormalZ));
+        const VectorRegister4Float TangentX = VectorReciprocalSqrt(VectorMultiplyAdd(Dx, Dx, One));
+        const VectorRegister4Float TangentZ = VectorMultiply(Dx, TangentX);
+
+        const VectorRegister4Float Heights = VectorLoad(&Chunk.Heights[Index]);
+        const VectorRegister4Float Red = VectorMultiply(VectorMin(VectorMax(VectorMultiplyAdd(Heights, HeightScale, Half), VectorZeroFloat()), One), ByteScale);
+        const VectorRegister4Float Green = VectorMultiply(VectorSubtract(One, NormalZ), ByteScale);
+
+        alignas(16) float Out[7][4];
+        VectorStoreAligned(NormalX, Out[0]);
+        VectorStoreAligned(NormalY, Out[1]);
+        VectorStoreAligned(NormalZ, Out[2]);
+        VectorStoreAligned(TangentX, Out[3]);
+        VectorStoreAligned(TangentZ, Out[4]);
+        VectorStoreAligned(Red, Out[5]);
+        VectorStoreAligned(Green, Out[6]);
+
+        for (int32 Lane = 0; Lane < 4; ++Lane)
+        {
+            WriteVertex(Index + Lane, Out[0][Lane], Out[1][Lane], Out[2][Lane], Out[3][Lane], Out[4][Lane], Out[5][Lane], Out[6][Lane]);
+        }
+    }
+
+    for (; Index < NumVertices; ++Index)
+    {
+        const FVector2f& Gradient = Chunk.Gradients[Index];
+        const float NormalZ = FMath::InvSqrt(Gradient.X * Gradient.X + Gradient.Y * Gradient.Y + 1.0f);
+        const float TangentX = FMath::InvSqrt(Gradient.X * Gradient.X + 1.0f);
+        const float Red = FMath::Clamp(Chunk.Heights[Index] * HeightToUnit + 0.5f, 0.0f, 1.0f) * 255.0f;
+        WriteVertex(Index, -Gradient.X * NormalZ, -Gradient.Y * NormalZ, NormalZ, TangentX, Gradient.X * TangentX, Red, (1.0f - NormalZ) * 255.0f);
+    }
+}
+
+void FTerrainChunkCache::SetBudget(SIZE_T InBudgetBytes)
+{
+    BudgetBytes = InBudgetBytes;
+    Trim();
+}
+
+void FTerrainChunkCache::Add(const FTerrainChunkCacheKey& Key, FTerrainChunkPtr Chunk, bool bPrefetched)
+{
+    if (FEntry* Existing = Entries.Find(Key))
+    {
+        Remove(Key, *Existing);
+    }
+
+    Recency.AddHead(Key);
+    const SIZE_T Bytes = Chunk->GetAllocatedSize();
+    Entries.Add(Key, {MoveTemp(Chunk), Bytes, bPrefetched, Recency.GetHead()});
+    AllocatedBytes += Bytes;
+    Trim();
+}
+
+FTerrainChunkPtr FTerrainChunkCache::Take(const FTerrainChunkCacheKey& Key, bool* bOutPrefetched)
+{
+    FEntry* Entry = Entries.Find(Key);
+    if (!Entry)
+    {
+        return nullptr;
+    }
+
+    FTerrainChunkPtr Chunk = MoveTemp(Entry->Chunk);
+    if (bOutPrefetched)
+    {
+        *bOutPrefetched = Entry->bPrefetched;
+    }
+    Remove(Key, *Entry);
+    return Chunk;
+}
+
+FTerrainChunkPtr FTerrainChunkCache::Find(const FTerrainChunkCacheKey& Key)
+{
+    FEntry* Entry = Entries.Find(Key);
+    if (!Entry)
+    {
+        return nullptr;
+    }
+
+    Recency.RemoveNode(Entry->Node, false);
+    Recency.AddHead(Entry->Node);
+    return Entry->Chunk;
+}
+
+void FTerrainChunkCache::Empty()
+{
+    Entries.Empty();
+    Recency.Empty();
+    AllocatedBytes = 0;
+}
+
+void FTerrainChunkCache::Remove(const FTerrainChunkCacheKey& Key, FEntry& Entry)
+{
+    AllocatedBytes -= Entry.Bytes;
+    Recency.RemoveNode(Entry.Node);
+    Entries.Remove(Key);
+}
+
+void FTerrainChunkCache::Trim()
+{
+    while (AllocatedBytes > BudgetBytes && Recency.GetTail())
+    {
+        const FTerrainChunkCacheKey Oldest = Recency.GetTail()->GetValue();
+        Remove(Oldest, Entries.FindChecked(Oldest));
+        NumEvicted++;
+    }
+}
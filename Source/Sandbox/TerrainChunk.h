@@ -0,0 +1,225 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/List.h"
+#include "PackedNormal.h"
+
+class FastNoiseLite;
+
+// Lattice address of a quadtree node: its depth and integer cell at that depth
+struct FTerrainChunkKey
+{
+    int32 Depth;
+    FIntPoint Coord;
+
+    FTerrainChunkKey()
+        : Depth(0), Coord(FIntPoint::ZeroValue)
+    {
+    }
+
+    FTerrainChunkKey(int32 InDepth, const FIntPoint& InCoord)
+        : Depth(InDepth), Coord(InCoord)
+    {
+    }
+
+    bool operator==(const FTerrainChunkKey& Other) const
+    {
+        return Depth == Other.Depth && Coord == Other.Coord;
+    }
+
+    friend uint32 GetTypeHash(const FTerrainChunkKey& Key)
+    {
+        return HashCombine(::GetTypeHash(Key.Depth), GetTypeHash(Key.Coord));
+    }
+};
+
+// Everything a worker needs to build one leaf without touching the live tree
+struct FTerrainChunkDesc
+{
+    FTerrainChunkKey Key;
+    FVector2D Position;
+    double Size;
+};
+
+// A point the terrain refines around, such as a camera or a pawn. Weight scales how close it
+// counts as: an observer with weight 2 gets the detail of one at half the distance.
+struct FTerrainObserver
+{
+    FVector Location {FVector::ZeroVector};
+    float Weight {1.0f};
+};
+
+// Everything the generation stages need besides the noise itself
+struct FTerrainGenerationSettings
+{
+    float Height {0.0f};
+
+    // Largest distance of a sample from zero, the noise output bound times Height. Packed vertex heights
+    // spread their 16 bits over it, 0 assumes twice Height.
+    float HeightBound {0.0f};
+
+    // Height samples per chunk edge
+    int32 Resolution {1};
+
+    // World units per texture repeat
+    float UVScale {1000.0f};
+
+    // Later stages can be skipped when only heights are needed, e.g. for heightfield collision on a server
+    bool bBuildMesh {true};
+    bool bBuildAttributes {true};
+};
+
+// Edges of a patch that meet a neighbour one level coarser
+enum class ETerrainStitch : uint8
+{
+    None = 0,
+    NegX = 1 << 0,
+    PosX = 1 << 1,
+    NegY = 1 << 2,
+    PosY = 1 << 3
+};
+ENUM_CLASS_FLAGS(ETerrainStitch);
+
+// Chunk vertex as the generation stages keep it: grid cell and quantized height instead of
+// a position, packed normal and tangent. Positions and UVs follow from the chunk and are
+// only expanded when the merged mesh is built for upload.
+struct FTerrainPackedVertex
+{
+    uint16 X;
+    uint16 Y;
+
+    // Multiple of the chunk's HeightQuantum, the same height quantizes the same in every chunk so borders stay watertight
+    int16 Height;
+    FPackedNormal Normal;
+    FPackedNormal Tangent;
+    FColor Color;
+};
+
+// One leaf patch: a (Resolution + 1)^2 height grid and the mesh built from it
+struct FTerrainChunkData
+{
+    FTerrainChunkDesc Desc;
+    int32 Resolution {0};
+    TArray<float> Heights;
+
+    // Height derivatives along X and Y, analytic or from apron samples around the grid
+    TArray<FVector2f> Gradients;
+
+    // Patch layout order, one per height sample; Heights and Gradients stay in grid order
+    TArray<FTerrainPackedVertex> Vertices;
+    TArray<int32> Triangles;
+    float HeightQuantum {1.0f};
+
+    // Texture coordinate of the first vertex with whole repeats dropped, and the step per grid cell
+    FVector2f UVBase {FVector2f::ZeroVector};
+    float UVStep {0.0f};
+
+    // CPU time spent generating this chunk across all stages
+    uint64 BuildCycles {0};
+
+    int32 GetGridSize() const { return Resolution + 1; }
+    FVector GetOrigin() const { return FVector(Desc.Position, 0.0); }
+
+    // Relative to GetOrigin(), small enough for 32 bits at any distance from the world origin
+    FVector3f GetVertexPosition(const FTerrainPackedVertex& Vertex) const
+    {
+        const float Step = float(Desc.Size / Resolution);
+        return FVector3f(Vertex.X * Step, Vertex.Y * Step, Vertex.Height * HeightQuantum);
+    }
+
+    FVector2f GetVertexUV(const FTerrainPackedVertex& Vertex) const
+    {
+        return UVBase + FVector2f(Vertex.X, Vertex.Y) * UVStep;
+    }
+
+    SIZE_T GetAllocatedSize() const;
+};
+
+using FTerrainChunkPtr = TSharedPtr<const FTerrainChunkData, ESPMode::ThreadSafe>;
+
+// Generation stages, each one only reads what the previous one wrote
+void SampleTerrainChunk(FastNoiseLite& Noise, const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk);
+void BuildTerrainChunkMesh(const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk);
+void BuildTerrainChunkAttributes(const FTerrainGenerationSettings& Settings, FTerrainChunkData& Chunk);
+
+// Vertex order and triangle lists shared by every patch of one resolution. Vertices follow a Morton
+// curve over the grid so neighbours sit close in memory, and each stitch mask's triangles are ordered
+// for the post-transform vertex cache.
+struct FTerrainPatchLayout
+{
+    int32 Resolution {0};
+    TArray<int32> VertexToGrid;
+    TArray<int32> GridToVertex;
+
+    // Indexed by ETerrainStitch, into the layout's vertex order
+    TArray<int32> Indices[16];
+};
+
+// Built once per resolution and kept for the lifetime of the module; safe from any thread
+const FTerrainPatchLayout& GetTerrainPatchLayout(int32 Resolution);
+
+// Triangle list over a (Resolution + 1)^2 patch in layout order, the same for every patch of that size and stitch
+void BuildTerrainPatchIndices(int32 Resolution, ETerrainStitch Stitch, TArray<int32>& OutIndices);
+
+// The unoptimized triangulation, row by row in grid order, kept for comparison
+void BuildTerrainRowMajorPatchIndices(int32 Resolution, ETerrainStitch Stitch, TArray<int32>& OutIndices);
+
+// Average post-transform cache misses per triangle of Indices through a FIFO cache of CacheSize vertices
+float ComputeTerrainIndexACMR(TConstArrayView<int32> Indices, int32 CacheSize);
+
+// Chunk identity across tree rebuilds: lattice node plus a hash of every setting that changes its contents
+struct FTerrainChunkCacheKey
+{
+    FTerrainChunkKey Key;
+    uint32 ConfigHash;
+
+    bool operator==(const FTerrainChunkCacheKey& Other) const
+    {
+        return ConfigHash == Other.ConfigHash && Key == Other.Key;
+    }
+
+    friend uint32 GetTypeHash(const FTerrainChunkCacheKey& CacheKey)
+    {
+        return HashCombine(GetTypeHash(CacheKey.Key), CacheKey.ConfigHash);
+    }
+};
+
+// Least recently used store of generated chunks, bounded by their allocated size
+class FTerrainChunkCache
+{
+public:
+    void SetBudget(SIZE_T InBudgetBytes);
+    void Add(const FTerrainChunkCacheKey& Key, FTerrainChunkPtr Chunk, bool bPrefetched);
+    FTerrainChunkPtr Take(const FTerrainChunkCacheKey& Key, bool* bOutPrefetched = nullptr);
+
+    // Marks the entry as used without removing it
+    FTerrainChunkPtr Find(const FTerrainChunkCacheKey& Key);
+    bool Contains(const FTerrainChunkCacheKey& Key) const { return Entries.Contains(Key); }
+    void Empty();
+
+    int32 Num() const { return Entries.Num(); }
+    SIZE_T GetAllocatedBytes() const { return AllocatedBytes; }
+    int32 GetNumEvicted() const { return NumEvicted; }
+
+private:
+    using FRecencyList = TDoubleLinkedList<FTerrainChunkCacheKey>;
+
+    struct FEntry
+    {
+        FTerrainChunkPtr Chunk;
+        SIZE_T Bytes;
+        bool bPrefetched;
+        FRecencyList::TDoubleLinkedListNode* Node;
+    };
+
+    void Remove(const FTerrainChunkCacheKey& Key, FEntry& Entry);
+    void Trim();
+
+    TMap<FTerrainChunkCacheKey, FEntry> Entries;
+
+    // Most recently used first
+    FRecencyList Recency;
+    SIZE_T BudgetBytes {256 * 1024 * 1024};
+    SIZE_T AllocatedBytes {0};
+    int32 NumEvicted {0};
+};
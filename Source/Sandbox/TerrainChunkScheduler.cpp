@@ -0,0 +1,335 @@
+﻿#include "TerrainChunkScheduler.h"
+#include "QuadTreeStats.h"
+#include "Tasks/Task.h"
+
+DECLARE_CYCLE_STAT(TEXT("Stage: Sample"), STAT_QuadTree_StageSample, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Stage: Mesh"), STAT_QuadTree_StageMesh, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Stage: Attributes"), STAT_QuadTree_StageAttributes, STATGROUP_QuadTree);
+
+void FTerrainChunkScheduler::SetGenerationSettings(const FastNoiseLite& InNoise, const FTerrainGenerationSettings& InSettings)
+{
+    FScopeLock Lock(&Mutex);
+    Noise = MakeShared<FastNoiseLite, ESPMode::ThreadSafe>(InNoise);
+    Settings = InSettings;
+    Settings.Resolution = FMath::Max(Settings.Resolution, 1);
+    Generation++;
+    Pending.Empty();
+    MeshQueue.Empty();
+    AttributesQueue.Empty();
+    Queued.Empty();
+}
+
+void FTerrainChunkScheduler::SetDiskCache(FTerrainDiskCachePtr InDiskCache)
+{
+    FScopeLock Lock(&Mutex);
+    DiskCache = MoveTemp(InDiskCache);
+}
+
+void FTerrainChunkScheduler::SetBakedData(FTerrainBakedDataPtr InBakedData)
+{
+    FScopeLock Lock(&Mutex);
+    BakedData = MoveTemp(InBakedData);
+}
+
+void FTerrainChunkScheduler::SetMaxWorkers(int32 InMaxWorkers)
+{
+    FScopeLock Lock(&Mutex);
+    MaxWorkers = FMath::Max(InMaxWorkers, 1);
+    LaunchWorkers();
+}
+
+void FTerrainChunkScheduler::SetMaxSpeculativeJobs(int32 InMaxSpeculativeJobs)
+{
+    FScopeLock Lock(&Mutex);
+    MaxSpeculativeJobs = FMath::Max(InMaxSpeculativeJobs, 0);
+    TrimSpeculative();
+}
+
+void FTerrainChunkScheduler::SetQueueCapacities(int32 InStageCapacity, int32 InUploadCapacity)
+{
+    FScopeLock Lock(&Mutex);
+    StageQueueCapacity = FMath::Max(InStageCapacity, 1);
+    UploadQueueCapacity = FMath::Max(InUploadCapacity, 1);
+    LaunchWorkers();
+}
+
+void FTerrainChunkScheduler::Enqueue(const FTerrainChunkDesc& Desc, bool bSpeculative)
+{
+    FScopeLock Lock(&Mutex);
+
+    if (bool* bQueuedSpeculative = Queued.Find(Desc.Key))
+    {
+        if (*bQueuedSpeculative && !bSpeculative)
+        {
+            *bQueuedSpeculative = false;
+            FJob* Job = Pending.FindByPredicate([&Desc](const FJob& Candidate) { return Candidate.Desc.Key == Desc.Key; });
+            if (Job)
+            {
+                Job->bSpeculative = false;
+                Pending.Heapify();
+            }
+        }
+        return;
+    }
+
+    Queued.Add(Desc.Key, bSpeculative);
+    Pending.HeapPush({Desc, ComputePriority(Desc), bSpeculative});
+    LaunchWorkers();
+}
+
+void FTerrainChunkScheduler::Reprioritize(TConstArrayView<FTerrainObserver> InObservers, const TSet<FTerrainChunkKey>& Demanded)
+{
+    FScopeLock Lock(&Mutex);
+
+    Observers = InObservers;
+    for (FJob& Job : Pending)
+    {
+        Job.bSpeculative = !Demanded.Contains(Job.Desc.Key);
+        Job.Priority = ComputePriority(Job.Desc);
+        Queued.Add(Job.Desc.Key, Job.bSpeculative);
+    }
+    Pending.Heapify();
+    TrimSpeculative();
+}
+
+void FTerrainChunkScheduler::CancelSpeculative()
+{
+    FScopeLock Lock(&Mutex);
+
+    const int32 NumRemoved = Pending.RemoveAll([this](const FJob& Job)
+    {
+        if (Job.bSpeculative)
+        {
+            Queued.Remove(Job.Desc.Key);
+            return true;
+        }
+        return false;
+    });
+
+    if (NumRemoved > 0)
+    {
+        Pending.Heapify();
+    }
+}
+
+bool FTerrainChunkScheduler::IsQueued(const FTerrainChunkKey& Key) const
+{
+    FScopeLock Lock(&Mutex);
+    return Queued.Contains(Key);
+}
+
+bool FTerrainChunkScheduler::Dequeue(FTerrainChunkResult& OutResult)
+{
+    while (Completed.Dequeue(OutResult))
+    {
+        // Stale results were counted when they were queued, so they free room in the upload queue as well
+        FScopeLock Lock(&Mutex);
+        NumAwaitingUpload--;
+        LaunchWorkers();
+        if (OutResult.Generation == Generation)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+FTerrainPipelineDepths FTerrainChunkScheduler::GetQueueDepths() const
+{
+    FScopeLock Lock(&Mutex);
+
+    FTerrainPipelineDepths Depths;
+    Depths.Sample = Pending.Num();
+    Depths.Mesh = MeshQueue.Num();
+    Depths.Attributes = AttributesQueue.Num();
+    Depths.Upload = NumAwaitingUpload;
+    return Depths;
+}
+
+int32 FTerrainChunkScheduler::GetNumWorkers() const
+{
+    FScopeLock Lock(&Mutex);
+    return NumWorkers;
+}
+
+float FTerrainChunkScheduler::ComputePriority(const FTerrainChunkDesc& Desc) const
+{
+    const FVector2D Center = Desc.Position + FVector2D(Desc.Size / 2.0, Desc.Size / 2.0);
+    if (Observers.Num() == 0)
+    {
+        return float(Desc.Size / FMath::Max(Center.Size(), 1.0));
+    }
+
+    float Priority = 0.0f;
+    for (const FTerrainObserver& Observer : Observers)
+    {
+        Priority = FMath::Max(Priority, float(Desc.Size * Observer.Weight / FMath::Max(FVector2D::Distance(Center, FVector2D(Observer.Location)), 1.0)));
+    }
+    return Priority;
+}
+
+void FTerrainChunkScheduler::TrimSpeculative()
+{
+    int32 NumSpeculative = 0;
+    for (const FJob& Job : Pending)
+    {
+        NumSpeculative += Job.bSpeculative ? 1 : 0;
+    }
+
+    if (NumSpeculative <= MaxSpeculativeJobs)
+    {
+        return;
+    }
+
+    // Sorted order is also a valid heap, the least useful speculative jobs end up last
+    Pending.Sort();
+    const int32 NumToDrop = NumSpeculative - MaxSpeculativeJobs;
+    for (int32 Index = Pending.Num() - NumToDrop; Index < Pending.Num(); ++Index)
+    {
+        Queued.Remove(Pending[Index].Desc.Key);
+    }
+    Pending.RemoveAt(Pending.Num() - NumToDrop, NumToDrop, false);
+}
+
+int32 FTerrainChunkScheduler::GetNumRunnable() const
+{
+    const bool bCanSample = MeshQueue.Num() < StageQueueCapacity && NumAwaitingUpload < UploadQueueCapacity;
+    return AttributesQueue.Num() + (AttributesQueue.Num() < StageQueueCapacity ? MeshQueue.Num() : 0) + (bCanSample ? Pending.Num() : 0);
+}
+
+bool FTerrainChunkScheduler::PopWork(EStage& OutStage, FChunkInFlight& OutChunk)
+{
+    // Drain the later stages first, new samples only start when there is room for them downstream
+    if (AttributesQueue.Num() > 0)
+    {
+        OutStage = EStage::Attributes;
+        OutChunk = AttributesQueue[0];
+        AttributesQueue.RemoveAt(0, 1, false);
+        return true;
+    }
+
+    if (MeshQueue.Num() > 0 && AttributesQueue.Num() < StageQueueCapacity)
+    {
+        OutStage = EStage::Mesh;
+        OutChunk = MeshQueue[0];
+        MeshQueue.RemoveAt(0, 1, false);
+        return true;
+    }
+
+    if (Pending.Num() > 0 && MeshQueue.Num() < StageQueueCapacity && NumAwaitingUpload < UploadQueueCapacity)
+    {
+        FJob Job;
+        Pending.HeapPop(Job, false);
+        OutStage = EStage::Sample;
+        OutChunk = MakeShared<FTerrainChunkData, ESPMode::ThreadSafe>();
+        OutChunk->Desc = Job.Desc;
+        return true;
+    }
+
+    return false;
+}
+
+void FTerrainChunkScheduler::LaunchWorkers()
+{
+    // Each worker drains the shared queues, the task system spreads and steals them across cores
+    while (NumWorkers < MaxWorkers && NumWorkers < GetNumRunnable())
+    {
+        NumWorkers++;
+        UE::Tasks::Launch(UE_SOURCE_LOCATION, [Self = AsShared()]()
+        {
+            Self->WorkerLoop();
+        });
+    }
+}
+
+void FTerrainChunkScheduler::WorkerLoop()
+{
+    for (;;)
+    {
+        EStage Stage;
+        FChunkInFlight Chunk;
+        TSharedPtr<FastNoiseLite, ESPMode::ThreadSafe> JobNoise;
+        FTerrainGenerationSettings JobSettings;
+        FTerrainDiskCachePtr JobDiskCache;
+        FTerrainBakedDataPtr JobBakedData;
+        int32 JobGeneration;
+        {
+            FScopeLock Lock(&Mutex);
+            if (NumWorkers > MaxWorkers || !PopWork(Stage, Chunk))
+            {
+                NumWorkers--;
+                return;
+            }
+            JobNoise = Noise;
+            JobSettings = Settings;
+            JobDiskCache = DiskCache;
+            JobBakedData = BakedData;
+            JobGeneration = Generation;
+        }
+
+        const uint64 StartCycles = FPlatformTime::Cycles64();
+        switch (Stage)
+        {
+            case EStage::Sample:
+            {
+                SCOPE_CYCLE_COUNTER(STAT_QuadTree_StageSample);
+                if (JobBakedData && JobBakedData->SampleChunk(JobSettings, *Chunk))
+                {
+                    break;
+                }
+                if (JobDiskCache && JobDiskCache->Load(Chunk->Desc.Key, JobSettings.bBuildAttributes, *Chunk))
+                {
+                    break;
+                }
+                FastNoiseLite LocalNoise = *JobNoise;
+                SampleTerrainChunk(LocalNoise, JobSettings, *Chunk);
+                if (JobDiskCache)
+                {
+                    JobDiskCache->Store(*Chunk);
+                }
+                break;
+            }
+            case EStage::Mesh:
+            {
+                SCOPE_CYCLE_COUNTER(STAT_QuadTree_StageMesh);
+                BuildTerrainChunkMesh(JobSettings, *Chunk);
+                break;
+            }
+            case EStage::Attributes:
+            {
+                SCOPE_CYCLE_COUNTER(STAT_QuadTree_StageAttributes);
+                BuildTerrainChunkAttributes(JobSettings, *Chunk);
+                break;
+            }
+        }
+        Chunk->BuildCycles += FPlatformTime::Cycles64() - StartCycles;
+
+        // Skipped stages hand the chunk straight to the upload queue
+        const bool bFinished = Stage == EStage::Attributes
+            || (Stage == EStage::Mesh && !JobSettings.bBuildAttributes)
+            || (Stage == EStage::Sample && !JobSettings.bBuildMesh);
+
+        FScopeLock Lock(&Mutex);
+        if (JobGeneration != Generation)
+        {
+            continue;
+        }
+
+        if (bFinished)
+        {
+            const FTerrainChunkKey Key = Chunk->Desc.Key;
+            Completed.Enqueue({Key, MoveTemp(Chunk), JobGeneration});
+            NumAwaitingUpload++;
+            Queued.Remove(Key);
+        }
+        else if (Stage == EStage::Sample)
+        {
+            MeshQueue.Add(MoveTemp(Chunk));
+        }
+        else
+        {
+            AttributesQueue.Add(MoveTemp(Chunk));
+        }
+        LaunchWorkers();
+    }
+}
@@ -0,0 +1,116 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "FastNoiseLite.h"
+#include "TerrainChunk.h"
+#include "TerrainBakedData.h"
+#include "TerrainDiskCache.h"
+
+struct FTerrainChunkResult
+{
+    FTerrainChunkKey Key;
+    FTerrainChunkPtr Chunk;
+    int32 Generation {0};
+};
+
+struct FTerrainPipelineDepths
+{
+    int32 Sample {0};
+    int32 Mesh {0};
+    int32 Attributes {0};
+    int32 Upload {0};
+};
+
+// Chunk generation pipeline served by UE::Tasks workers.
+//
+// Sample -> Mesh -> Attributes run on workers, connected by bounded queues so the stages
+// of different chunks overlap; results then wait for the game thread (upload). Workers
+// always prefer the furthest stage that has room downstream, so a full upload queue
+// stops new sampling instead of piling up finished chunks. Chunks leave early when the
+// generation settings turn the later stages off.
+//
+// Sampling is fed from a priority queue. Demanded chunks always run before speculative
+// ones, and within each class the chunk with the largest projected error (size over
+// distance to the nearest weighted observer) goes first.
+class FTerrainChunkScheduler : public TSharedFromThis<FTerrainChunkScheduler, ESPMode::ThreadSafe>
+{
+public:
+    // Replaces the generation settings and drops every queued job, results still in flight are discarded
+    void SetGenerationSettings(const FastNoiseLite& InNoise, const FTerrainGenerationSettings& InSettings);
+
+    // Sampling loads from the disk cache first and stores what it had to evaluate, none turns it off
+    void SetDiskCache(FTerrainDiskCachePtr InDiskCache);
+
+    // Chunks inside the baked area are sampled from it before the disk cache or the noise, none turns it off
+    void SetBakedData(FTerrainBakedDataPtr InBakedData);
+    void SetMaxWorkers(int32 InMaxWorkers);
+    void SetMaxSpeculativeJobs(int32 InMaxSpeculativeJobs);
+    void SetQueueCapacities(int32 InStageCapacity, int32 InUploadCapacity);
+
+    // Queues a chunk, or promotes it if it was only queued speculatively
+    void Enqueue(const FTerrainChunkDesc& Desc, bool bSpeculative);
+
+    // Recomputes priorities for new observer positions, in terrain space. Queued chunks that
+    // are no longer demanded become speculative instead of being dropped.
+    void Reprioritize(TConstArrayView<FTerrainObserver> InObservers, const TSet<FTerrainChunkKey>& Demanded);
+    void CancelSpeculative();
+
+    bool IsQueued(const FTerrainChunkKey& Key) const;
+    bool Dequeue(FTerrainChunkResult& OutResult);
+
+    FTerrainPipelineDepths GetQueueDepths() const;
+    int32 GetNumWorkers() const;
+
+private:
+    enum class EStage : uint8
+    {
+        Sample,
+        Mesh,
+        Attributes
+    };
+
+    struct FJob
+    {
+        FTerrainChunkDesc Desc;
+        float Priority;
+        bool bSpeculative;
+
+        // Heap top is the job that has to run first
+        bool operator<(const FJob& Other) const
+        {
+            return bSpeculative != Other.bSpeculative ? !bSpeculative : Priority > Other.Priority;
+        }
+    };
+
+    using FChunkInFlight = TSharedPtr<FTerrainChunkData, ESPMode::ThreadSafe>;
+
+    float ComputePriority(const FTerrainChunkDesc& Desc) const;
+    void TrimSpeculative();
+    int32 GetNumRunnable() const;
+    bool PopWork(EStage& OutStage, FChunkInFlight& OutChunk);
+    void LaunchWorkers();
+    void WorkerLoop();
+
+    mutable FCriticalSection Mutex;
+    TArray<FJob> Pending;
+    TArray<FChunkInFlight> MeshQueue;
+    TArray<FChunkInFlight> AttributesQueue;
+    int32 NumAwaitingUpload {0};
+    int32 StageQueueCapacity {16};
+    int32 UploadQueueCapacity {256};
+
+    // Keys anywhere in the pipeline, mapped to whether they are only speculative
+    TMap<FTerrainChunkKey, bool> Queued;
+    TSharedPtr<FastNoiseLite, ESPMode::ThreadSafe> Noise;
+    FTerrainGenerationSettings Settings;
+    FTerrainDiskCachePtr DiskCache;
+    FTerrainBakedDataPtr BakedData;
+    int32 Generation {0};
+    TArray<FTerrainObserver> Observers;
+    int32 MaxWorkers {4};
+    int32 NumWorkers {0};
+    int32 MaxSpeculativeJobs {256};
+
+    TQueue<FTerrainChunkResult, EQueueMode::Mpsc> Completed;
+};
@@ -0,0 +1,117 @@
+﻿#include "TerrainCollisionComponent.h"
+#include "Chaos/HeightField.h"
+#include "Chaos/ParticleHandle.h"
+#include "Engine/Engine.h"
+#include "Physics/Experimental/PhysScene_Chaos.h"
+#include "Physics/PhysicsFiltering.h"
+#include "Physics/PhysicsInterfaceCore.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "QuadTreeStats.h"
+
+DECLARE_CYCLE_STAT(TEXT("Collision: Build Heightfield"), STAT_QuadTree_BuildHeightfield, STATGROUP_QuadTree);
+
+UTerrainHeightfieldCollisionComponent::UTerrainHeightfieldCollisionComponent()
+{
+    SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+    SetGenerateOverlapEvents(false);
+    SetHiddenInGame(true);
+    SetVisibility(false);
+    Mobility = EComponentMobility::Static;
+}
+
+void UTerrainHeightfieldCollisionComponent::SetChunk(const FTerrainChunkData& Chunk)
+{
+    Heights = Chunk.Heights;
+    GridSize = Chunk.GetGridSize();
+    Step = float(Chunk.Desc.Size / Chunk.Resolution);
+
+    MinHeight = MAX_flt;
+    MaxHeight = -MAX_flt;
+    for (float Height : Heights)
+    {
+        MinHeight = FMath::Min(MinHeight, Height);
+        MaxHeight = FMath::Max(MaxHeight, Height);
+    }
+}
+
+SIZE_T UTerrainHeightfieldCollisionComponent::GetHeightfieldMemory() const
+{
+    return sizeof(Chaos::FHeightField) + Heights.Num() * sizeof(uint16);
+}
+
+FBoxSphereBounds UTerrainHeightfieldCollisionComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+    const float Size = Step * FMath::Max(GridSize - 1, 0);
+    return FBoxSphereBounds(FBox(FVector(0.0f, 0.0f, MinHeight), FVector(Size, Size, MaxHeight)).TransformBy(LocalToWorld));
+}
+
+bool UTerrainHeightfieldCollisionComponent::ShouldCreatePhysicsState() const
+{
+    return GridSize > 1 && Super::ShouldCreatePhysicsState();
+}
+
+void UTerrainHeightfieldCollisionComponent::OnCreatePhysicsState()
+{
+    // Skip UPrimitiveComponent, there is no body setup to instantiate
+    USceneComponent::OnCreatePhysicsState();
+
+    FPhysScene* PhysScene = GetWorld()->GetPhysicsScene();
+    if (!PhysScene || BodyInstance.IsValidBodyInstance())
+    {
+        return;
+    }
+
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_BuildHeightfield);
+
+    // Rows run along Y and columns along X, the same layout as the chunk grid
+    TArray<Chaos::FReal> Samples;
+    Samples.Reserve(Heights.Num());
+    for (float Height : Heights)
+    {
+        Samples.Add(Height);
+    }
+    TArray<uint8> MaterialIndices {0};
+
+    const FVector Scale = GetComponentTransform().GetScale3D();
+    TUniquePtr<Chaos::FHeightField> Heightfield = MakeUnique<Chaos::FHeightField>(MoveTemp(Samples), MoveTemp(MaterialIndices), GridSize, GridSize, Chaos::FVec3(Step * Scale.X, Step * Scale.Y, Scale.Z));
+
+    FActorCreationParams Params;
+    Params.InitialTM = FTransform(GetComponentQuat(), GetComponentLocation());
+    Params.bQueryOnly = false;
+    Params.bStatic = true;
+    Params.Scene = PhysScene;
+
+    FPhysicsActorHandle PhysHandle;
+    FPhysicsInterface::CreateActor(Params, PhysHandle);
+    Chaos::FRigidBodyHandle_External& Body_External = PhysHandle->GetGameThreadAPI();
+
+    FCollisionFilterData QueryFilterData, SimFilterData;
+    CreateShapeFilterData(static_cast<uint8>(GetCollisionObjectType()), FMaskFilter(0), GetOwner()->GetUniqueID(), GetCollisionResponseToChannels(),
+        GetUniqueID(), 0, QueryFilterData, SimFilterData, false, false, true);
+    QueryFilterData.Word3 |= EPDF_SimpleCollision | EPDF_ComplexCollision;
+    SimFilterData.Word3 |= EPDF_SimpleCollision | EPDF_ComplexCollision;
+
+    TUniquePtr<Chaos::FPerShapeData> Shape = Chaos::FPerShapeData::CreatePerShapeData(0, MakeSerializable(Heightfield));
+    Shape->SetQueryData(QueryFilterData);
+    Shape->SetSimData(SimFilterData);
+    Shape->SetCollisionTraceType(EChaosCollisionTraceFlag::Chaos_CTF_UseSimpleAsComplex);
+    Shape->SetMaterials({GEngine->DefaultPhysMaterial->GetPhysicsMaterial()});
+
+    // The particle owns the geometry from here on
+    Chaos::FShapesArray ShapeArray;
+    ShapeArray.Emplace(MoveTemp(Shape));
+    Body_External.SetGeometry(TUniquePtr<Chaos::FImplicitObject>(MoveTemp(Heightfield)));
+    Body_External.MergeShapesArray(MoveTemp(ShapeArray));
+
+    BodyInstance.PhysicsUserData = FPhysicsUserData(&BodyInstance);
+    BodyInstance.OwnerComponent = this;
+    BodyInstance.ActorHandle = PhysHandle;
+    Body_External.SetUserData(&BodyInstance.PhysicsUserData);
+
+    TArray<FPhysicsActorHandle> Actors {PhysHandle};
+    FPhysicsCommand::ExecuteWrite(PhysScene, [&]()
+    {
+        PhysScene->AddActorsToScene_AssumesLocked(Actors, true);
+    });
+    PhysScene->AddToComponentMaps(this, PhysHandle);
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/PrimitiveComponent.h"
+#include "TerrainChunk.h"
+
+#include "TerrainCollisionComponent.generated.h"
+
+// Static collision for one terrain chunk: a Chaos heightfield built straight from the chunk's
+// height samples, so there is no cooking step. Modelled on ULandscapeHeightfieldCollisionComponent.
+UCLASS()
+class SANDBOX_API UTerrainHeightfieldCollisionComponent : public UPrimitiveComponent
+{
+    GENERATED_BODY()
+
+public:
+    UTerrainHeightfieldCollisionComponent();
+
+    // Copies the height samples, call before the component is registered
+    void SetChunk(const FTerrainChunkData& Chunk);
+
+    // Approximate size of the heightfield geometry, Chaos quantizes every sample to 16 bits
+    SIZE_T GetHeightfieldMemory() const;
+
+    virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+    virtual bool ShouldCreatePhysicsState() const override;
+
+protected:
+    virtual void OnCreatePhysicsState() override;
+
+private:
+    TArray<float> Heights;
+    int32 GridSize {0};
+    float Step {0.0f};
+    float MinHeight {0.0f};
+    float MaxHeight {0.0f};
+};
@@ -0,0 +1,386 @@
+﻿#include "TerrainDiskCache.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "QuadTreeStats.h"
+#include "TerrainHeightCodec.h"
+
+static constexpr uint32 DiskCacheMagic = 0x43485454; // "TTHC"
+static constexpr uint32 DiskCacheVersion = 2;
+
+// Segments are merged into one once there are more than this
+static constexpr int32 MaxSegments = 8;
+
+// Marks when a configuration was last opened, its age decides which one goes first
+static const TCHAR* LastUsedFile = TEXT("LastUsed");
+
+// Leads every segment, followed by NumEntries entry headers and then the tile data
+struct FDiskCacheHeader
+{
+    uint32 Magic;
+    uint32 Version;
+    uint64 ConfigHash;
+    int32 Resolution;
+    int32 NumEntries;
+};
+
+struct FDiskCacheEntryHeader
+{
+    int32 Depth;
+    int32 X;
+    int32 Y;
+    uint32 bHasGradients;
+    uint64 Offset;
+    uint64 Size;
+};
+
+// Deletes the least recently opened configurations under Root, other than Keep, until the rest fit MaxBytes
+static void TrimDiskCacheRoot(const FString& Root, const FString& Keep, int64 MaxBytes)
+{
+    IFileManager& FileManager = IFileManager::Get();
+
+    // Segments of the flat layout, from before every configuration had its own directory
+    TArray<FString> Stale;
+    FileManager.FindFiles(Stale, *(Root / TEXT("*.tiles")), true, false);
+    for (const FString& File : Stale)
+    {
+        FileManager.Delete(*(Root / File), false, true, true);
+    }
+
+    struct FConfiguration
+    {
+        FString Path;
+        int64 Bytes {0};
+        FDateTime LastUsed {FDateTime::MinValue()};
+    };
+    TArray<FString> Names;
+    FileManager.FindFiles(Names, *(Root / TEXT("*")), false, true);
+    TArray<FConfiguration> Configurations;
+    int64 TotalBytes = 0;
+    for (const FString& Name : Names)
+    {
+        FConfiguration& Configuration = Configurations.AddDefaulted_GetRef();
+        Configuration.Path = Root / Name;
+        TArray<FString> Files;
+        FileManager.FindFilesRecursive(Files, *Configuration.Path, TEXT("*"), true, false);
+        for (const FString& File : Files)
+        {
+            Configuration.Bytes += FMath::Max<int64>(FileManager.FileSize(*File), 0);
+            Configuration.LastUsed = FMath::Max(Configuration.LastUsed, FileManager.GetTimeStamp(*File));
+        }
+        TotalBytes += Configuration.Bytes;
+    }
+
+    Configurations.Sort([](const FConfiguration& A, const FConfiguration& B) { return A.LastUsed < B.LastUsed; });
+    for (const FConfiguration& Configuration : Configurations)
+    {
+        if (TotalBytes <= MaxBytes)
+        {
+            break;
+        }
+        if (FPaths::IsSamePath(Configuration.Path, Keep))
+        {
+            continue;
+        }
+        if (FileManager.DeleteDirectory(*Configuration.Path, false, true))
+        {
+            TotalBytes -= Configuration.Bytes;
+        }
+    }
+}
+
+FTerrainDiskCache::FTerrainDiskCache(const FString& InRootDirectory, uint64 InConfigHash, int32 InResolution, int64 InMaxBytes)
+    : Directory(InRootDirectory / FString::Printf(TEXT("%016llx"), InConfigHash)), ConfigHash(InConfigHash), Resolution(FMath::Max(InResolution, 1))
+{
+    IFileManager& FileManager = IFileManager::Get();
+    FileManager.MakeDirectory(*Directory, true);
+    FFileHelper::SaveStringToFile(FString(), *(Directory / LastUsedFile));
+    TrimDiskCacheRoot(InRootDirectory, Directory, InMaxBytes);
+
+    TArray<FString> Files;
+    FileManager.FindFiles(Files, *(Directory / TEXT("*.tiles")), true, false);
+    Files.Sort();
+
+    for (const FString& File : Files)
+    {
+        const FString Path = Directory / File;
+        if (!MapSegment(Path))
+        {
+            // A segment that did not survive a crash
+            FileManager.Delete(*Path, false, true, true);
+            continue;
+        }
+        NextSegment = FMath::Max(NextSegment, FCString::Atoi(*File) + 1);
+    }
+
+    if (Segments.Num() > MaxSegments)
+    {
+        CompactSegments();
+    }
+}
+
+FTerrainDiskCache::~FTerrainDiskCache()
+{
+    // Regions have to go before the handles they were mapped from
+    for (FSegment& Segment : Segments)
+    {
+        Segment.Region.Reset();
+        Segment.Handle.Reset();
+    }
+}
+
+FString FTerrainDiskCache::GetSegmentPath(int32 Index) const
+{
+    return Directory / FString::Printf(TEXT("%04d.tiles"), Index);
+}
+
+bool FTerrainDiskCache::MapSegment(const FString& Path)
+{
+    TUniquePtr<IMappedFileHandle> Handle(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+    if (!Handle || Handle->GetFileSize() < int64(sizeof(FDiskCacheHeader)))
+    {
+        return false;
+    }
+    TUniquePtr<IMappedFileRegion> Region(Handle->MapRegion());
+    if (!Region)
+    {
+        return false;
+    }
+
+    const uint8* Data = Region->GetMappedPtr();
+    const int64 Size = Region->GetMappedSize();
+    const FDiskCacheHeader& Header = *reinterpret_cast<const FDiskCacheHeader*>(Data);
+    const int64 TableEnd = sizeof(FDiskCacheHeader) + int64(Header.NumEntries) * sizeof(FDiskCacheEntryHeader);
+    if (Header.Magic != DiskCacheMagic || Header.Version != DiskCacheVersion || Header.ConfigHash != ConfigHash
+        || Header.Resolution != Resolution || Header.NumEntries < 0 || TableEnd > Size)
+    {
+        return false;
+    }
+
+    const FDiskCacheEntryHeader* Table = reinterpret_cast<const FDiskCacheEntryHeader*>(Data + sizeof(FDiskCacheHeader));
+    for (int32 Index = 0; Index < Header.NumEntries; ++Index)
+    {
+        const FDiskCacheEntryHeader& Entry = Table[Index];
+        if (int64(Entry.Offset) < TableEnd || Entry.Size > uint64(MAX_int32) || int64(Entry.Offset + Entry.Size) > Size)
+        {
+            return false;
+        }
+    }
+
+    // Later segments were written later, so their tiles replace older ones
+    for (int32 Index = 0; Index < Header.NumEntries; ++Index)
+    {
+        const FDiskCacheEntryHeader& Entry = Table[Index];
+        Entries.Add(FTerrainChunkKey(Entry.Depth, FIntPoint(Entry.X, Entry.Y)), {Data + Entry.Offset, int32(Entry.Size), Entry.bHasGradients != 0});
+    }
+    Segments.Add({Path, MoveTemp(Handle), MoveTemp(Region)});
+    return true;
+}
+
+void FTerrainDiskCache::CompactSegments()
+{
+    // The merged segment is written while the old ones stay mapped, so loads keep hitting meanwhile.
+    // It is numbered after all of them, so a crash before they are deleted still leaves its tiles winning.
+    TMap<FTerrainChunkKey, FPendingTile> Tiles;
+    {
+        FReadScopeLock ReadLock(Lock);
+        Tiles.Reserve(Entries.Num());
+        for (const TPair<FTerrainChunkKey, FEntry>& Entry : Entries)
+        {
+            FPendingTile& Tile = Tiles.Add(Entry.Key);
+            Tile.Data.Append(Entry.Value.Data, Entry.Value.Size);
+            Tile.bHasGradients = Entry.Value.bHasGradients;
+        }
+    }
+    FString Path;
+    if (!WriteSegment(Tiles, Path))
+    {
+        return;
+    }
+
+    FWriteScopeLock WriteLock(Lock);
+    for (FSegment& Segment : Segments)
+    {
+        Segment.Region.Reset();
+        Segment.Handle.Reset();
+        IFileManager::Get().Delete(*Segment.Path, false, true, true);
+    }
+    Segments.Reset();
+    Entries.Reset();
+    if (!MapSegment(Path))
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Could not map terrain disk cache segment %s"), *Path);
+    }
+}
+
+bool FTerrainDiskCache::Load(const FTerrainChunkKey& Key, bool bNeedGradients, FTerrainChunkData& OutChunk) const
+{
+    FReadScopeLock ReadLock(Lock);
+    const FEntry* Entry = Entries.Find(Key);
+    if (!Entry || (bNeedGradients && !Entry->bHasGradients))
+    {
+        NumMisses++;
+        return false;
+    }
+
+    const int32 GridSize = Resolution + 1;
+    const TConstArrayView<uint8> Data(Entry->Data, Entry->Size);
+    int32 Width = 0;
+    int32 Height = 0;
+    const int32 HeightBytes = DecodeTerrainHeights(Data, OutChunk.Heights, Width, Height);
+    bool bDecoded = HeightBytes > 0 && Width == GridSize && Height == GridSize;
+    if (bDecoded && bNeedGradients)
+    {
+        TArray<float> GradientX;
+        TArray<float> GradientY;
+        const int32 GradientXBytes = DecodeTerrainHeights(Data.RightChop(HeightBytes), GradientX, Width, Height);
+        bDecoded = GradientXBytes > 0 && DecodeTerrainHeights(Data.RightChop(HeightBytes + GradientXBytes), GradientY, Width, Height) > 0
+            && GradientX.Num() == OutChunk.Heights.Num() && GradientY.Num() == OutChunk.Heights.Num();
+        if (bDecoded)
+        {
+            OutChunk.Gradients.SetNumUninitialized(GradientX.Num());
+            for (int32 Index = 0; Index < GradientX.Num(); ++Index)
+            {
+                OutChunk.Gradients[Index] = FVector2f(GradientX[Index], GradientY[Index]);
+            }
+        }
+    }
+    if (!bDecoded)
+    {
+        NumMisses++;
+        return false;
+    }
+
+    OutChunk.Resolution = Resolution;
+    NumHits++;
+    return true;
+}
+
+void FTerrainDiskCache::Store(const FTerrainChunkData& Chunk)
+{
+    const int32 NumSamples = FMath::Square(Resolution + 1);
+    if (Chunk.Resolution != Resolution || Chunk.Heights.Num() != NumSamples)
+    {
+        return;
+    }
+
+    // Gradients go as two separate grids, each component predicts well from its own neighbours
+    const int32 GridSize = Resolution + 1;
+    FPendingTile Tile;
+    Tile.bHasGradients = Chunk.Gradients.Num() == NumSamples;
+    EncodeTerrainHeights(Chunk.Heights, GridSize, GridSize, 0.0f, Tile.Data);
+    if (Tile.bHasGradients)
+    {
+        TArray<float> Component;
+        Component.SetNumUninitialized(NumSamples);
+        for (int32 Axis = 0; Axis < 2; ++Axis)
+        {
+            for (int32 Index = 0; Index < NumSamples; ++Index)
+            {
+                Component[Index] = Chunk.Gradients[Index][Axis];
+            }
+            EncodeTerrainHeights(Component, GridSize, GridSize, 0.0f, Tile.Data);
+        }
+    }
+
+    FWriteScopeLock WriteLock(Lock);
+    if (const FPendingTile* Existing = Pending.Find(Chunk.Desc.Key))
+    {
+        PendingBytes -= Existing->Data.Num();
+    }
+    PendingBytes += Tile.Data.Num();
+    Pending.Add(Chunk.Desc.Key, MoveTemp(Tile));
+}
+
+void FTerrainDiskCache::Flush()
+{
+    TMap<FTerrainChunkKey, FPendingTile> Tiles;
+    {
+        FWriteScopeLock WriteLock(Lock);
+        Tiles = MoveTemp(Pending);
+        Pending.Reset();
+        PendingBytes = 0;
+    }
+    if (Tiles.Num() == 0)
+    {
+        return;
+    }
+
+    FString Path;
+    if (!WriteSegment(Tiles, Path))
+    {
+        return;
+    }
+    bool bCompact = false;
+    {
+        FWriteScopeLock WriteLock(Lock);
+        if (!MapSegment(Path))
+        {
+            UE_LOG(LogQuadTree, Warning, TEXT("Could not map terrain disk cache segment %s"), *Path);
+        }
+        bCompact = Segments.Num() > MaxSegments;
+    }
+
+    // Every flush adds a file and a mapping, a long session merges them instead of piling them up
+    if (bCompact)
+    {
+        CompactSegments();
+    }
+}
+
+bool FTerrainDiskCache::WriteSegment(const TMap<FTerrainChunkKey, FPendingTile>& Tiles, FString& OutPath)
+{
+    FDiskCacheHeader Header {DiskCacheMagic, DiskCacheVersion, ConfigHash, Resolution, Tiles.Num()};
+    TArray<FDiskCacheEntryHeader> Table;
+    Table.Reserve(Tiles.Num());
+    uint64 Offset = sizeof(FDiskCacheHeader) + Tiles.Num() * sizeof(FDiskCacheEntryHeader);
+    for (const TPair<FTerrainChunkKey, FPendingTile>& Tile : Tiles)
+    {
+        Table.Add({Tile.Key.Depth, Tile.Key.Coord.X, Tile.Key.Coord.Y, uint32(Tile.Value.bHasGradients), Offset, uint64(Tile.Value.Data.Num())});
+        Offset += Tile.Value.Data.Num();
+    }
+
+    TArray<uint8> Buffer;
+    Buffer.Reserve(int64(Offset));
+    Buffer.Append(reinterpret_cast<const uint8*>(&Header), sizeof(Header));
+    Buffer.Append(reinterpret_cast<const uint8*>(Table.GetData()), Table.Num() * sizeof(FDiskCacheEntryHeader));
+    for (const TPair<FTerrainChunkKey, FPendingTile>& Tile : Tiles)
+    {
+        Buffer.Append(Tile.Value.Data);
+    }
+
+    // Written under a temporary name first, so a segment that exists is always complete
+    OutPath = GetSegmentPath(NextSegment++);
+    const FString TempPath = OutPath + TEXT(".tmp");
+    if (!FFileHelper::SaveArrayToFile(Buffer, *TempPath) || !IFileManager::Get().Move(*OutPath, *TempPath))
+    {
+        UE_LOG(LogQuadTree, Warning, TEXT("Could not write terrain disk cache segment %s"), *OutPath);
+        return false;
+    }
+    return true;
+}
+
+int32 FTerrainDiskCache::GetNumEntries() const
+{
+    FReadScopeLock ReadLock(Lock);
+    return Entries.Num();
+}
+
+SIZE_T FTerrainDiskCache::GetMappedBytes() const
+{
+    FReadScopeLock ReadLock(Lock);
+    SIZE_T Bytes = 0;
+    for (const FSegment& Segment : Segments)
+    {
+        Bytes += Segment.Region->GetMappedSize();
+    }
+    return Bytes;
+}
+
+SIZE_T FTerrainDiskCache::GetPendingBytes() const
+{
+    FReadScopeLock ReadLock(Lock);
+    return PendingBytes;
+}
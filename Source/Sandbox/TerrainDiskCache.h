@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainChunk.h"
+#include <atomic>
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// Sampled heights of generated chunks kept on disk across sessions, so loading a terrain again maps
+// them instead of evaluating the noise. Tiles are written in segment files that never change once
+// written and are memory mapped read-only; a flush adds one more segment, and past a few segments
+// they are merged into one. Heights and gradients are stored through the lossless mode of the height
+// codec and decoded on load.
+//
+// Each configuration hash has its own subdirectory of the root, so a change to any noise setting, the
+// height or the lattice starts an empty cache while switching back finds the old one again. Opening a
+// cache drops the least recently opened configurations once the root holds more than MaxBytes.
+// Load and Store are safe from any thread.
+class FTerrainDiskCache
+{
+public:
+    FTerrainDiskCache(const FString& InRootDirectory, uint64 InConfigHash, int32 InResolution, int64 InMaxBytes);
+    ~FTerrainDiskCache();
+
+    // Copies the stored heights, and gradients when wanted, out of the mapping. False when the key is
+    // not stored or was stored without the gradients asked for.
+    bool Load(const FTerrainChunkKey& Key, bool bNeedGradients, FTerrainChunkData& OutChunk) const;
+
+    // Queues a freshly sampled chunk for the next Flush
+    void Store(const FTerrainChunkData& Chunk);
+
+    // Writes the queued chunks as a new segment and maps it, then merges the segments if there are too many
+    void Flush();
+
+    uint64 GetConfigHash() const { return ConfigHash; }
+    int32 GetNumEntries() const;
+    SIZE_T GetMappedBytes() const;
+    SIZE_T GetPendingBytes() const;
+    int32 GetNumHits() const { return NumHits; }
+    int32 GetNumMisses() const { return NumMisses; }
+
+private:
+    struct FSegment
+    {
+        FString Path;
+        TUniquePtr<IMappedFileHandle> Handle;
+        TUniquePtr<IMappedFileRegion> Region;
+    };
+
+    struct FEntry
+    {
+        // Encoded heights, then gradients along X and along Y if stored, inside a mapped segment
+        const uint8* Data;
+        int32 Size;
+        bool bHasGradients;
+    };
+
+    struct FPendingTile
+    {
+        TArray<uint8> Data;
+        bool bHasGradients;
+    };
+
+    FString GetSegmentPath(int32 Index) const;
+    bool MapSegment(const FString& Path);
+    bool WriteSegment(const TMap<FTerrainChunkKey, FPendingTile>& Tiles, FString& OutPath);
+    void CompactSegments();
+
+    FString Directory;
+    uint64 ConfigHash;
+    int32 Resolution;
+    int32 NextSegment {0};
+
+    mutable FRWLock Lock;
+    TArray<FSegment> Segments;
+    TMap<FTerrainChunkKey, FEntry> Entries;
+
+    // Serialized tiles waiting for the next flush, keyed so a chunk sampled twice is written once
+    TMap<FTerrainChunkKey, FPendingTile> Pending;
+    SIZE_T PendingBytes {0};
+
+    mutable std::atomic<int32> NumHits {0};
+    mutable std::atomic<int32> NumMisses {0};
+};
+
+using FTerrainDiskCachePtr = TSharedPtr<FTerrainDiskCache, ESPMode::ThreadSafe>;
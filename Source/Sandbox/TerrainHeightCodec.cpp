@@ -0,0 +1,360 @@
+﻿#include "TerrainHeightCodec.h"
+
+static constexpr uint32 HeightCodecMagic = 0x43485448; // "HTHC"
+static constexpr int32 RiceBlockSize = 32;
+
+// Quotients from here on are escaped, and the value follows in full
+static constexpr uint32 RiceEscape = 24;
+
+// Zero bytes after the bit stream, so the reader can always load 64 bits at once
+static constexpr int32 StreamPadding = 8;
+
+struct FHeightCodecHeader
+{
+    uint32 Magic;
+
+    // Whole stream, header and padding included
+    int32 Bytes;
+    int32 Width;
+    int32 Height;
+    int64 QuantizedBase;
+
+    // Zero for bit-exact floats
+    double Step;
+};
+
+// Orders float bit patterns like the floats themselves, so close heights are close as integers too
+static FORCEINLINE uint32 OrderFloatBits(float Value)
+{
+    uint32 Bits;
+    FMemory::Memcpy(&Bits, &Value, sizeof(Bits));
+    return Bits & 0x80000000u ? ~Bits : Bits | 0x80000000u;
+}
+
+static FORCEINLINE float RestoreFloatBits(uint32 Ordered)
+{
+    const uint32 Bits = Ordered & 0x80000000u ? Ordered & 0x7FFFFFFFu : ~Ordered;
+    float Value;
+    FMemory::Memcpy(&Value, &Bits, sizeof(Value));
+    return Value;
+}
+
+// LOCO-I median predictor: takes the edge the upper-left neighbour does not sit on, else the plane through all three
+static FORCEINLINE uint32 PredictSample(uint32 Left, uint32 Up, uint32 UpLeft)
+{
+    const uint32 Low = FMath::Min(Left, Up);
+    const uint32 High = FMath::Max(Left, Up);
+    return UpLeft >= High ? Low : UpLeft <= Low ? High : Left + Up - UpLeft;
+}
+
+static FORCEINLINE uint32 ZigZag(uint32 Residual)
+{
+    return (Residual << 1) ^ uint32(int32(Residual) >> 31);
+}
+
+static FORCEINLINE uint32 UnZigZag(uint32 Value)
+{
+    return (Value >> 1) ^ (0u - (Value & 1u));
+}
+
+// Little endian bit stream, least significant bit first
+class FRiceWriter
+{
+public:
+    explicit FRiceWriter(TArray<uint8>& InOut)
+        : Out(InOut)
+    {
+    }
+
+    // Value has to fit in NumBits, at most 32
+    void Write(uint32 Value, int32 NumBits)
+    {
+        Accumulator |= uint64(Value) << NumPending;
+        NumPending += NumBits;
+        if (NumPending >= 32)
+        {
+            const uint32 Low = uint32(Accumulator);
+            Out.Append(reinterpret_cast<const uint8*>(&Low), sizeof(Low));
+            Accumulator >>= 32;
+            NumPending -= 32;
+        }
+    }
+
+    void WriteBlock(const uint32* Values, int32 Num)
+    {
+        // Parameter around the block mean, the cheapest of it and its neighbours wins
+        uint64 Sum = 0;
+        for (int32 Index = 0; Index < Num; ++Index)
+        {
+            Sum += Values[Index];
+        }
+        const int32 Guess = Sum >= uint64(Num) ? int32(FMath::FloorLog2_64(Sum / Num)) : 0;
+        int32 K = Guess;
+        uint64 BestBits = MAX_uint64;
+        for (int32 Candidate = FMath::Max(Guess - 1, 0); Candidate <= FMath::Min(Guess + 1, 31); ++Candidate)
+        {
+            uint64 Bits = 0;
+            for (int32 Index = 0; Index < Num; ++Index)
+            {
+                const uint32 Quotient = Values[Index] >> Candidate;
+                Bits += Quotient < RiceEscape ? Quotient + 1 + Candidate : RiceEscape + 1 + 32;
+            }
+            if (Bits < BestBits)
+            {
+                BestBits = Bits;
+                K = Candidate;
+            }
+        }
+
+        Write(K, 5);
+        const uint32 Mask = (1u << K) - 1;
+        for (int32 Index = 0; Index < Num; ++Index)
+        {
+            const uint32 Quotient = Values[Index] >> K;
+            if (Quotient < RiceEscape)
+            {
+                Write(1u << Quotient, Quotient + 1);
+                if (K > 0)
+                {
+                    Write(Values[Index] & Mask, K);
+                }
+            }
+            else
+            {
+                Write(1u << RiceEscape, RiceEscape + 1);
+                Write(Values[Index], 32);
+            }
+        }
+    }
+
+    void Flush()
+    {
+        for (; NumPending > 0; NumPending -= 8)
+        {
+            Out.Add(uint8(Accumulator));
+            Accumulator >>= 8;
+        }
+        NumPending = 0;
+    }
+
+private:
+    TArray<uint8>& Out;
+    uint64 Accumulator {0};
+    int32 NumPending {0};
+};
+
+class FRiceReader
+{
+public:
+    FRiceReader(const uint8* InData, int64 InNumBits)
+        : Data(InData), NumBits(InNumBits)
+    {
+    }
+
+    // Decodes the next Num residuals, which may span blocks
+    void ReadResiduals(uint32* Out, int32 Num)
+    {
+        while (Num > 0)
+        {
+            if (LeftInBlock == 0)
+            {
+                K = uint32(Peek<true>()) & 31u;
+                Position += 5;
+                LeftInBlock = RiceBlockSize;
+            }
+            const int32 Count = FMath::Min(Num, LeftInBlock);
+
+            // Bounds are only checked where the worst case could pass the end of the stream
+            if (Position + int64(Count) * (RiceEscape + 1 + 32) <= NumBits)
+            {
+                for (int32 Index = 0; Index < Count; ++Index)
+                {
+                    Out[Index] = UnZigZag(ReadValue<false>());
+                }
+            }
+            else
+            {
+                for (int32 Index = 0; Index < Count; ++Index)
+                {
+                    Out[Index] = UnZigZag(ReadValue<true>());
+                }
+            }
+            Out += Count;
+            Num -= Count;
+            LeftInBlock -= Count;
+        }
+    }
+
+    bool IsOverrun() const { return Position > NumBits; }
+
+private:
+    // Corrupt data only ever reads zeros past the end, which ends as an overrun
+    template <bool bChecked>
+    FORCEINLINE uint64 Peek() const
+    {
+        if (bChecked && Position > NumBits)
+        {
+            return 0;
+        }
+        uint64 Bits;
+        FMemory::Memcpy(&Bits, Data + (Position >> 3), sizeof(Bits));
+        return Bits >> (Position & 7);
+    }
+
+    template <bool bChecked>
+    FORCEINLINE uint32 ReadValue()
+    {
+        // At least 57 bits are loaded, a quotient below the escape and its remainder always fit
+        const uint64 Bits = Peek<bChecked>();
+        const uint32 Quotient = uint32(FMath::CountTrailingZeros64(Bits));
+        if (Quotient < RiceEscape)
+        {
+            Position += Quotient + 1 + K;
+            return (Quotient << K) | uint32((Bits >> (Quotient + 1)) & ((uint64(1) << K) - 1));
+        }
+        Position += RiceEscape + 1;
+        const uint32 Value = uint32(Peek<bChecked>());
+        Position += 32;
+        return Value;
+    }
+
+    const uint8* Data;
+    int64 NumBits;
+    int64 Position {0};
+    uint32 K {0};
+    int32 LeftInBlock {0};
+};
+
+void EncodeTerrainHeights(TConstArrayView<float> Heights, int32 Width, int32 Height, float MaxError, TArray<uint8>& OutData)
+{
+    check(Width > 0 && Height > 0 && Heights.Num() == Width * Height);
+    const int32 Num = Heights.Num();
+
+    float MinHeight = MAX_flt;
+    float MaxHeight = -MAX_flt;
+    for (float Sample : Heights)
+    {
+        MinHeight = FMath::Min(MinHeight, Sample);
+        MaxHeight = FMath::Max(MaxHeight, Sample);
+    }
+
+    double Step = MaxError > 0.0f ? 2.0 * MaxError : 0.0;
+    int64 Base = 0;
+    if (Step > 0.0)
+    {
+        Base = FMath::FloorToInt64(MinHeight / Step);
+
+        // A step too fine for the range to fit 30 bits keeps the heights exact instead
+        if (MaxHeight / Step - double(Base) >= double(1 << 30))
+        {
+            Step = 0.0;
+            Base = 0;
+        }
+    }
+
+    TArray<uint32> Values;
+    Values.SetNumUninitialized(Num);
+    for (int32 Index = 0; Index < Num; ++Index)
+    {
+        Values[Index] = Step > 0.0 ? uint32(FMath::RoundToInt64(Heights[Index] / Step) - Base) : OrderFloatBits(Heights[Index]);
+    }
+
+    // Residuals in the order the decoder rebuilds the samples
+    TArray<uint32> Residuals;
+    Residuals.SetNumUninitialized(Num);
+    for (int32 Y = 0; Y < Height; ++Y)
+    {
+        const uint32* Row = Values.GetData() + Y * Width;
+        const uint32* Above = Row - Width;
+        for (int32 X = 0; X < Width; ++X)
+        {
+            const uint32 Prediction = Y == 0 ? (X == 0 ? 0u : Row[X - 1]) : X == 0 ? Above[0] : PredictSample(Row[X - 1], Above[X], Above[X - 1]);
+            Residuals[Y * Width + X] = ZigZag(Row[X] - Prediction);
+        }
+    }
+
+    const int32 Start = OutData.Num();
+    OutData.AddZeroed(sizeof(FHeightCodecHeader));
+    FRiceWriter Writer(OutData);
+    for (int32 First = 0; First < Num; First += RiceBlockSize)
+    {
+        Writer.WriteBlock(Residuals.GetData() + First, FMath::Min(RiceBlockSize, Num - First));
+    }
+    Writer.Flush();
+    OutData.AddZeroed(StreamPadding);
+
+    const FHeightCodecHeader Header {HeightCodecMagic, OutData.Num() - Start, Width, Height, Base, Step};
+    FMemory::Memcpy(OutData.GetData() + Start, &Header, sizeof(Header));
+}
+
+int32 DecodeTerrainHeights(TConstArrayView<uint8> Data, TArray<float>& OutHeights, int32& OutWidth, int32& OutHeight)
+{
+    FHeightCodecHeader Header;
+    if (Data.Num() < int32(sizeof(Header)))
+    {
+        return 0;
+    }
+    FMemory::Memcpy(&Header, Data.GetData(), sizeof(Header));
+    if (Header.Magic != HeightCodecMagic || Header.Width < 1 || Header.Height < 1 || int64(Header.Width) * Header.Height > MAX_int32
+        || Header.Bytes < int32(sizeof(Header)) + StreamPadding || Header.Bytes > Data.Num())
+    {
+        return 0;
+    }
+
+    const int32 Width = Header.Width;
+    const int32 Height = Header.Height;
+    OutHeights.SetNumUninitialized(Width * Height);
+    FRiceReader Reader(Data.GetData() + sizeof(Header), int64(Header.Bytes - int32(sizeof(Header)) - StreamPadding) * 8);
+
+    // A row of residuals is decoded ahead of the predictor, only it and the row above are kept as integers
+    TArray<uint32> Rows;
+    Rows.SetNumUninitialized(Width * 3);
+    uint32* Residuals = Rows.GetData();
+    uint32* Row = Residuals + Width;
+    uint32* Above = Row + Width;
+    for (int32 Y = 0; Y < Height; ++Y)
+    {
+        Reader.ReadResiduals(Residuals, Width);
+        if (Y == 0)
+        {
+            Row[0] = Residuals[0];
+            for (int32 X = 1; X < Width; ++X)
+            {
+                Row[X] = Row[X - 1] + Residuals[X];
+            }
+        }
+        else
+        {
+            Row[0] = Above[0] + Residuals[0];
+            for (int32 X = 1; X < Width; ++X)
+            {
+                Row[X] = PredictSample(Row[X - 1], Above[X], Above[X - 1]) + Residuals[X];
+            }
+        }
+
+        float* Out = OutHeights.GetData() + Y * Width;
+        if (Header.Step > 0.0)
+        {
+            for (int32 X = 0; X < Width; ++X)
+            {
+                Out[X] = float(double(Header.QuantizedBase + int64(Row[X])) * Header.Step);
+            }
+        }
+        else
+        {
+            for (int32 X = 0; X < Width; ++X)
+            {
+                Out[X] = RestoreFloatBits(Row[X]);
+            }
+        }
+        Swap(Row, Above);
+    }
+
+    if (Reader.IsOverrun())
+    {
+        return 0;
+    }
+    OutWidth = Width;
+    OutHeight = Height;
+    return Header.Bytes;
+}
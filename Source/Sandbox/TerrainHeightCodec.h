@@ -0,0 +1,16 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+// Codec for grids of height samples, as held by the disk cache and the terrain bake.
+//
+// Each sample is predicted from its left, upper and upper-left neighbours with the LOCO-I median
+// predictor, and the residuals are Rice coded in blocks of 32 that each pick their own parameter.
+// MaxError 0 keeps every float bit-exact. Anything above quantizes to multiples of 2 * MaxError counted
+// from zero, so a height decodes to the same value in every tile and mip it appears in.
+//
+// Encoding appends to OutData, so several grids can follow each other in one buffer.
+void EncodeTerrainHeights(TConstArrayView<float> Heights, int32 Width, int32 Height, float MaxError, TArray<uint8>& OutData);
+
+// Decodes the grid at the start of Data. Returns the bytes it took, 0 when the data is not a valid grid.
+int32 DecodeTerrainHeights(TConstArrayView<uint8> Data, TArray<float>& OutHeights, int32& OutWidth, int32& OutHeight);
@@ -0,0 +1,240 @@
+﻿#include "TerrainHeightField.h"
+#include "Async/ParallelFor.h"
+#include "QuadTreeStats.h"
+
+DECLARE_CYCLE_STAT(TEXT("Query: Heights"), STAT_QuadTree_QueryHeights, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Query: Normals"), STAT_QuadTree_QueryNormals, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Query: Raycasts"), STAT_QuadTree_QueryRaycasts, STATGROUP_QuadTree);
+
+// Queries per worker task, small enough to balance and large enough to amortize the noise copy
+static constexpr int32 QueryBatchSize = 256;
+
+static constexpr int32 MaxRaySteps = 256;
+
+// Fixed steps are cheap but many, past this the step grows with the ray instead
+static constexpr int32 MaxFixedRaySteps = 4096;
+
+FTerrainHeightField::FTerrainHeightField(const FastNoiseLite& InNoise, float InHeight, const FVector& InOrigin, float InMaxStep, FTerrainBakedDataPtr InBakedData)
+    : Noise(InNoise), Height(InHeight), Origin(InOrigin), MaxStep(FMath::Max(InMaxStep, 1.0f)), BakedData(MoveTemp(InBakedData))
+{
+    const float GradientBound = Noise.GetGradientBound();
+    Lipschitz = GradientBound >= 0.0f ? GradientBound * FMath::Abs(Height) : -1.0f;
+    HeightBound = Noise.GetOutputBound() * FMath::Abs(Height);
+
+    if (BakedData.IsValid())
+    {
+        // Bilinear between samples of the bounded surface is steeper by at most sqrt(2) along a diagonal,
+        // and the height codec may move two neighbouring samples apart by twice its error
+        const FTerrainBakeHeader& Header = BakedData->GetHeader();
+        if (Lipschitz >= 0.0f)
+        {
+            Lipschitz = Lipschitz * UE_SQRT_2 + 2.0f * Header.MaxHeightError / float(Header.GetSpacing());
+        }
+        HeightBound += Header.MaxHeightError;
+    }
+}
+
+float FTerrainHeightField::GetHeightAt(const FVector2D& Location) const
+{
+    FastNoiseLite LocalNoise = Noise;
+    return SampleHeight(LocalNoise, Location);
+}
+
+FVector FTerrainHeightField::GetNormalAt(const FVector2D& Location) const
+{
+    FastNoiseLite LocalNoise = Noise;
+    return SampleNormal(LocalNoise, Location);
+}
+
+bool FTerrainHeightField::Raycast(const FVector& Start, const FVector& End, FTerrainRayHit& OutHit) const
+{
+    FastNoiseLite LocalNoise = Noise;
+    return TraceRay(LocalNoise, Start, End, OutHit);
+}
+
+void FTerrainHeightField::GetHeightsAt(TConstArrayView<FVector2D> Locations, TArrayView<float> OutHeights) const
+{
+    check(Locations.Num() == OutHeights.Num());
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_QueryHeights);
+
+    const int32 NumBatches = FMath::DivideAndRoundUp(Locations.Num(), QueryBatchSize);
+    ParallelFor(NumBatches, [&](int32 Batch)
+    {
+        FastNoiseLite LocalNoise = Noise;
+        const int32 End = FMath::Min((Batch + 1) * QueryBatchSize, Locations.Num());
+        for (int32 Index = Batch * QueryBatchSize; Index < End; ++Index)
+        {
+            OutHeights[Index] = SampleHeight(LocalNoise, Locations[Index]);
+        }
+    });
+}
+
+void FTerrainHeightField::GetNormalsAt(TConstArrayView<FVector2D> Locations, TArrayView<FVector> OutNormals) const
+{
+    check(Locations.Num() == OutNormals.Num());
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_QueryNormals);
+
+    const int32 NumBatches = FMath::DivideAndRoundUp(Locations.Num(), QueryBatchSize);
+    ParallelFor(NumBatches, [&](int32 Batch)
+    {
+        FastNoiseLite LocalNoise = Noise;
+        const int32 End = FMath::Min((Batch + 1) * QueryBatchSize, Locations.Num());
+        for (int32 Index = Batch * QueryBatchSize; Index < End; ++Index)
+        {
+            OutNormals[Index] = SampleNormal(LocalNoise, Locations[Index]);
+        }
+    });
+}
+
+void FTerrainHeightField::RaycastBatch(TConstArrayView<FVector> Starts, TConstArrayView<FVector> Ends, TArrayView<FTerrainRayHit> OutHits) const
+{
+    check(Starts.Num() == Ends.Num() && Starts.Num() == OutHits.Num());
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_QueryRaycasts);
+
+    // Rays cost far more than points and vary a lot, so they get smaller batches
+    const int32 RayBatchSize = QueryBatchSize / 16;
+    const int32 NumBatches = FMath::DivideAndRoundUp(Starts.Num(), RayBatchSize);
+    ParallelFor(NumBatches, [&](int32 Batch)
+    {
+        FastNoiseLite LocalNoise = Noise;
+        const int32 End = FMath::Min((Batch + 1) * RayBatchSize, Starts.Num());
+        for (int32 Index = Batch * RayBatchSize; Index < End; ++Index)
+        {
+            TraceRay(LocalNoise, Starts[Index], Ends[Index], OutHits[Index]);
+        }
+    });
+}
+
+float FTerrainHeightField::SampleHeight(FastNoiseLite& LocalNoise, const FVector2D& Location) const
+{
+    // Inside the bake the answer matches the chunks and collision built from it
+    const FVector2D Local = Location - FVector2D(Origin);
+    float Baked;
+    if (BakedData.IsValid() && BakedData->SampleAt(Local, Baked))
+    {
+        return Origin.Z + Baked;
+    }
+    return Origin.Z + LocalNoise.GetNoise(Local.X, Local.Y) * Height;
+}
+
+FVector FTerrainHeightField::SampleNormal(FastNoiseLite& LocalNoise, const FVector2D& Location) const
+{
+    const FVector2D Local = Location - FVector2D(Origin);
+    float Baked;
+    FVector2f Gradient;
+    if (BakedData.IsValid() && BakedData->SampleAt(Local, Baked, &Gradient))
+    {
+        return FVector(-Gradient.X, -Gradient.Y, 1.0f).GetSafeNormal();
+    }
+    float Dx, Dy;
+    LocalNoise.GetNoiseWithGradient(Local.X, Local.Y, Dx, Dy);
+    return FVector(-Dx * Height, -Dy * Height, 1.0f).GetSafeNormal();
+}
+
+bool FTerrainHeightField::TraceRay(FastNoiseLite& LocalNoise, const FVector& Start, const FVector& End, FTerrainRayHit& OutHit) const
+{
+    OutHit = FTerrainRayHit();
+
+    const FVector Delta = End - Start;
+    const float Length = Delta.Size();
+    if (Length <= UE_KINDA_SMALL_NUMBER)
+    {
+        return false;
+    }
+    const FVector Direction = Delta / Length;
+    const float Tolerance = FMath::Max(Length * 1.0e-5f, 0.1f);
+
+    // Nothing above the highest the surface can reach is worth sampling
+    const float Top = Origin.Z + HeightBound;
+    float Distance = 0.0f;
+    if (Start.Z > Top)
+    {
+        if (Direction.Z >= 0.0f)
+        {
+            return false;
+        }
+        Distance = (Start.Z - Top) / -Direction.Z;
+        if (Distance >= Length)
+        {
+            return false;
+        }
+    }
+
+    // With |grad h| <= L the surface is at least (z - h) / sqrt(1 + L^2) away from any point above it,
+    // so stepping by that much does not pass through it. Without a bound the march falls back to fixed steps.
+    bool bSphereTrace = Lipschitz >= 0.0f;
+    const float StepScale = bSphereTrace ? 1.0f / FMath::Sqrt(1.0f + FMath::Square(Lipschitz)) : 0.0f;
+    float FixedStep = FMath::Max(MaxStep, (Length - Distance) / MaxFixedRaySteps);
+    int32 StepsLeft = bSphereTrace ? MaxRaySteps : MaxFixedRaySteps + 1;
+
+    const FVector First = Start + Direction * Distance;
+    float Previous = Distance;
+    float Gap = First.Z - SampleHeight(LocalNoise, FVector2D(First));
+    if (Gap < 0.0f)
+    {
+        // Starting underground counts as a hit at the start, like an initial overlap
+        OutHit.bHit = true;
+        OutHit.Distance = Distance;
+        OutHit.Location = First;
+        OutHit.Normal = SampleNormal(LocalNoise, FVector2D(First));
+        return true;
+    }
+
+    for (OutHit.NumSteps = 1; ; ++OutHit.NumSteps)
+    {
+        if (Gap < Tolerance && bSphereTrace)
+        {
+            break;
+        }
+
+        // A long ray grazing the surface makes sphere tracing crawl, the rest of it is marched in fixed steps.
+        // Those cover whatever length is left, so a ray never ends short of End without an answer.
+        if (--StepsLeft < 0)
+        {
+            if (!bSphereTrace)
+            {
+                break;
+            }
+            bSphereTrace = false;
+            FixedStep = FMath::Max(MaxStep, (Length - Distance) / MaxFixedRaySteps);
+            StepsLeft = MaxFixedRaySteps;
+        }
+
+        Previous = Distance;
+        Distance = FMath::Min(Distance + (bSphereTrace ? FMath::Max(Gap * StepScale, Tolerance) : FixedStep), Length);
+        const FVector Point = Start + Direction * Distance;
+        Gap = Point.Z - SampleHeight(LocalNoise, FVector2D(Point));
+
+        if (Gap < 0.0f)
+        {
+            // The minimum step overshot, the crossing lies between the last two samples
+            float Above = Previous;
+            float Below = Distance;
+            while (Below - Above > Tolerance)
+            {
+                const float Middle = (Above + Below) * 0.5f;
+                const FVector MiddlePoint = Start + Direction * Middle;
+                (MiddlePoint.Z - SampleHeight(LocalNoise, FVector2D(MiddlePoint)) < 0.0f ? Below : Above) = Middle;
+            }
+            Distance = Below;
+            Gap = 0.0f;
+            break;
+        }
+
+        if (Distance >= Length)
+        {
+            return false;
+        }
+    }
+
+    if (Gap >= Tolerance)
+    {
+        return false;
+    }
+
+    OutHit.bHit = true;
+    OutHit.Distance = Distance;
+    OutHit.Location = Start + Direction * Distance;
+    OutHit.Normal = SampleNormal(LocalNoise, FVector2D(OutHit.Location));
+    return true;
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "FastNoiseLite.h"
+#include "TerrainBakedData.h"
+
+struct FTerrainRayHit
+{
+    bool bHit {false};
+    FVector Location {FVector::ZeroVector};
+    FVector Normal {FVector::UpVector};
+
+    // Distance from the ray start
+    float Distance {0.0f};
+    int32 NumSteps {0};
+};
+
+// Immutable view of the terrain surface that evaluates the noise directly, or reads the bake where one
+// covers the point, so it answers for any point whether or not a chunk, mesh or collision body exists there.
+// Safe to use from any thread, every query works on its own copy of the noise.
+class FTerrainHeightField
+{
+public:
+    // Origin is the world location of the terrain's local (0, 0, 0). MaxStep is how far a ray may
+    // march between samples when the noise has no slope bound, such as the finest chunk spacing.
+    // A bake must have been sampled from the same noise and height, the chunks inside it come from it too.
+    FTerrainHeightField(const FastNoiseLite& InNoise, float InHeight, const FVector& InOrigin, float InMaxStep, FTerrainBakedDataPtr InBakedData = nullptr);
+
+    float GetHeightAt(const FVector2D& Location) const;
+    FVector GetNormalAt(const FVector2D& Location) const;
+
+    // Sphere traces the surface between Start and End, then refines the crossing by bisection.
+    // Noise that steps instead of sloping is marched at MaxStep, and features thinner than that can be missed.
+    // Rays that run out of sphere tracing steps finish the same way, so they never end in a miss short of End.
+    bool Raycast(const FVector& Start, const FVector& End, FTerrainRayHit& OutHit) const;
+
+    // Batched versions, split across worker threads. Output views must match the input size.
+    void GetHeightsAt(TConstArrayView<FVector2D> Locations, TArrayView<float> OutHeights) const;
+    void GetNormalsAt(TConstArrayView<FVector2D> Locations, TArrayView<FVector> OutNormals) const;
+    void RaycastBatch(TConstArrayView<FVector> Starts, TConstArrayView<FVector> Ends, TArrayView<FTerrainRayHit> OutHits) const;
+
+    // Upper bound on the surface slope that ray marching relies on, negative when the noise has none
+    float GetLipschitz() const { return Lipschitz; }
+
+private:
+    float SampleHeight(FastNoiseLite& LocalNoise, const FVector2D& Location) const;
+    FVector SampleNormal(FastNoiseLite& LocalNoise, const FVector2D& Location) const;
+    bool TraceRay(FastNoiseLite& LocalNoise, const FVector& Start, const FVector& End, FTerrainRayHit& OutHit) const;
+
+    FastNoiseLite Noise;
+    float Height;
+    FVector Origin;
+    float MaxStep;
+    FTerrainBakedDataPtr BakedData;
+    float Lipschitz;
+
+    // Largest distance of the surface from Origin.Z
+    float HeightBound;
+};
+
+using FTerrainHeightFieldPtr = TSharedPtr<const FTerrainHeightField, ESPMode::ThreadSafe>;
@@ -0,0 +1,101 @@
+﻿#include "TerrainLinearQuadTree.h"
+
+// Edge neighbours in ETerrainStitch bit order
+static const FIntPoint EdgeDirections[] = {FIntPoint(-1, 0), FIntPoint(1, 0), FIntPoint(0, -1), FIntPoint(0, 1)};
+
+void FTerrainLinearQuadTree::Reset()
+{
+    Leaves.Reset();
+    MinLevel = MAX_int32;
+}
+
+void FTerrainLinearQuadTree::Add(const FTerrainNodeCode& Leaf)
+{
+    Leaves.Add(Leaf);
+    MinLevel = FMath::Min(MinLevel, Leaf.Level);
+}
+
+void FTerrainLinearQuadTree::Remove(const FTerrainNodeCode& Leaf)
+{
+    Leaves.Remove(Leaf);
+}
+
+bool FTerrainLinearQuadTree::FindCoveringLeaf(const FTerrainNodeCode& Code, FTerrainNodeCode& OutLeaf) const
+{
+    for (int32 Level = Code.Level; Level >= MinLevel; --Level)
+    {
+        const FTerrainNodeCode Ancestor = Code.GetAncestor(Level);
+        if (Leaves.Contains(Ancestor))
+        {
+            OutLeaf = Ancestor;
+            return true;
+        }
+    }
+    return false;
+}
+
+ETerrainStitch FTerrainLinearQuadTree::GetCoarserEdges(const FTerrainNodeCode& Leaf) const
+{
+    ETerrainStitch Edges = ETerrainStitch::None;
+    if (Leaf.Level <= MinLevel)
+    {
+        return Edges;
+    }
+
+    FTerrainNodeCode Coarser;
+    for (int32 Edge = 0; Edge < int32(UE_ARRAY_COUNT(EdgeDirections)); ++Edge)
+    {
+        const FTerrainNodeCode Neighbour = Leaf.GetNeighbour(EdgeDirections[Edge].X, EdgeDirections[Edge].Y);
+        if (FindCoveringLeaf(Neighbour.GetParent(), Coarser))
+        {
+            Edges |= ETerrainStitch(1 << Edge);
+        }
+    }
+    return Edges;
+}
+
+int32 FTerrainLinearQuadTree::Balance(TFunctionRef<bool(const FTerrainNodeCode&)> TrySplit)
+{
+    TArray<FTerrainNodeCode> Pending = Leaves.Array();
+    TSet<FTerrainNodeCode> Refused;
+    int32 NumSplit = 0;
+
+    while (Pending.Num() > 0)
+    {
+        const FTerrainNodeCode Leaf = Pending.Pop(false);
+        if (Leaf.Level - 2 < MinLevel || !Leaves.Contains(Leaf))
+        {
+            continue;
+        }
+
+        // Anything one level coarser is fine, so the probe starts two levels up
+        for (const FIntPoint& Direction : EdgeDirections)
+        {
+            const FTerrainNodeCode Neighbour = Leaf.GetNeighbour(Direction.X, Direction.Y);
+            FTerrainNodeCode Coarse;
+            if (!FindCoveringLeaf(Neighbour.GetAncestor(Leaf.Level - 2), Coarse) || Refused.Contains(Coarse))
+            {
+                continue;
+            }
+
+            if (!TrySplit(Coarse))
+            {
+                Refused.Add(Coarse);
+                continue;
+            }
+
+            Leaves.Remove(Coarse);
+            for (int32 Index = 0; Index < 4; ++Index)
+            {
+                Leaves.Add(Coarse.GetChild(Index));
+                Pending.Add(Coarse.GetChild(Index));
+            }
+            NumSplit++;
+
+            // The child next to Leaf may still be too coarse, look again
+            Pending.Add(Leaf);
+            break;
+        }
+    }
+    return NumSplit;
+}
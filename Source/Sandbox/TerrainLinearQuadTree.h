@@ -0,0 +1,141 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainChunk.h"
+
+// A node of the terrain lattice as its level and the Morton interleave of its global coordinates,
+// X in the even bits. Coordinates stay two's complement, so negative tiles and neighbours across root
+// tiles need no special case. Parent, child and neighbour codes are a handful of bit operations.
+struct FTerrainNodeCode
+{
+    static constexpr uint64 XMask = 0x5555555555555555ull;
+    static constexpr uint64 YMask = 0xAAAAAAAAAAAAAAAAull;
+
+    uint64 Morton {0};
+    int32 Level {0};
+
+    FTerrainNodeCode() = default;
+
+    FTerrainNodeCode(int32 InLevel, uint64 InMorton)
+        : Morton(InMorton), Level(InLevel)
+    {
+    }
+
+    explicit FTerrainNodeCode(const FTerrainChunkKey& Key)
+        : Morton(Dilate(uint32(Key.Coord.X)) | (Dilate(uint32(Key.Coord.Y)) << 1)), Level(Key.Depth)
+    {
+    }
+
+    FTerrainChunkKey ToKey() const
+    {
+        return FTerrainChunkKey(Level, FIntPoint(int32(Compact(Morton)), int32(Compact(Morton >> 1))));
+    }
+
+    FTerrainNodeCode GetParent() const
+    {
+        return GetAncestor(Level - 1);
+    }
+
+    // Shifts both coordinates right, filling the vacated high bits with each one's sign like >> on int32
+    FTerrainNodeCode GetAncestor(int32 AncestorLevel) const
+    {
+        const int32 Shift = 2 * (Level - AncestorLevel);
+        const uint64 High = Shift > 0 ? ~(~0ull >> Shift) : 0;
+        const uint64 SignFill = ((Morton >> 62) & 1 ? XMask : 0) | ((Morton >> 63) & 1 ? YMask : 0);
+        return FTerrainNodeCode(AncestorLevel, (Morton >> Shift) | (High & SignFill));
+    }
+
+    // Index in the same order as FQuadTreeNode::Subdivide, X in bit 0 and Y in bit 1
+    FTerrainNodeCode GetChild(int32 Index) const
+    {
+        return FTerrainNodeCode(Level + 1, (Morton << 2) | uint64(Index));
+    }
+
+    // Same level, one step along X and Y. Adding in dilated form carries through the other axis' bits.
+    FTerrainNodeCode GetNeighbour(int32 DeltaX, int32 DeltaY) const
+    {
+        uint64 X = Morton & XMask;
+        uint64 Y = Morton & YMask;
+        if (DeltaX > 0)
+        {
+            X = ((X | YMask) + 1) & XMask;
+        }
+        else if (DeltaX < 0)
+        {
+            X = (X - 1) & XMask;
+        }
+        if (DeltaY > 0)
+        {
+            Y = ((Y | XMask) + 2) & YMask;
+        }
+        else if (DeltaY < 0)
+        {
+            Y = (Y - 2) & YMask;
+        }
+        return FTerrainNodeCode(Level, X | Y);
+    }
+
+    bool operator==(const FTerrainNodeCode& Other) const
+    {
+        return Morton == Other.Morton && Level == Other.Level;
+    }
+
+    friend uint32 GetTypeHash(const FTerrainNodeCode& Code)
+    {
+        return HashCombine(::GetTypeHash(Code.Morton), ::GetTypeHash(Code.Level));
+    }
+
+    // Spreads the 32 bits of Value over the even bits of the result
+    static uint64 Dilate(uint32 Value)
+    {
+        uint64 Result = Value;
+        Result = (Result | (Result << 16)) & 0x0000FFFF0000FFFFull;
+        Result = (Result | (Result << 8)) & 0x00FF00FF00FF00FFull;
+        Result = (Result | (Result << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        Result = (Result | (Result << 2)) & 0x3333333333333333ull;
+        Result = (Result | (Result << 1)) & 0x5555555555555555ull;
+        return Result;
+    }
+
+    static uint32 Compact(uint64 Value)
+    {
+        Value &= 0x5555555555555555ull;
+        Value = (Value | (Value >> 1)) & 0x3333333333333333ull;
+        Value = (Value | (Value >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+        Value = (Value | (Value >> 4)) & 0x00FF00FF00FF00FFull;
+        Value = (Value | (Value >> 8)) & 0x0000FFFF0000FFFFull;
+        Value = (Value | (Value >> 16)) & 0x00000000FFFFFFFFull;
+        return uint32(Value);
+    }
+};
+
+// The leaves of a quadtree as a hash of node codes, without parent, child or neighbour links.
+// A query computes the code it wants and probes for it and its ancestors, never descending from a root.
+class FTerrainLinearQuadTree
+{
+public:
+    void Reset();
+    void Add(const FTerrainNodeCode& Leaf);
+    void Remove(const FTerrainNodeCode& Leaf);
+    bool Contains(const FTerrainNodeCode& Leaf) const { return Leaves.Contains(Leaf); }
+    int32 Num() const { return Leaves.Num(); }
+
+    // The leaf at Code or the nearest ancestor of it, false where the area is split finer or empty
+    bool FindCoveringLeaf(const FTerrainNodeCode& Code, FTerrainNodeCode& OutLeaf) const;
+
+    // Edges of Leaf whose neighbour is a coarser leaf
+    ETerrainStitch GetCoarserEdges(const FTerrainNodeCode& Leaf) const;
+
+    // Splits leaves until edge neighbours are at most one level apart, so every seam can be stitched.
+    // TrySplit is asked before each split and may refuse it; the leaf then stays as it is.
+    // Returns the number of leaves split.
+    int32 Balance(TFunctionRef<bool(const FTerrainNodeCode&)> TrySplit);
+
+    TArray<FTerrainNodeCode> GetLeaves() const { return Leaves.Array(); }
+
+private:
+    TSet<FTerrainNodeCode> Leaves;
+
+    // No leaf is above this level, so probes stop there
+    int32 MinLevel {MAX_int32};
+};
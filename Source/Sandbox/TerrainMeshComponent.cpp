@@ -0,0 +1,756 @@
+﻿#include "TerrainMeshComponent.h"
+#include "Engine/Engine.h"
+#include "LocalVertexFactory.h"
+#include "MaterialDomain.h"
+#include "MaterialShared.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialRenderProxy.h"
+#include "PrimitiveSceneProxy.h"
+#include "PrimitiveViewRelevance.h"
+#include "QuadTreeStats.h"
+#include "SceneManagement.h"
+#include "Algo/BinarySearch.h"
+
+DECLARE_CYCLE_STAT(TEXT("Terrain Mesh: Update Slots"), STAT_QuadTree_UpdateSlots, STATGROUP_QuadTree);
+DECLARE_CYCLE_STAT(TEXT("Terrain Mesh: Collect Draws"), STAT_QuadTree_CollectDraws, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Terrain Mesh Draws"), STAT_QuadTree_MeshDraws, STATGROUP_QuadTree);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Terrain Mesh Batches"), STAT_QuadTree_MeshBatches, STATGROUP_QuadTree);
+
+// What a render command needs to fill one slot with a chunk's vertices
+struct FTerrainMeshSlotUpdate
+{
+    int32 Index {INDEX_NONE};
+    FTerrainChunkPtr Chunk;
+
+    // Chunk origin relative to the component
+    FVector3f Offset {FVector3f::ZeroVector};
+};
+
+// The slots one batch draws and how each is stitched, no members removes the batch
+struct FTerrainMeshBatchUpdate
+{
+    FTerrainChunkKey Key;
+    TArray<TPair<int32, ETerrainStitch>> Members;
+
+    // Relative to the component
+    FBox3f Bounds {ForceInit};
+};
+
+// One vertex attribute for every slot, rewritten a slot at a time
+class FTerrainVertexStream : public FVertexBuffer
+{
+public:
+    FTerrainVertexStream(uint32 InStride, uint32 InElementStride, EPixelFormat InElementFormat)
+        : Stride(InStride), ElementStride(InElementStride), ElementFormat(InElementFormat)
+    {
+    }
+
+    virtual void InitRHI(FRHICommandListBase& RHICmdList) override
+    {
+        FRHIResourceCreateInfo CreateInfo(TEXT("TerrainVertexStream"));
+        VertexBufferRHI = RHICmdList.CreateVertexBuffer(FMath::Max(NumVertices * Stride, Stride), BUF_Dynamic | BUF_ShaderResource, CreateInfo);
+        SRV = RHICreateShaderResourceView(VertexBufferRHI, ElementStride, ElementFormat);
+    }
+
+    virtual void ReleaseRHI() override
+    {
+        SRV.SafeRelease();
+        FVertexBuffer::ReleaseRHI();
+    }
+
+    void* Lock(FRHICommandListImmediate& RHICmdList, int32 FirstVertex, int32 Count)
+    {
+        return RHICmdList.LockBuffer(VertexBufferRHI, FirstVertex * Stride, Count * Stride, RLM_WriteOnly);
+    }
+
+    uint32 Stride;
+    uint32 ElementStride;
+    EPixelFormat ElementFormat;
+    uint32 NumVertices {0};
+    FShaderResourceViewRHIRef SRV;
+};
+
+// Triangles of every patch in one batch, relative to the batch's first slot
+class FTerrainBatchIndexBuffer : public FIndexBuffer
+{
+public:
+    FTerrainBatchIndexBuffer(int32 InResolution, int32 InFirstSlot, int32 InNumVertices, TArray<TPair<int32, ETerrainStitch>> InMembers)
+        : Resolution(InResolution), FirstSlot(InFirstSlot), NumVertices(InNumVertices), Members(MoveTemp(InMembers))
+    {
+        const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Resolution);
+        for (const TPair<int32, ETerrainStitch>& Member : Members)
+        {
+            NumIndices += Layout.Indices[uint8(Member.Value)].Num();
+        }
+    }
+
+    virtual void InitRHI(FRHICommandListBase& RHICmdList) override
+    {
+        // Only when the slots between the first and last member fit, slots are handed out near each
+        // other but a batch can still end up spread over the buffers
+        if (NumVertices <= MAX_uint16 + 1)
+        {
+            CreateBuffer<uint16>(RHICmdList);
+        }
+        else
+        {
+            CreateBuffer<uint32>(RHICmdList);
+        }
+        Members.Empty();
+    }
+
+    int32 NumIndices {0};
+
+private:
+    template <typename IndexType>
+    void CreateBuffer(FRHICommandListBase& RHICmdList)
+    {
+        const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Resolution);
+        const int32 SlotVertices = FMath::Square(Resolution + 1);
+
+        TResourceArray<IndexType, INDEXBUFFER_ALIGNMENT> Data;
+        Data.Reserve(NumIndices);
+        for (const TPair<int32, ETerrainStitch>& Member : Members)
+        {
+            const int32 BaseVertex = (Member.Key - FirstSlot) * SlotVertices;
+            for (int32 Index : Layout.Indices[uint8(Member.Value)])
+            {
+                Data.Add(IndexType(BaseVertex + Index));
+            }
+        }
+
+        FRHIResourceCreateInfo CreateInfo(TEXT("TerrainBatchIndexBuffer"), &Data);
+        IndexBufferRHI = RHICmdList.CreateIndexBuffer(sizeof(IndexType), Data.GetResourceDataSize(), BUF_Static, CreateInfo);
+    }
+
+    int32 Resolution;
+    int32 FirstSlot;
+    int32 NumVertices;
+    TArray<TPair<int32, ETerrainStitch>> Members;
+};
+
+class FTerrainMeshSceneProxy final : public FPrimitiveSceneProxy
+{
+public:
+    FTerrainMeshSceneProxy(const UTerrainMeshComponent* Component)
+        : FPrimitiveSceneProxy(Component)
+        , MaterialRelevance(Component->GetMaterialRelevance(GetScene().GetFeatureLevel()))
+        , VertexFactory(GetScene().GetFeatureLevel(), "FTerrainMeshSceneProxy")
+        , Positions(sizeof(FVector3f), sizeof(float), PF_R32_FLOAT)
+        , Tangents(2 * sizeof(FPackedNormal), sizeof(FPackedNormal), PF_R8G8B8A8_SNORM)
+        , TexCoords(sizeof(FVector2f), sizeof(FVector2f), PF_G32R32F)
+        , Colors(sizeof(FColor), sizeof(FColor), PF_R8G8B8A8)
+        , Resolution(Component->SlotResolution)
+        , SlotVertices(FMath::Square(Component->SlotResolution + 1))
+        , SlotCapacity(Component->SlotCapacity)
+    {
+        Material = Component->GetMaterial(0);
+        if (!Material)
+        {
+            Material = UMaterial::GetDefaultMaterial(MD_Surface);
+        }
+
+        TArray<FTerrainMeshSlotUpdate> InitialSlots;
+        InitialSlots.Reserve(Component->Slots.Num());
+        for (const TPair<FTerrainChunkKey, UTerrainMeshComponent::FSlot>& Slot : Component->Slots)
+        {
+            InitialSlots.Add(Component->MakeSlotUpdate(Slot.Value));
+        }
+
+        TArray<FTerrainMeshBatchUpdate> InitialBatches;
+        InitialBatches.Reserve(Component->Batches.Num());
+        for (const TPair<FTerrainChunkKey, UTerrainMeshComponent::FBatch>& Batch : Component->Batches)
+        {
+            InitialBatches.Add(Component->MakeBatchUpdate(Batch.Key, Batch.Value));
+        }
+
+        ENQUEUE_RENDER_COMMAND(InitTerrainMesh)([this, InitialSlots = MoveTemp(InitialSlots), InitialBatches = MoveTemp(InitialBatches)](FRHICommandListImmediate& RHICmdList)
+        {
+            InitResources(RHICmdList, SlotCapacity);
+            Update_RenderThread(RHICmdList, InitialSlots, InitialBatches);
+        });
+    }
+
+    virtual ~FTerrainMeshSceneProxy() override
+    {
+        VertexFactory.ReleaseResource();
+        Positions.ReleaseResource();
+        Tangents.ReleaseResource();
+        TexCoords.ReleaseResource();
+        Colors.ReleaseResource();
+        for (TPair<FTerrainChunkKey, FBatchDraw>& Batch : Batches)
+        {
+            if (Batch.Value.OwnedIndexBuffer)
+            {
+                Batch.Value.OwnedIndexBuffer->ReleaseResource();
+            }
+        }
+        for (TPair<ETerrainStitch, TUniquePtr<FTerrainBatchIndexBuffer>>& IndexBuffer : PatchIndexBuffers)
+        {
+            IndexBuffer.Value->ReleaseResource();
+        }
+    }
+
+    void Update_RenderThread(FRHICommandListImmediate& RHICmdList, TConstArrayView<FTerrainMeshSlotUpdate> SlotUpdates, TConstArrayView<FTerrainMeshBatchUpdate> BatchUpdates)
+    {
+        SCOPE_CYCLE_COUNTER(STAT_QuadTree_UpdateSlots);
+
+        for (const FTerrainMeshSlotUpdate& Update : SlotUpdates)
+        {
+            WriteSlot(RHICmdList, Update);
+        }
+
+        // Batches only get new indices, the vertices of their slots are written above when they change
+        for (const FTerrainMeshBatchUpdate& Update : BatchUpdates)
+        {
+            if (FBatchDraw* Existing = Batches.Find(Update.Key))
+            {
+                if (Existing->OwnedIndexBuffer)
+                {
+                    Existing->OwnedIndexBuffer->ReleaseResource();
+                    Existing->OwnedIndexBuffer.Reset();
+                }
+                if (Update.Members.Num() == 0)
+                {
+                    Batches.Remove(Update.Key);
+                    continue;
+                }
+            }
+            else if (Update.Members.Num() == 0)
+            {
+                continue;
+            }
+
+            int32 FirstSlot = MAX_int32;
+            int32 LastSlot = 0;
+            for (const TPair<int32, ETerrainStitch>& Member : Update.Members)
+            {
+                FirstSlot = FMath::Min(FirstSlot, Member.Key);
+                LastSlot = FMath::Max(LastSlot, Member.Key);
+            }
+
+            FBatchDraw& Batch = Batches.FindOrAdd(Update.Key);
+            Batch.BaseVertexIndex = FirstSlot * SlotVertices;
+            Batch.NumVertices = (LastSlot - FirstSlot + 1) * SlotVertices;
+            Batch.Bounds = FBox(Update.Bounds);
+
+            // A lone chunk draws with the shared indices of its stitch, as every slot did before batching
+            if (Update.Members.Num() == 1)
+            {
+                Batch.IndexBuffer = FindOrCreatePatchIndexBuffer(RHICmdList, Update.Members[0].Value);
+                continue;
+            }
+            Batch.OwnedIndexBuffer = MakeUnique<FTerrainBatchIndexBuffer>(Resolution, FirstSlot, Batch.NumVertices, Update.Members);
+            Batch.OwnedIndexBuffer->InitResource(RHICmdList);
+            Batch.IndexBuffer = Batch.OwnedIndexBuffer.Get();
+        }
+        SET_DWORD_STAT(STAT_QuadTree_MeshBatches, Batches.Num());
+    }
+
+    virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override
+    {
+        SCOPE_CYCLE_COUNTER(STAT_QuadTree_CollectDraws);
+
+        const bool bWireframe = AllowDebugViewmodes() && ViewFamily.EngineShowFlags.Wireframe;
+        FMaterialRenderProxy* MaterialProxy = Material->GetRenderProxy();
+        if (bWireframe)
+        {
+            FColoredMaterialRenderProxy* WireframeMaterial = new FColoredMaterialRenderProxy(
+                GEngine->WireframeMaterial ? GEngine->WireframeMaterial->GetRenderProxy() : nullptr,
+                FLinearColor(0.0f, 0.5f, 1.0f));
+            Collector.RegisterOneFrameMaterialProxy(WireframeMaterial);
+            MaterialProxy = WireframeMaterial;
+        }
+
+        int32 NumDraws = 0;
+        for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+        {
+            if (!(VisibilityMap & (1 << ViewIndex)))
+            {
+                continue;
+            }
+
+            const FSceneView* View = Views[ViewIndex];
+            for (const TPair<FTerrainChunkKey, FBatchDraw>& Batch : Batches)
+            {
+                const FBatchDraw& Draw = Batch.Value;
+                if (Draw.IndexBuffer->NumIndices == 0)
+                {
+                    continue;
+                }
+
+                // The whole terrain is one primitive, so batches outside the frustum are dropped here
+                const FBox WorldBounds = Draw.Bounds.TransformBy(GetLocalToWorld());
+                if (!View->ViewFrustum.IntersectBox(WorldBounds.GetCenter(), WorldBounds.GetExtent()))
+                {
+                    continue;
+                }
+
+                FMeshBatch& Mesh = Collector.AllocateMesh();
+                Mesh.VertexFactory = &VertexFactory;
+                Mesh.MaterialRenderProxy = MaterialProxy;
+                Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
+                Mesh.Type = PT_TriangleList;
+                Mesh.DepthPriorityGroup = SDPG_World;
+                Mesh.bCanApplyViewModeOverrides = false;
+                Mesh.bWireframe = bWireframe;
+
+                FMeshBatchElement& Element = Mesh.Elements[0];
+                Element.IndexBuffer = Draw.IndexBuffer;
+                Element.FirstIndex = 0;
+                Element.NumPrimitives = Draw.IndexBuffer->NumIndices / 3;
+                Element.BaseVertexIndex = Draw.BaseVertexIndex;
+                Element.MinVertexIndex = 0;
+                Element.MaxVertexIndex = Draw.NumVertices - 1;
+                Element.PrimitiveUniformBuffer = GetUniformBuffer();
+
+                Collector.AddMesh(ViewIndex, Mesh);
+                NumDraws++;
+            }
+        }
+        SET_DWORD_STAT(STAT_QuadTree_MeshDraws, NumDraws);
+    }
+
+    virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View) const override
+    {
+        FPrimitiveViewRelevance Result;
+        Result.bDrawRelevance = IsShown(View);
+        Result.bShadowRelevance = IsShadowCast(View);
+        Result.bDynamicRelevance = true;
+        Result.bRenderInMainPass = ShouldRenderInMainPass();
+        Result.bUsesLightingChannels = GetLightingChannelMask() != GetDefaultLightingChannelMask();
+        Result.bRenderCustomDepth = ShouldRenderCustomDepth();
+        MaterialRelevance.SetPrimitiveViewRelevance(Result);
+        Result.bVelocityRelevance = DrawsVelocity() && Result.bOpaque && Result.bRenderInMainPass;
+        return Result;
+    }
+
+    virtual bool CanBeOccluded() const override
+    {
+        return !MaterialRelevance.bDisableDepthTest;
+    }
+
+    virtual SIZE_T GetTypeHash() const override
+    {
+        static size_t UniquePointer;
+        return reinterpret_cast<size_t>(&UniquePointer);
+    }
+
+    virtual uint32 GetMemoryFootprint() const override
+    {
+        return sizeof(*this) + GetAllocatedSize();
+    }
+
+    uint32 GetAllocatedSize() const
+    {
+        return FPrimitiveSceneProxy::GetAllocatedSize() + Batches.GetAllocatedSize() + PatchIndexBuffers.GetAllocatedSize();
+    }
+
+private:
+    struct FBatchDraw
+    {
+        // Null when the batch draws with a shared patch buffer
+        TUniquePtr<FTerrainBatchIndexBuffer> OwnedIndexBuffer;
+        const FTerrainBatchIndexBuffer* IndexBuffer {nullptr};
+        uint32 BaseVertexIndex {0};
+        uint32 NumVertices {0};
+        FBox Bounds {ForceInit};
+    };
+
+    void InitResources(FRHICommandListImmediate& RHICmdList, int32 NumSlots)
+    {
+        const uint32 NumVertices = NumSlots * SlotVertices;
+        for (FTerrainVertexStream* Stream : {&Positions, &Tangents, &TexCoords, &Colors})
+        {
+            Stream->NumVertices = NumVertices;
+            Stream->InitResource(RHICmdList);
+        }
+
+        FLocalVertexFactory::FDataType Data;
+        Data.PositionComponent = FVertexStreamComponent(&Positions, 0, Positions.Stride, VET_Float3);
+        Data.PositionComponentSRV = Positions.SRV;
+        Data.TangentBasisComponents[0] = FVertexStreamComponent(&Tangents, 0, Tangents.Stride, VET_PackedNormal);
+        Data.TangentBasisComponents[1] = FVertexStreamComponent(&Tangents, sizeof(FPackedNormal), Tangents.Stride, VET_PackedNormal);
+        Data.TangentsSRV = Tangents.SRV;
+        Data.TextureCoordinates.Add(FVertexStreamComponent(&TexCoords, 0, TexCoords.Stride, VET_Float2));
+        Data.TextureCoordinatesSRV = TexCoords.SRV;
+        Data.NumTexCoords = 1;
+        Data.LightMapCoordinateIndex = 0;
+        Data.ColorComponent = FVertexStreamComponent(&Colors, 0, Colors.Stride, VET_Color);
+        Data.ColorComponentsSRV = Colors.SRV;
+        VertexFactory.SetData(RHICmdList, Data);
+        VertexFactory.InitResource(RHICmdList);
+    }
+
+    const FTerrainBatchIndexBuffer* FindOrCreatePatchIndexBuffer(FRHICommandListImmediate& RHICmdList, ETerrainStitch Stitch)
+    {
+        TUniquePtr<FTerrainBatchIndexBuffer>& IndexBuffer = PatchIndexBuffers.FindOrAdd(Stitch);
+        if (!IndexBuffer)
+        {
+            IndexBuffer = MakeUnique<FTerrainBatchIndexBuffer>(Resolution, 0, SlotVertices, TArray<TPair<int32, ETerrainStitch>>{TPair<int32, ETerrainStitch>(0, Stitch)});
+            IndexBuffer->InitResource(RHICmdList);
+        }
+        return IndexBuffer.Get();
+    }
+
+    // Expands the packed chunk straight into the locked slot, no intermediate copy
+    void WriteSlot(FRHICommandListImmediate& RHICmdList, const FTerrainMeshSlotUpdate& Update)
+    {
+        const FTerrainChunkData& Chunk = *Update.Chunk;
+        const int32 NumVertices = FMath::Min(Chunk.Vertices.Num(), SlotVertices);
+        const int32 FirstVertex = Update.Index * SlotVertices;
+
+        FVector3f* OutPositions = static_cast<FVector3f*>(Positions.Lock(RHICmdList, FirstVertex, NumVertices));
+        FPackedNormal* OutTangents = static_cast<FPackedNormal*>(Tangents.Lock(RHICmdList, FirstVertex, NumVertices));
+        FVector2f* OutTexCoords = static_cast<FVector2f*>(TexCoords.Lock(RHICmdList, FirstVertex, NumVertices));
+        FColor* OutColors = static_cast<FColor*>(Colors.Lock(RHICmdList, FirstVertex, NumVertices));
+
+        for (int32 Index = 0; Index < NumVertices; ++Index)
+        {
+            const FTerrainPackedVertex& Vertex = Chunk.Vertices[Index];
+            OutPositions[Index] = Update.Offset + Chunk.GetVertexPosition(Vertex);
+            OutTangents[Index * 2] = Vertex.Tangent;
+            OutTangents[Index * 2 + 1] = Vertex.Normal;
+            OutTexCoords[Index] = Chunk.GetVertexUV(Vertex);
+            OutColors[Index] = Vertex.Color;
+        }
+
+        for (FTerrainVertexStream* Stream : {&Positions, &Tangents, &TexCoords, &Colors})
+        {
+            RHICmdList.UnlockBuffer(Stream->VertexBufferRHI);
+        }
+    }
+
+    UMaterialInterface* Material;
+    FMaterialRelevance MaterialRelevance;
+    FLocalVertexFactory VertexFactory;
+    FTerrainVertexStream Positions;
+    FTerrainVertexStream Tangents;
+    FTerrainVertexStream TexCoords;
+    FTerrainVertexStream Colors;
+    int32 Resolution;
+    int32 SlotVertices;
+    int32 SlotCapacity;
+
+    // Render thread only
+    TMap<FTerrainChunkKey, FBatchDraw> Batches;
+    TMap<ETerrainStitch, TUniquePtr<FTerrainBatchIndexBuffer>> PatchIndexBuffers;
+};
+
+UTerrainMeshComponent::UTerrainMeshComponent()
+{
+    PrimaryComponentTick.bCanEverTick = false;
+    SetCollisionEnabled(ECollisionEnabled::NoCollision);
+    SetGenerateOverlapEvents(false);
+}
+
+SIZE_T UTerrainMeshComponent::GetGPUVertexBytes()
+{
+    return sizeof(FVector3f) + 2 * sizeof(FPackedNormal) + sizeof(FVector2f) + sizeof(FColor);
+}
+
+void UTerrainMeshComponent::SetBatchVertices(int32 InBatchVertices)
+{
+    // Takes effect with the next SetChunks, which regroups every batch
+    BatchVertices = FMath::Max(InBatchVertices, 1);
+}
+
+void UTerrainMeshComponent::SetChunks(TConstArrayView<FTerrainMeshChunk> Chunks, const FVector2D& Origin)
+{
+    const int32 Resolution = Chunks.Num() > 0 ? Chunks[0].Chunk->Resolution : SlotResolution;
+    const bool bRebase = Origin != RenderOrigin;
+    const bool bRecreateProxy = Resolution != SlotResolution || Chunks.Num() > SlotCapacity;
+    RenderOrigin = Origin;
+    SetRelativeLocation(FVector(Origin, 0.0));
+
+    TSet<FTerrainChunkKey> Wanted;
+    Wanted.Reserve(Chunks.Num());
+    for (const FTerrainMeshChunk& Chunk : Chunks)
+    {
+        Wanted.Add(Chunk.Key);
+    }
+
+    // A slot under every quadtree node above a chunk, freed ones included, so a chunk that replaces its
+    // parent or children lands next to them and batches keep a short slot range
+    TMap<FTerrainChunkKey, int32> NodeSlots;
+    auto AddNodeSlot = [&NodeSlots](FTerrainChunkKey Key, int32 Index)
+    {
+        for (; Key.Depth >= 0; Key = FTerrainChunkKey(Key.Depth - 1, FIntPoint(Key.Coord.X >> 1, Key.Coord.Y >> 1)))
+        {
+            NodeSlots.FindOrAdd(Key, Index);
+        }
+    };
+    for (const TPair<FTerrainChunkKey, FSlot>& Slot : Slots)
+    {
+        AddNodeSlot(Slot.Key, Slot.Value.Index);
+    }
+
+    // A freed slot is no longer drawn once its batch is updated, its vertices are simply left behind
+    for (TMap<FTerrainChunkKey, FSlot>::TIterator It = Slots.CreateIterator(); It; ++It)
+    {
+        if (!Wanted.Contains(It.Key()))
+        {
+            FreeSlot(It.Value().Index);
+            It.RemoveCurrent();
+        }
+    }
+
+    if (bRecreateProxy)
+    {
+        // Slots are handed out again from scratch and the new proxy uploads every one of them
+        SlotResolution = Resolution;
+        SlotCapacity = FMath::RoundUpToPowerOfTwo(FMath::Max(Chunks.Num(), 16));
+        Slots.Reset();
+        Batches.Reset();
+        NodeSlots.Reset();
+        FreeSlots.Reset();
+        for (int32 Index = 0; Index < SlotCapacity; ++Index)
+        {
+            FreeSlots.Add(Index);
+        }
+    }
+
+    TArray<FTerrainMeshSlotUpdate> SlotUpdates;
+    TSet<FTerrainChunkKey> Written;
+    LastUploadVertices = 0;
+    for (const FTerrainMeshChunk& Chunk : Chunks)
+    {
+        // Only meshed chunks of the slot resolution fit a slot
+        if (Chunk.Chunk->Resolution != SlotResolution || Chunk.Chunk->Vertices.Num() == 0)
+        {
+            continue;
+        }
+
+        FSlot* Slot = Slots.Find(Chunk.Key);
+        if (Slot && Slot->Chunk == Chunk.Chunk && !bRebase)
+        {
+            // Same vertices, at most the edges changed and that is up to the batch
+            Slot->Stitch = Chunk.Stitch;
+            continue;
+        }
+
+        if (!Slot)
+        {
+            int32 NearSlot = 0;
+            for (FTerrainChunkKey Node = Chunk.Key; Node.Depth >= 0; Node = FTerrainChunkKey(Node.Depth - 1, FIntPoint(Node.Coord.X >> 1, Node.Coord.Y >> 1)))
+            {
+                if (const int32* Found = NodeSlots.Find(Node))
+                {
+                    NearSlot = *Found;
+                    break;
+                }
+            }
+            Slot = &Slots.Add(Chunk.Key, {AllocateSlot(NearSlot), nullptr, ETerrainStitch::None, FBox(ForceInit)});
+            AddNodeSlot(Chunk.Key, Slot->Index);
+        }
+        Slot->Chunk = Chunk.Chunk;
+        Slot->Stitch = Chunk.Stitch;
+
+        float MinHeight = MAX_flt;
+        float MaxHeight = -MAX_flt;
+        for (float Height : Chunk.Chunk->Heights)
+        {
+            MinHeight = FMath::Min(MinHeight, Height);
+            MaxHeight = FMath::Max(MaxHeight, Height);
+        }
+        const FVector Offset = Chunk.Chunk->GetOrigin() - FVector(RenderOrigin, 0.0);
+        Slot->Bounds = FBox(Offset + FVector(0.0, 0.0, MinHeight), Offset + FVector(Chunk.Chunk->Desc.Size, Chunk.Chunk->Desc.Size, MaxHeight));
+
+        SlotUpdates.Add(MakeSlotUpdate(*Slot));
+        Written.Add(Chunk.Key);
+        LastUploadVertices += Chunk.Chunk->Vertices.Num();
+    }
+
+    TArray<FTerrainMeshBatchUpdate> BatchUpdates = UpdateBatches(Written);
+
+    LocalBounds.Init();
+    for (const TPair<FTerrainChunkKey, FSlot>& Slot : Slots)
+    {
+        LocalBounds += Slot.Value.Bounds;
+    }
+    UpdateBounds();
+
+    if (bRecreateProxy || !SceneProxy)
+    {
+        MarkRenderStateDirty();
+        return;
+    }
+
+    MarkRenderTransformDirty();
+    if (SlotUpdates.Num() > 0 || BatchUpdates.Num() > 0)
+    {
+        FTerrainMeshSceneProxy* Proxy = static_cast<FTerrainMeshSceneProxy*>(SceneProxy);
+        ENQUEUE_RENDER_COMMAND(UpdateTerrainMeshSlots)([Proxy, SlotUpdates = MoveTemp(SlotUpdates), BatchUpdates = MoveTemp(BatchUpdates)](FRHICommandListImmediate& RHICmdList)
+        {
+            Proxy->Update_RenderThread(RHICmdList, SlotUpdates, BatchUpdates);
+        });
+    }
+}
+
+TArray<FTerrainMeshBatchUpdate> UTerrainMeshComponent::UpdateBatches(const TSet<FTerrainChunkKey>& Written)
+{
+    auto GetParent = [](const FTerrainChunkKey& Key)
+    {
+        return FTerrainChunkKey(Key.Depth - 1, FIntPoint(Key.Coord.X >> 1, Key.Coord.Y >> 1));
+    };
+
+    // Displayed vertices under every quadtree node above a chunk
+    const int32 SlotVertices = FMath::Square(SlotResolution + 1);
+    TMap<FTerrainChunkKey, int32> NodeVertices;
+    for (const TPair<FTerrainChunkKey, FSlot>& Slot : Slots)
+    {
+        for (FTerrainChunkKey Node = Slot.Key; Node.Depth >= 0; Node = GetParent(Node))
+        {
+            NodeVertices.FindOrAdd(Node) += SlotVertices;
+        }
+    }
+
+    // A batch is the coarsest node that fits the target, so it covers one contiguous Morton range of the
+    // lattice. Changes only move the batches along their path: a node that grows past the target splits
+    // into its children and merges back once it fits again.
+    TMap<FTerrainChunkKey, TArray<FTerrainChunkKey>> Groups;
+    TArray<FTerrainChunkKey> Path;
+    for (const TPair<FTerrainChunkKey, FSlot>& Slot : Slots)
+    {
+        Path.Reset();
+        for (FTerrainChunkKey Node = Slot.Key; Node.Depth >= 0; Node = GetParent(Node))
+        {
+            Path.Add(Node);
+        }
+
+        FTerrainChunkKey Batch = Slot.Key;
+        for (int32 Index = Path.Num() - 1; Index > 0; --Index)
+        {
+            if (NodeVertices.FindChecked(Path[Index]) <= BatchVertices)
+            {
+                Batch = Path[Index];
+                break;
+            }
+        }
+        Groups.FindOrAdd(Batch).Add(Slot.Key);
+    }
+
+    const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(FMath::Max(SlotResolution, 1));
+    TMap<FTerrainChunkKey, FBatch> NewBatches;
+    NewBatches.Reserve(Groups.Num());
+    TArray<FTerrainMeshBatchUpdate> Updates;
+    LastUploadIndexBytes = 0;
+    for (TPair<FTerrainChunkKey, TArray<FTerrainChunkKey>>& Group : Groups)
+    {
+        const FTerrainChunkKey& BatchKey = Group.Key;
+        TArray<FTerrainChunkKey>& Members = Group.Value;
+
+        // Z-order inside the batch, on the lattice of its finest member
+        int32 MaxDepth = BatchKey.Depth;
+        for (const FTerrainChunkKey& Member : Members)
+        {
+            MaxDepth = FMath::Max(MaxDepth, Member.Depth);
+        }
+        auto GetMortonCode = [&BatchKey, MaxDepth](const FTerrainChunkKey& Key)
+        {
+            const int32 Shift = Key.Depth - BatchKey.Depth;
+            const uint32 X = uint32(Key.Coord.X - (BatchKey.Coord.X << Shift)) << (MaxDepth - Key.Depth);
+            const uint32 Y = uint32(Key.Coord.Y - (BatchKey.Coord.Y << Shift)) << (MaxDepth - Key.Depth);
+            return FMath::MortonCode2(X) | (FMath::MortonCode2(Y) << 1);
+        };
+        Members.Sort([&GetMortonCode](const FTerrainChunkKey& A, const FTerrainChunkKey& B) { return GetMortonCode(A) < GetMortonCode(B); });
+
+        FBatch& Batch = NewBatches.Add(BatchKey);
+        bool bWritten = false;
+        int32 FirstSlot = MAX_int32;
+        int32 LastSlot = 0;
+        int32 NumIndices = 0;
+        for (const FTerrainChunkKey& Member : Members)
+        {
+            const FSlot& Slot = Slots.FindChecked(Member);
+            Batch.Members.Emplace(Slot.Index, Slot.Stitch);
+            Batch.Bounds += Slot.Bounds;
+            bWritten |= Written.Contains(Member);
+            FirstSlot = FMath::Min(FirstSlot, Slot.Index);
+            LastSlot = FMath::Max(LastSlot, Slot.Index);
+            NumIndices += Layout.Indices[uint8(Slot.Stitch)].Num();
+        }
+
+        // Unchanged batches keep their index buffer, rewritten members may have moved their bounds.
+        // A lone chunk reuses the shared buffer of its stitch and builds no indices.
+        const FBatch* Existing = Batches.Find(BatchKey);
+        if (!Existing || bWritten || Existing->Members != Batch.Members)
+        {
+            Updates.Add(MakeBatchUpdate(BatchKey, Batch));
+            if (Members.Num() > 1)
+            {
+                LastUploadIndexBytes += NumIndices * ((LastSlot - FirstSlot + 1) * SlotVertices <= MAX_uint16 + 1 ? sizeof(uint16) : sizeof(uint32));
+            }
+        }
+    }
+
+    for (const TPair<FTerrainChunkKey, FBatch>& Batch : Batches)
+    {
+        if (!NewBatches.Contains(Batch.Key))
+        {
+            Updates.Add({Batch.Key, {}, FBox3f(ForceInit)});
+        }
+    }
+
+    Batches = MoveTemp(NewBatches);
+    return Updates;
+}
+
+int32 UTerrainMeshComponent::AllocateSlot(int32 NearSlot)
+{
+    // Nearest free slot on either side
+    int32 Position = Algo::LowerBound(FreeSlots, NearSlot);
+    if (Position == FreeSlots.Num() || (Position > 0 && NearSlot - FreeSlots[Position - 1] < FreeSlots[Position] - NearSlot))
+    {
+        --Position;
+    }
+    const int32 Index = FreeSlots[Position];
+    FreeSlots.RemoveAt(Position, 1, false);
+    return Index;
+}
+
+void UTerrainMeshComponent::FreeSlot(int32 Index)
+{
+    FreeSlots.Insert(Index, Algo::LowerBound(FreeSlots, Index));
+}
+
+void UTerrainMeshComponent::ClearChunks()
+{
+    Slots.Reset();
+    Batches.Reset();
+    FreeSlots.Reset();
+    SlotCapacity = 0;
+    LocalBounds.Init();
+    UpdateBounds();
+    MarkRenderStateDirty();
+}
+
+FTerrainMeshSlotUpdate UTerrainMeshComponent::MakeSlotUpdate(const FSlot& Slot) const
+{
+    FTerrainMeshSlotUpdate Update;
+    Update.Index = Slot.Index;
+    Update.Chunk = Slot.Chunk;
+
+    // Narrowed only after the origin is taken off
+    Update.Offset = FVector3f(Slot.Chunk->GetOrigin() - FVector(RenderOrigin, 0.0));
+    return Update;
+}
+
+FTerrainMeshBatchUpdate UTerrainMeshComponent::MakeBatchUpdate(const FTerrainChunkKey& Key, const FBatch& Batch) const
+{
+    return {Key, Batch.Members, FBox3f(Batch.Bounds)};
+}
+
+FPrimitiveSceneProxy* UTerrainMeshComponent::CreateSceneProxy()
+{
+    return SlotCapacity > 0 ? new FTerrainMeshSceneProxy(this) : nullptr;
+}
+
+FBoxSphereBounds UTerrainMeshComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+    if (!LocalBounds.IsValid)
+    {
+        return FBoxSphereBounds(LocalToWorld.GetLocation(), FVector::ZeroVector, 0.0);
+    }
+    return FBoxSphereBounds(LocalBounds.TransformBy(LocalToWorld));
+}
@@ -0,0 +1,99 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/MeshComponent.h"
+#include "TerrainChunk.h"
+
+#include "TerrainMeshComponent.generated.h"
+
+struct FTerrainMeshSlotUpdate;
+struct FTerrainMeshBatchUpdate;
+
+// A chunk shown by the terrain mesh and the coarser edges it has to stitch to
+struct FTerrainMeshChunk
+{
+    FTerrainChunkKey Key;
+    FTerrainChunkPtr Chunk;
+    ETerrainStitch Stitch {ETerrainStitch::None};
+};
+
+// Renders terrain chunks out of persistent GPU vertex buffers with one fixed slot per chunk.
+//
+// Unlike UProceduralMeshComponent the scene proxy survives mesh updates: only chunks that appear
+// are written, in place, by a render command, and packed vertices are expanded straight into the
+// locked buffers. Chunks are drawn in batches, one per quadtree node holding up to the target vertex
+// count, so draw calls stay bounded while a change only rebuilds the indices of the batches it touches.
+// Running under -nullrhi exercises the same code.
+UCLASS()
+class SANDBOX_API UTerrainMeshComponent : public UMeshComponent
+{
+    GENERATED_BODY()
+
+public:
+    UTerrainMeshComponent();
+
+    // Makes Chunks the displayed set. Vertices are written relative to Origin, which is also where the
+    // component is placed; moving it rewrites every slot, otherwise only new or restitched chunks are sent.
+    void SetChunks(TConstArrayView<FTerrainMeshChunk> Chunks, const FVector2D& Origin);
+    void ClearChunks();
+
+    // Vertices a batch may gather before it splits into its quadtree children, one chunk at the least
+    void SetBatchVertices(int32 InBatchVertices);
+
+    int32 GetNumChunks() const { return Slots.Num(); }
+    int32 GetSlotCapacity() const { return SlotCapacity; }
+    int32 GetNumBatches() const { return Batches.Num(); }
+
+    // Vertices written to the GPU by the last SetChunks
+    int32 GetLastUploadVertices() const { return LastUploadVertices; }
+
+    // Index data rebuilt for the batches the last SetChunks touched
+    SIZE_T GetLastUploadIndexBytes() const { return LastUploadIndexBytes; }
+
+    // What the GPU buffers take per vertex: position, tangent basis, UV and colour
+    static SIZE_T GetGPUVertexBytes();
+
+    virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
+    virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+    virtual int32 GetNumMaterials() const override { return 1; }
+
+private:
+    friend class FTerrainMeshSceneProxy;
+
+    struct FSlot
+    {
+        int32 Index;
+        FTerrainChunkPtr Chunk;
+        ETerrainStitch Stitch;
+
+        // Relative to the component
+        FBox Bounds;
+    };
+
+    // Chunks drawn together, in Z-order, as slot and stitch
+    struct FBatch
+    {
+        TArray<TPair<int32, ETerrainStitch>> Members;
+        FBox Bounds {ForceInit};
+    };
+
+    // Regroups the slots and returns the batches that changed, Written holds chunks whose vertices were just sent
+    TArray<FTerrainMeshBatchUpdate> UpdateBatches(const TSet<FTerrainChunkKey>& Written);
+    int32 AllocateSlot(int32 NearSlot);
+    void FreeSlot(int32 Index);
+    FTerrainMeshSlotUpdate MakeSlotUpdate(const FSlot& Slot) const;
+    FTerrainMeshBatchUpdate MakeBatchUpdate(const FTerrainChunkKey& Key, const FBatch& Batch) const;
+
+    TMap<FTerrainChunkKey, FSlot> Slots;
+    TMap<FTerrainChunkKey, FBatch> Batches;
+
+    // Ascending, so a new chunk can take the free slot nearest to its quadtree neighbours
+    TArray<int32> FreeSlots;
+    int32 SlotCapacity {0};
+    int32 SlotResolution {0};
+    FVector2D RenderOrigin {FVector2D::ZeroVector};
+    FBox LocalBounds {ForceInit};
+    int32 BatchVertices {65536};
+    int32 LastUploadVertices {0};
+    SIZE_T LastUploadIndexBytes {0};
+};
@@ -0,0 +1,282 @@
+﻿#include "TerrainPatchInstancesComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/Texture2D.h"
+#include "Materials/MaterialInstanceDynamic.h"
+#include "MeshDescription.h"
+#include "MeshDescriptionBuilder.h"
+#include "QuadTreeStats.h"
+#include "StaticMeshAttributes.h"
+
+DECLARE_CYCLE_STAT(TEXT("Patches: Update Instances"), STAT_QuadTree_UpdatePatches, STATGROUP_QuadTree);
+DECLARE_MEMORY_STAT(TEXT("Height Atlas Memory"), STAT_QuadTree_HeightAtlasMemory, STATGROUP_QuadTree);
+
+// Atlas slot, morph factor and coarser edges
+static constexpr int32 NumPatchCustomData = 3;
+
+static constexpr float MorphSteps = 256.0f;
+
+UTerrainPatchInstancesComponent::UTerrainPatchInstancesComponent()
+{
+    PrimaryComponentTick.bCanEverTick = false;
+    SetCollisionEnabled(ECollisionEnabled::NoCollision);
+    SetGenerateOverlapEvents(false);
+    NumCustomDataFloats = NumPatchCustomData;
+
+    // Removal moves the last instance into the gap, so indices of the others stay put
+    bSupportRemoveAtSwap = true;
+}
+
+void UTerrainPatchInstancesComponent::SetPatchMaterial(UMaterialInterface* InMaterial)
+{
+    if (BaseMaterial == InMaterial)
+    {
+        return;
+    }
+
+    BaseMaterial = InMaterial;
+    PatchMaterial = BaseMaterial ? UMaterialInstanceDynamic::Create(BaseMaterial, this) : nullptr;
+    if (PatchMaterial && HeightAtlas)
+    {
+        PatchMaterial->SetTextureParameterValue(TEXT("HeightAtlas"), HeightAtlas);
+        PatchMaterial->SetScalarParameterValue(TEXT("AtlasSlotsPerSide"), AtlasSlotsPerSide);
+        PatchMaterial->SetScalarParameterValue(TEXT("PatchGridSize"), PatchResolution + 1);
+    }
+    SetMaterial(0, PatchMaterial);
+}
+
+SIZE_T UTerrainPatchInstancesComponent::GetAtlasBytes() const
+{
+    return HeightAtlas ? SIZE_T(HeightAtlas->GetSizeX()) * HeightAtlas->GetSizeY() * sizeof(float) : 0;
+}
+
+SIZE_T UTerrainPatchInstancesComponent::GetInstanceBytes() const
+{
+    return sizeof(FInstancedStaticMeshInstanceData) + NumCustomDataFloats * sizeof(float);
+}
+
+void UTerrainPatchInstancesComponent::SetPatches(TConstArrayView<FTerrainPatchInstance> InPatches, const FVector2D& Origin, float HeightExtent)
+{
+    SCOPE_CYCLE_COUNTER(STAT_QuadTree_UpdatePatches);
+
+    const int32 Resolution = InPatches.Num() > 0 ? InPatches[0].Chunk->Resolution : PatchResolution;
+    const bool bRebase = Origin != RenderOrigin;
+    RenderOrigin = Origin;
+    SetRelativeLocation(FVector(Origin, 0.0));
+    LastUploadTexels = 0;
+
+    // A new patch shape or a full atlas starts over, every chunk uploads again
+    if (!PatchMesh || Resolution != PatchResolution || HeightExtent != PatchHeightExtent)
+    {
+        BuildPatchMesh(Resolution, HeightExtent);
+        CreateAtlas(FMath::Max(InPatches.Num(), FMath::Square(AtlasSlotsPerSide)));
+    }
+    else if (InPatches.Num() > FMath::Square(AtlasSlotsPerSide))
+    {
+        CreateAtlas(InPatches.Num());
+    }
+
+    TSet<FTerrainChunkKey> Wanted;
+    Wanted.Reserve(InPatches.Num());
+    for (const FTerrainPatchInstance& Patch : InPatches)
+    {
+        Wanted.Add(Patch.Key);
+    }
+
+    for (TMap<FTerrainChunkKey, FPatch>::TIterator It = Patches.CreateIterator(); It; ++It)
+    {
+        if (!Wanted.Contains(It.Key()))
+        {
+            FreeAtlasSlots.Add(It.Value().AtlasSlot);
+            RemovePatchInstance(It.Value().Instance);
+            It.RemoveCurrent();
+        }
+    }
+
+    const int32 GridSize = PatchResolution + 1;
+    TArray<TPair<int32, FTerrainChunkPtr>> Uploads;
+    bool bAnyChanged = bRebase;
+    for (const FTerrainPatchInstance& Patch : InPatches)
+    {
+        const FTerrainChunkData& Chunk = *Patch.Chunk;
+        if (Chunk.Resolution != PatchResolution || Chunk.Heights.Num() != GridSize * GridSize)
+        {
+            continue;
+        }
+
+        // Offset in double first, as for the slot mesh
+        const FTransform Transform(FQuat::Identity, Chunk.GetOrigin() - FVector(RenderOrigin, 0.0), FVector(Chunk.Desc.Size, Chunk.Desc.Size, 1.0));
+        // Morph in 1/256 steps, so observer moves too small to show do not touch the instance
+        const float Morph = FMath::RoundToFloat(Patch.Morph * MorphSteps) / MorphSteps;
+        FPatch* Existing = Patches.Find(Patch.Key);
+        bool bCustomDataChanged = true;
+        if (!Existing)
+        {
+            const int32 Instance = AddInstance(Transform);
+            check(Instance == InstanceKeys.Num());
+            InstanceKeys.Add(Patch.Key);
+            Existing = &Patches.Add(Patch.Key, {Instance, FreeAtlasSlots.Pop(false), Patch.Chunk, Morph, Patch.CoarserEdges});
+            Uploads.Emplace(Existing->AtlasSlot, Patch.Chunk);
+        }
+        else
+        {
+            if (Existing->Chunk != Patch.Chunk)
+            {
+                Existing->Chunk = Patch.Chunk;
+                Uploads.Emplace(Existing->AtlasSlot, Patch.Chunk);
+            }
+            if (bRebase)
+            {
+                UpdateInstanceTransform(Existing->Instance, Transform, false, false);
+            }
+            bCustomDataChanged = Existing->Morph != Morph || Existing->CoarserEdges != Patch.CoarserEdges;
+            Existing->Morph = Morph;
+            Existing->CoarserEdges = Patch.CoarserEdges;
+        }
+
+        if (bCustomDataChanged)
+        {
+            const float CustomData[NumPatchCustomData] = {float(Existing->AtlasSlot), Morph, float(uint8(Patch.CoarserEdges))};
+            SetCustomData(Existing->Instance, MakeArrayView(CustomData), false);
+            bAnyChanged = true;
+        }
+    }
+
+    UploadHeights(Uploads);
+
+    // Every change of this call goes to the render thread in one render state update, none when nothing changed.
+    // Instances that came or went already marked it.
+    if (bAnyChanged)
+    {
+        MarkRenderStateDirty();
+    }
+}
+
+void UTerrainPatchInstancesComponent::ClearPatches()
+{
+    ClearInstances();
+    Patches.Reset();
+    InstanceKeys.Reset();
+    FreeAtlasSlots.Reset();
+    for (int32 Slot = FMath::Square(AtlasSlotsPerSide) - 1; Slot >= 0; --Slot)
+    {
+        FreeAtlasSlots.Add(Slot);
+    }
+}
+
+void UTerrainPatchInstancesComponent::BuildPatchMesh(int32 Resolution, float HeightExtent)
+{
+    PatchResolution = Resolution;
+    PatchHeightExtent = HeightExtent;
+    const int32 GridSize = Resolution + 1;
+
+    FMeshDescription MeshDescription;
+    FStaticMeshAttributes Attributes(MeshDescription);
+    Attributes.Register();
+
+    FMeshDescriptionBuilder Builder;
+    Builder.SetMeshDescription(&MeshDescription);
+    Builder.EnablePolyGroups();
+    Builder.SetNumUVLayers(1);
+
+    // Same vertex layout and triangle order as the chunk meshes
+    const FTerrainPatchLayout& Layout = GetTerrainPatchLayout(Resolution);
+    TArray<FVertexID> VertexIDs;
+    VertexIDs.Reserve(Layout.VertexToGrid.Num());
+    for (int32 GridIndex : Layout.VertexToGrid)
+    {
+        VertexIDs.Add(Builder.AppendVertex(FVector(GridIndex % GridSize, GridIndex / GridSize, 0.0) / Resolution));
+    }
+
+    const TArray<int32>& Indices = Layout.Indices[uint8(ETerrainStitch::None)];
+    const FPolygonGroupID PolygonGroup = Builder.AppendPolygonGroup();
+    for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+    {
+        FVertexInstanceID Corners[3];
+        for (int32 Corner = 0; Corner < 3; ++Corner)
+        {
+            const int32 Vertex = Indices[Index + Corner];
+            const int32 GridIndex = Layout.VertexToGrid[Vertex];
+            Corners[Corner] = Builder.AppendInstance(VertexIDs[Vertex]);
+            Builder.SetInstanceNormal(Corners[Corner], FVector::UpVector);
+            Builder.SetInstanceUV(Corners[Corner], FVector2D(GridIndex % GridSize, GridIndex / GridSize) / Resolution, 0);
+        }
+        Builder.AppendTriangle(Corners[0], Corners[1], Corners[2], PolygonGroup);
+    }
+
+    PatchMesh = NewObject<UStaticMesh>(this, NAME_None, RF_Transient);
+    PatchMesh->GetStaticMaterials().Add(FStaticMaterial());
+
+    // The patch is flat until the material displaces it
+    PatchMesh->SetPositiveBoundsExtension(FVector(0.0, 0.0, HeightExtent));
+    PatchMesh->SetNegativeBoundsExtension(FVector(0.0, 0.0, HeightExtent));
+
+    UStaticMesh::FBuildMeshDescriptionsParams Params;
+    Params.bBuildSimpleCollision = false;
+    Params.bFastBuild = true;
+    PatchMesh->BuildFromMeshDescriptions({&MeshDescription}, Params);
+    SetStaticMesh(PatchMesh);
+}
+
+void UTerrainPatchInstancesComponent::CreateAtlas(int32 Capacity)
+{
+    const int32 GridSize = PatchResolution + 1;
+    AtlasSlotsPerSide = FMath::Max(1, int32(FMath::RoundUpToPowerOfTwo(FMath::CeilToInt(FMath::Sqrt(float(FMath::Max(Capacity, 64)))))));
+
+    HeightAtlas = UTexture2D::CreateTransient(AtlasSlotsPerSide * GridSize, AtlasSlotsPerSide * GridSize, PF_R32_FLOAT, TEXT("TerrainHeightAtlas"));
+    HeightAtlas->Filter = TF_Nearest;
+    HeightAtlas->SRGB = false;
+    HeightAtlas->CompressionSettings = TC_HDR;
+    HeightAtlas->UpdateResource();
+    SET_MEMORY_STAT(STAT_QuadTree_HeightAtlasMemory, GetAtlasBytes());
+
+    if (PatchMaterial)
+    {
+        PatchMaterial->SetTextureParameterValue(TEXT("HeightAtlas"), HeightAtlas);
+        PatchMaterial->SetScalarParameterValue(TEXT("AtlasSlotsPerSide"), AtlasSlotsPerSide);
+        PatchMaterial->SetScalarParameterValue(TEXT("PatchGridSize"), GridSize);
+    }
+
+    // Every slot of the old atlas is gone with it
+    ClearPatches();
+}
+
+void UTerrainPatchInstancesComponent::RemovePatchInstance(int32 Instance)
+{
+    RemoveInstance(Instance);
+
+    const int32 Last = InstanceKeys.Num() - 1;
+    if (Instance != Last)
+    {
+        InstanceKeys[Instance] = InstanceKeys[Last];
+        Patches.FindChecked(InstanceKeys[Instance]).Instance = Instance;
+    }
+    InstanceKeys.Pop(false);
+}
+
+void UTerrainPatchInstancesComponent::UploadHeights(TConstArrayView<TPair<int32, FTerrainChunkPtr>> Uploads)
+{
+    if (Uploads.Num() == 0 || !HeightAtlas)
+    {
+        return;
+    }
+
+    // All new chunks go in one call, stacked in a single source buffer that the render thread frees
+    const int32 GridSize = PatchResolution + 1;
+    const int32 NumTexels = GridSize * GridSize;
+    float* Heights = new float[NumTexels * Uploads.Num()];
+    FUpdateTextureRegion2D* Regions = new FUpdateTextureRegion2D[Uploads.Num()];
+    for (int32 Index = 0; Index < Uploads.Num(); ++Index)
+    {
+        const int32 Slot = Uploads[Index].Key;
+        FMemory::Memcpy(Heights + Index * NumTexels, Uploads[Index].Value->Heights.GetData(), NumTexels * sizeof(float));
+        Regions[Index] = FUpdateTextureRegion2D((Slot % AtlasSlotsPerSide) * GridSize, (Slot / AtlasSlotsPerSide) * GridSize, 0, Index * GridSize, GridSize, GridSize);
+    }
+
+    HeightAtlas->UpdateTextureRegions(0, Uploads.Num(), Regions, GridSize * sizeof(float), sizeof(float), reinterpret_cast<uint8*>(Heights),
+        [](uint8* SrcData, const FUpdateTextureRegion2D* SrcRegions)
+        {
+            delete[] reinterpret_cast<float*>(SrcData);
+            delete[] SrcRegions;
+        });
+    LastUploadTexels = NumTexels * Uploads.Num();
+}
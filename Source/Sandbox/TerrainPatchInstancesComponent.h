@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "TerrainChunk.h"
+
+#include "TerrainPatchInstancesComponent.generated.h"
+
+class UMaterialInstanceDynamic;
+class UTexture2D;
+
+// A chunk drawn as an instance of the shared patch, how far it has morphed towards its parent and
+// which of its edges meet a coarser neighbour
+struct FTerrainPatchInstance
+{
+    FTerrainChunkKey Key;
+    FTerrainChunkPtr Chunk;
+    float Morph {0.0f};
+    ETerrainStitch CoarserEdges {ETerrainStitch::None};
+};
+
+// Renders terrain as one shared flat grid patch drawn through instancing. Chunks only contribute
+// their height samples, copied into one slot of a float height atlas.
+//
+// Each instance is placed and scaled over its chunk, and carries three custom data floats: the atlas
+// slot, the LOD morph factor and the ETerrainStitch bits of its edges that meet a coarser neighbour.
+// The material does the rest in its world position offset. It reads the texture parameter HeightAtlas
+// and the scalars AtlasSlotsPerSide and PatchGridSize. UV0 is the position inside the patch in [0, 1],
+// so a vertex reads texel Slot * PatchGridSize + UV0 * (PatchGridSize - 1). Odd vertices along a
+// flagged edge take the mean of their two even neighbours whatever the morph, as the slot mesh
+// stitches them, so no T-junction opens against the coarser patch.
+UCLASS()
+class SANDBOX_API UTerrainPatchInstancesComponent : public UInstancedStaticMeshComponent
+{
+    GENERATED_BODY()
+
+public:
+    UTerrainPatchInstancesComponent();
+
+    void SetPatchMaterial(UMaterialInterface* InMaterial);
+
+    // Makes Patches the displayed set, placed relative to Origin like the slot mesh. Only chunks new to
+    // the set upload heights, the rest just refresh custom data that changed. All of it reaches the
+    // render thread in at most one render state update per call. HeightExtent pads the flat patch bounds.
+    void SetPatches(TConstArrayView<FTerrainPatchInstance> InPatches, const FVector2D& Origin, float HeightExtent);
+    void ClearPatches();
+
+    int32 GetNumPatches() const { return Patches.Num(); }
+
+    // Height samples sent to the atlas by the last SetPatches
+    int32 GetLastUploadTexels() const { return LastUploadTexels; }
+    SIZE_T GetAtlasBytes() const;
+    SIZE_T GetInstanceBytes() const;
+
+private:
+    struct FPatch
+    {
+        int32 Instance;
+        int32 AtlasSlot;
+        FTerrainChunkPtr Chunk;
+
+        // Last sent as custom data
+        float Morph;
+        ETerrainStitch CoarserEdges;
+    };
+
+    void BuildPatchMesh(int32 Resolution, float HeightExtent);
+    void CreateAtlas(int32 Capacity);
+    void RemovePatchInstance(int32 Instance);
+    void UploadHeights(TConstArrayView<TPair<int32, FTerrainChunkPtr>> Uploads);
+
+    UPROPERTY(Transient)
+    UStaticMesh* PatchMesh {nullptr};
+
+    UPROPERTY(Transient)
+    UTexture2D* HeightAtlas {nullptr};
+
+    UPROPERTY(Transient)
+    UMaterialInstanceDynamic* PatchMaterial {nullptr};
+
+    UPROPERTY(Transient)
+    UMaterialInterface* BaseMaterial {nullptr};
+
+    TMap<FTerrainChunkKey, FPatch> Patches;
+
+    // Key of every instance, in instance order
+    TArray<FTerrainChunkKey> InstanceKeys;
+    TArray<int32> FreeAtlasSlots;
+    int32 AtlasSlotsPerSide {0};
+    int32 PatchResolution {0};
+    float PatchHeightExtent {0.0f};
+    FVector2D RenderOrigin {FVector2D::ZeroVector};
+    int32 LastUploadTexels {0};
+};
@@ -0,0 +1,116 @@
+﻿#include "TerrainQuadTreeSnapshot.h"
+
+FTerrainQuadTreeSnapshot::FTerrainQuadTreeSnapshot(TArray<FNode> InNodes, int32 InNumRoots, const FVector& InOrigin)
+    : Nodes(MoveTemp(InNodes)), NumRoots(InNumRoots), Origin(InOrigin)
+{
+    for (const FNode& Node : Nodes)
+    {
+        NumLeaves += Node.FirstChild == INDEX_NONE ? 1 : 0;
+    }
+}
+
+template <typename OverlapsType>
+void FTerrainQuadTreeSnapshot::CollectLeaves(OverlapsType&& Overlaps, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    TArray<int32, TInlineAllocator<64>> Stack;
+    for (int32 Index = NumRoots - 1; Index >= 0; --Index)
+    {
+        Stack.Add(Index);
+    }
+
+    while (Stack.Num() > 0)
+    {
+        const FNode& Node = Nodes[Stack.Pop(false)];
+        if (!Overlaps(Node.Bounds))
+        {
+            continue;
+        }
+
+        if (Node.FirstChild == INDEX_NONE)
+        {
+            OutLeaves.Add(MakeLeaf(Node));
+            continue;
+        }
+
+        for (int32 Child = 3; Child >= 0; --Child)
+        {
+            Stack.Add(Node.FirstChild + Child);
+        }
+    }
+}
+
+FTerrainLeaf FTerrainQuadTreeSnapshot::MakeLeaf(const FNode& Node) const
+{
+    return {Node.Key, Node.Bounds.ShiftBy(Origin), Node.bOccluded};
+}
+
+void FTerrainQuadTreeSnapshot::GetLeavesInBox(const FBox& Box, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    const FBox LocalBox = Box.ShiftBy(-Origin);
+    CollectLeaves([&LocalBox](const FBox& Bounds) { return Bounds.Intersect(LocalBox); }, OutLeaves);
+}
+
+void FTerrainQuadTreeSnapshot::GetLeavesInSphere(const FVector& Center, double Radius, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    const FVector LocalCenter = Center - Origin;
+    const double RadiusSquared = FMath::Square(Radius);
+    CollectLeaves([&LocalCenter, RadiusSquared](const FBox& Bounds) { return Bounds.ComputeSquaredDistanceToPoint(LocalCenter) <= RadiusSquared; }, OutLeaves);
+}
+
+void FTerrainQuadTreeSnapshot::GetLeavesAlongRay(const FVector& Start, const FVector& End, TArray<FTerrainLeaf>& OutLeaves) const
+{
+    const FVector LocalStart = Start - Origin;
+    const FVector Delta = End - Start;
+
+    // Slab test against the segment, remembering where each leaf is entered to sort by it afterwards
+    auto GetEntry = [&Delta](const FBox& Bounds, const FVector& From, double& OutEntry)
+    {
+        double Enter = 0.0;
+        double Exit = 1.0;
+        for (int32 Axis = 0; Axis < 3; ++Axis)
+        {
+            if (FMath::IsNearlyZero(Delta[Axis]))
+            {
+                if (From[Axis] < Bounds.Min[Axis] || From[Axis] > Bounds.Max[Axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            const double InvDelta = 1.0 / Delta[Axis];
+            double Near = (Bounds.Min[Axis] - From[Axis]) * InvDelta;
+            double Far = (Bounds.Max[Axis] - From[Axis]) * InvDelta;
+            if (Near > Far)
+            {
+                Swap(Near, Far);
+            }
+            Enter = FMath::Max(Enter, Near);
+            Exit = FMath::Min(Exit, Far);
+            if (Enter > Exit)
+            {
+                return false;
+            }
+        }
+        OutEntry = Enter;
+        return true;
+    };
+
+    const int32 FirstLeaf = OutLeaves.Num();
+    double Entry = 0.0;
+    CollectLeaves([&GetEntry, &LocalStart, &Entry](const FBox& Bounds) { return GetEntry(Bounds, LocalStart, Entry); }, OutLeaves);
+
+    TArray<TPair<double, FTerrainLeaf>> Sorted;
+    Sorted.Reserve(OutLeaves.Num() - FirstLeaf);
+    for (int32 Index = FirstLeaf; Index < OutLeaves.Num(); ++Index)
+    {
+        const FTerrainLeaf& Leaf = OutLeaves[Index];
+        GetEntry(Leaf.Bounds, Start, Entry);
+        Sorted.Emplace(Entry, Leaf);
+    }
+    Sorted.Sort([](const TPair<double, FTerrainLeaf>& A, const TPair<double, FTerrainLeaf>& B) { return A.Key < B.Key; });
+    for (int32 Index = 0; Index < Sorted.Num(); ++Index)
+    {
+        OutLeaves[FirstLeaf + Index] = Sorted[Index].Value;
+    }
+}
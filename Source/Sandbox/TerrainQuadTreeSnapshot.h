@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainChunk.h"
+
+// A leaf of the LOD quadtree as seen by a spatial query
+struct FTerrainLeaf
+{
+    FTerrainChunkKey Key;
+
+    // World space, heights padded like the occlusion bounds
+    FBox Bounds {ForceInit};
+
+    // Behind the horizon and not drawn
+    bool bOccluded {false};
+};
+
+// Immutable copy of the LOD quadtree taken after a LOD pass, with the node bounds flattened into one
+// array. Queries walk it from the root tiles and skip every subtree whose bounds miss, so their cost
+// follows the number of leaves found rather than the size of the tree.
+// Safe to use from any thread and stays unchanged while the live tree moves on.
+class FTerrainQuadTreeSnapshot
+{
+public:
+    struct FNode
+    {
+        // Terrain space
+        FBox Bounds {ForceInit};
+        FTerrainChunkKey Key;
+
+        // The four children are stored together from here, none for a leaf
+        int32 FirstChild {INDEX_NONE};
+        bool bOccluded {false};
+    };
+
+    // Roots come first in Nodes. Origin is the world location of the terrain's local (0, 0, 0).
+    FTerrainQuadTreeSnapshot(TArray<FNode> InNodes, int32 InNumRoots, const FVector& InOrigin);
+
+    // Leaves are appended to OutLeaves, which is not reset
+    void GetLeavesInBox(const FBox& Box, TArray<FTerrainLeaf>& OutLeaves) const;
+    void GetLeavesInSphere(const FVector& Center, double Radius, TArray<FTerrainLeaf>& OutLeaves) const;
+
+    // Leaves the segment passes through, nearest first
+    void GetLeavesAlongRay(const FVector& Start, const FVector& End, TArray<FTerrainLeaf>& OutLeaves) const;
+
+    int32 GetNumNodes() const { return Nodes.Num(); }
+    int32 GetNumLeaves() const { return NumLeaves; }
+
+private:
+    // Visits every leaf whose bounds pass Overlaps, which sees terrain space bounds
+    template <typename OverlapsType>
+    void CollectLeaves(OverlapsType&& Overlaps, TArray<FTerrainLeaf>& OutLeaves) const;
+
+    FTerrainLeaf MakeLeaf(const FNode& Node) const;
+
+    TArray<FNode> Nodes;
+    int32 NumRoots;
+    int32 NumLeaves {0};
+    FVector Origin;
+};
+
+using FTerrainQuadTreeSnapshotPtr = TSharedPtr<const FTerrainQuadTreeSnapshot, ESPMode::ThreadSafe>;